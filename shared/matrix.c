@@ -28,6 +28,12 @@
 #include <stdlib.h>
 #include <math.h>
 
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
 #ifdef IN_WESTON
 #include <wayland-server.h>
 #else
@@ -61,6 +67,38 @@ WL_EXPORT void
 weston_matrix_multiply(struct weston_matrix *m, const struct weston_matrix *n)
 {
 	struct weston_matrix tmp;
+#if defined(__SSE__)
+	__m128 n0 = _mm_loadu_ps(&n->d[0]);
+	__m128 n1 = _mm_loadu_ps(&n->d[4]);
+	__m128 n2 = _mm_loadu_ps(&n->d[8]);
+	__m128 n3 = _mm_loadu_ps(&n->d[12]);
+	__m128 r;
+	int i;
+
+	/* Column i of the result is n times column i of m. */
+	for (i = 0; i < 16; i += 4) {
+		r = _mm_mul_ps(n0, _mm_set1_ps(m->d[i]));
+		r = _mm_add_ps(r, _mm_mul_ps(n1, _mm_set1_ps(m->d[i + 1])));
+		r = _mm_add_ps(r, _mm_mul_ps(n2, _mm_set1_ps(m->d[i + 2])));
+		r = _mm_add_ps(r, _mm_mul_ps(n3, _mm_set1_ps(m->d[i + 3])));
+		_mm_storeu_ps(&tmp.d[i], r);
+	}
+#elif defined(__ARM_NEON__)
+	float32x4_t n0 = vld1q_f32(&n->d[0]);
+	float32x4_t n1 = vld1q_f32(&n->d[4]);
+	float32x4_t n2 = vld1q_f32(&n->d[8]);
+	float32x4_t n3 = vld1q_f32(&n->d[12]);
+	float32x4_t r;
+	int i;
+
+	for (i = 0; i < 16; i += 4) {
+		r = vmulq_n_f32(n0, m->d[i]);
+		r = vaddq_f32(r, vmulq_n_f32(n1, m->d[i + 1]));
+		r = vaddq_f32(r, vmulq_n_f32(n2, m->d[i + 2]));
+		r = vaddq_f32(r, vmulq_n_f32(n3, m->d[i + 3]));
+		vst1q_f32(&tmp.d[i], r);
+	}
+#else
 	const float *row, *column;
 	div_t d;
 	int i, j;
@@ -73,6 +111,7 @@ weston_matrix_multiply(struct weston_matrix *m, const struct weston_matrix *n)
 		for (j = 0; j < 4; j++)
 			tmp.d[i] += row[j] * column[j * 4];
 	}
+#endif
 	tmp.type = m->type | n->type;
 	memcpy(m, &tmp, sizeof tmp);
 }
@@ -114,16 +153,58 @@ weston_matrix_rotate_xy(struct weston_matrix *matrix, float cos, float sin)
 WL_EXPORT void
 weston_matrix_transform(struct weston_matrix *matrix, struct weston_vector *v)
 {
-	int i, j;
-	struct weston_vector t;
+	weston_matrix_transform_points(matrix, v, 1);
+}
 
-	for (i = 0; i < 4; i++) {
-		t.f[i] = 0;
-		for (j = 0; j < 4; j++)
-			t.f[i] += v->f[j] * matrix->d[i + j * 4];
+/* v[i] <- m * v[i], for count vectors */
+WL_EXPORT void
+weston_matrix_transform_points(struct weston_matrix *matrix,
+			       struct weston_vector *v, int count)
+{
+#if defined(__SSE__)
+	__m128 m0 = _mm_loadu_ps(&matrix->d[0]);
+	__m128 m1 = _mm_loadu_ps(&matrix->d[4]);
+	__m128 m2 = _mm_loadu_ps(&matrix->d[8]);
+	__m128 m3 = _mm_loadu_ps(&matrix->d[12]);
+	__m128 r;
+	int k;
+
+	for (k = 0; k < count; k++) {
+		r = _mm_mul_ps(m0, _mm_set1_ps(v[k].f[0]));
+		r = _mm_add_ps(r, _mm_mul_ps(m1, _mm_set1_ps(v[k].f[1])));
+		r = _mm_add_ps(r, _mm_mul_ps(m2, _mm_set1_ps(v[k].f[2])));
+		r = _mm_add_ps(r, _mm_mul_ps(m3, _mm_set1_ps(v[k].f[3])));
+		_mm_storeu_ps(v[k].f, r);
 	}
+#elif defined(__ARM_NEON__)
+	float32x4_t m0 = vld1q_f32(&matrix->d[0]);
+	float32x4_t m1 = vld1q_f32(&matrix->d[4]);
+	float32x4_t m2 = vld1q_f32(&matrix->d[8]);
+	float32x4_t m3 = vld1q_f32(&matrix->d[12]);
+	float32x4_t r;
+	int k;
+
+	for (k = 0; k < count; k++) {
+		r = vmulq_n_f32(m0, v[k].f[0]);
+		r = vaddq_f32(r, vmulq_n_f32(m1, v[k].f[1]));
+		r = vaddq_f32(r, vmulq_n_f32(m2, v[k].f[2]));
+		r = vaddq_f32(r, vmulq_n_f32(m3, v[k].f[3]));
+		vst1q_f32(v[k].f, r);
+	}
+#else
+	int i, j, k;
+	struct weston_vector t;
 
-	*v = t;
+	for (k = 0; k < count; k++) {
+		for (i = 0; i < 4; i++) {
+			t.f[i] = 0;
+			for (j = 0; j < 4; j++)
+				t.f[i] += v[k].f[j] * matrix->d[i + j * 4];
+		}
+
+		v[k] = t;
+	}
+#endif
 }
 
 static inline void
@@ -253,21 +334,104 @@ inverse_transform(const double *LU, const unsigned *p, float *v)
 		v[j] = b[j];
 }
 
+/*
+ * Translation, scaling and rotation in the xy plane, in any combination,
+ * only ever produce matrices of the form
+ *  a  c  0 tx
+ *  b  d  0 ty
+ *  0  0 sz tz
+ *  0  0  0  1
+ * whose inverse has a closed form.
+ */
+static int
+invert_affine_xy(struct weston_matrix *inverse,
+		 const struct weston_matrix *matrix)
+{
+	double a = matrix->d[0], b = matrix->d[1];
+	double c = matrix->d[4], d = matrix->d[5];
+	double sz = matrix->d[10];
+	double tx = matrix->d[12], ty = matrix->d[13], tz = matrix->d[14];
+	double det = a * d - b * c;
+	double ia, ib, ic, id;
+
+	if (fabs(det) < 1e-9 || fabs(sz) < 1e-9)
+		return -1;
+
+	ia = d / det;
+	ib = -b / det;
+	ic = -c / det;
+	id = a / det;
+
+	weston_matrix_init(inverse);
+	inverse->d[0] = ia;
+	inverse->d[1] = ib;
+	inverse->d[4] = ic;
+	inverse->d[5] = id;
+	inverse->d[10] = 1.0 / sz;
+	inverse->d[12] = -(ia * tx + ic * ty);
+	inverse->d[13] = -(ib * tx + id * ty);
+	inverse->d[14] = -tz / sz;
+
+	return 0;
+}
+
+static int
+matrix_is_identity(const struct weston_matrix *matrix)
+{
+	unsigned i;
+
+	for (i = 0; i < 16; i++)
+		if (matrix->d[i] != (i % 5 == 0 ? 1.0f : 0.0f))
+			return 0;
+
+	return 1;
+}
+
 WL_EXPORT int
 weston_matrix_invert(struct weston_matrix *inverse,
 		     const struct weston_matrix *matrix)
 {
 	double LU[16];		/* column-major */
 	unsigned perm[4];	/* permutation */
+	unsigned type = matrix->type;
 	unsigned c;
 
+	/* A matrix filled in by hand keeps type 0 whatever it holds. */
+	if (type == 0) {
+		if (matrix_is_identity(matrix)) {
+			weston_matrix_init(inverse);
+			return 0;
+		}
+		type = WESTON_MATRIX_TRANSFORM_OTHER;
+	}
+
+	if (type == WESTON_MATRIX_TRANSFORM_TRANSLATE) {
+		float x = matrix->d[12], y = matrix->d[13], z = matrix->d[14];
+
+		weston_matrix_init(inverse);
+		inverse->d[12] = -x;
+		inverse->d[13] = -y;
+		inverse->d[14] = -z;
+		inverse->type = type;
+
+		return 0;
+	}
+
+	if (!(type & WESTON_MATRIX_TRANSFORM_OTHER)) {
+		if (invert_affine_xy(inverse, matrix) < 0)
+			return -1;
+		inverse->type = type;
+
+		return 0;
+	}
+
 	if (matrix_invert(LU, perm, matrix) < 0)
 		return -1;
 
 	weston_matrix_init(inverse);
 	for (c = 0; c < 4; ++c)
 		inverse_transform(LU, perm, &inverse->d[c * 4]);
-	inverse->type = matrix->type;
+	inverse->type = type;
 
 	return 0;
 }
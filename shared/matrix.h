@@ -57,6 +57,9 @@ void
 weston_matrix_rotate_xy(struct weston_matrix *matrix, float cos, float sin);
 void
 weston_matrix_transform(struct weston_matrix *matrix, struct weston_vector *v);
+void
+weston_matrix_transform_points(struct weston_matrix *matrix,
+			       struct weston_vector *v, int count);
 
 int
 weston_matrix_invert(struct weston_matrix *inverse,
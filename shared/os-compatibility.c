@@ -28,9 +28,14 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <sys/epoll.h>
+#include <sys/syscall.h>
 #include <string.h>
 #include <stdlib.h>
 
+#ifdef HAVE_LINUX_MEMFD_H
+#include <linux/memfd.h>
+#endif
+
 #include "os-compatibility.h"
 
 static int
@@ -186,6 +191,57 @@ os_create_anonymous_file(off_t size)
 	return fd;
 }
 
+/*
+ * Create an anonymous file holding a copy of the given data, and seal it
+ * so that it can no longer be written, grown or shrunk. Such a file can
+ * be handed to any number of clients without one of them being able to
+ * change what the others see. The file descriptor is set CLOEXEC.
+ *
+ * Returns -1 with errno set to ENOSYS if memfd sealing is not available,
+ * in which case the caller should fall back to os_create_anonymous_file().
+ */
+int
+os_create_sealed_file(const char *name, const void *data, size_t size)
+{
+#if defined(HAVE_LINUX_MEMFD_H) && defined(__NR_memfd_create) && \
+    defined(F_ADD_SEALS)
+	const char *p = data;
+	ssize_t len;
+	int fd;
+
+	fd = syscall(__NR_memfd_create, name,
+		     MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd < 0)
+		return -1;
+
+	while (size > 0) {
+		len = write(fd, p, size);
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len < 0)
+			goto err;
+		p += len;
+		size -= len;
+	}
+
+	if (lseek(fd, 0, SEEK_SET) < 0)
+		goto err;
+
+	if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW |
+		  F_SEAL_WRITE | F_SEAL_SEAL) < 0)
+		goto err;
+
+	return fd;
+
+err:
+	close(fd);
+	return -1;
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
 #ifndef HAVE_STRCHRNUL
 char *
 strchrnul(const char *s, int c)
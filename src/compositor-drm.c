@@ -33,6 +33,7 @@
 #include <linux/vt.h>
 #include <assert.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <dlfcn.h>
 #include <time.h>
 
@@ -49,6 +50,7 @@
 #include "pixman-renderer.h"
 #include "udev-input.h"
 #include "launcher-util.h"
+#include "plane-policy.h"
 #include "vaapi-recorder.h"
 
 #ifndef DRM_CAP_TIMESTAMP_MONOTONIC
@@ -102,6 +104,8 @@ struct drm_compositor {
 
 	int cursors_are_broken;
 
+	int dump_plane_scene;
+
 	int use_pixman;
 
 	uint32_t prev_state;
@@ -169,6 +173,26 @@ struct drm_output {
 
 	struct vaapi_recorder *recorder;
 	struct wl_listener recorder_frame_listener;
+
+	/* Scratch space for drm_assign_planes(), the plane arrays are
+	 * sized for the sprites when the output is created, the view
+	 * arrays grow with the scene graph. */
+	struct plane_policy_plane *policy_planes;
+	struct drm_sprite **policy_sprites;
+	struct plane_policy_view *policy_views;
+	int *policy_assignment;
+	int max_policy_views;
+
+	/* Outputs with mirror= in weston.ini are not weston_outputs of
+	 * their own: they show the frames of the output they mirror,
+	 * either scanning out the same fb, or a scaled copy of the
+	 * pixman shadow when the modes differ. A frame of the source is
+	 * only finished once all its mirrors have flipped. */
+	struct drm_output *mirror_of;
+	struct wl_list mirror_list;
+	struct wl_list mirror_link;
+	int mirror_flips_pending;
+	int mirror_scaled;
 };
 
 /*
@@ -577,6 +601,123 @@ drm_output_set_gamma(struct weston_output *output_base,
 		weston_log("set gamma failed: %m\n");
 }
 
+static void
+drm_mirror_render_scaled(struct drm_output *mirror, pixman_region32_t *damage)
+{
+	struct drm_output *output = mirror->mirror_of;
+	pixman_image_t *shadow =
+		pixman_renderer_output_get_shadow(&output->base);
+	int sw = pixman_image_get_width(shadow);
+	int sh = pixman_image_get_height(shadow);
+	int mw = mirror->base.current_mode->width;
+	int mh = mirror->base.current_mode->height;
+	pixman_region32_t region, scaled, total_damage;
+	pixman_transform_t transform;
+	pixman_box32_t *rects;
+	pixman_image_t *image;
+	int i, n, x1, y1, x2, y2;
+
+	/* The damage of the source in its buffer coordinates, scaled to
+	 * the mirror, with one more pixel around for the filter. */
+	pixman_region32_init(&region);
+	pixman_region32_copy(&region, damage);
+	pixman_region32_translate(&region,
+				  -output->base.x, -output->base.y);
+	weston_transformed_region(output->base.width, output->base.height,
+				  output->base.transform,
+				  output->base.current_scale,
+				  &region, &region);
+
+	pixman_region32_init(&scaled);
+	rects = pixman_region32_rectangles(&region, &n);
+	for (i = 0; i < n; i++) {
+		x1 = rects[i].x1 * mw / sw - 1;
+		y1 = rects[i].y1 * mh / sh - 1;
+		x2 = (rects[i].x2 * mw + sw - 1) / sw + 1;
+		y2 = (rects[i].y2 * mh + sh - 1) / sh + 1;
+		pixman_region32_union_rect(&scaled, &scaled,
+					   x1, y1, x2 - x1, y2 - y1);
+	}
+	pixman_region32_intersect_rect(&scaled, &scaled, 0, 0, mw, mh);
+	pixman_region32_fini(&region);
+
+	pixman_region32_init(&total_damage);
+	pixman_region32_union(&total_damage, &scaled,
+			      &mirror->previous_damage);
+	pixman_region32_copy(&mirror->previous_damage, &scaled);
+	pixman_region32_fini(&scaled);
+
+	mirror->current_image ^= 1;
+	mirror->next = mirror->dumb[mirror->current_image];
+	image = mirror->image[mirror->current_image];
+
+	pixman_transform_init_scale(&transform,
+				    pixman_double_to_fixed((double) sw / mw),
+				    pixman_double_to_fixed((double) sh / mh));
+	pixman_image_set_transform(shadow, &transform);
+	pixman_image_set_filter(shadow, PIXMAN_FILTER_BILINEAR, NULL, 0);
+	pixman_image_set_clip_region32(image, &total_damage);
+
+	pixman_image_composite32(PIXMAN_OP_SRC,
+				 shadow, /* src */
+				 NULL /* mask */,
+				 image, /* dest */
+				 0, 0, /* src_x, src_y */
+				 0, 0, /* mask_x, mask_y */
+				 0, 0, /* dest_x, dest_y */
+				 mw, mh);
+
+	pixman_image_set_clip_region32(image, NULL);
+	pixman_image_set_filter(shadow, PIXMAN_FILTER_NEAREST, NULL, 0);
+	pixman_image_set_transform(shadow, NULL);
+
+	pixman_region32_fini(&total_damage);
+}
+
+static void
+drm_output_repaint_mirror(struct drm_output *mirror, pixman_region32_t *damage)
+{
+	struct drm_output *output = mirror->mirror_of;
+	struct drm_compositor *compositor =
+		(struct drm_compositor *) output->base.compositor;
+	struct drm_mode *mode;
+
+	if (mirror->destroy_pending)
+		return;
+
+	if (mirror->mirror_scaled)
+		drm_mirror_render_scaled(mirror, damage);
+	else
+		mirror->next = output->next;
+
+	mode = container_of(mirror->base.current_mode, struct drm_mode, base);
+	if (!mirror->current ||
+	    mirror->current->stride != mirror->next->stride) {
+		if (drmModeSetCrtc(compositor->drm.fd, mirror->crtc_id,
+				   mirror->next->fb_id, 0, 0,
+				   &mirror->connector_id, 1,
+				   &mode->mode_info)) {
+			weston_log("set mode failed for mirror %s: %m\n",
+				   mirror->base.name);
+			mirror->next = NULL;
+			return;
+		}
+		mirror->base.set_dpms(&mirror->base, WESTON_DPMS_ON);
+	}
+
+	if (drmModePageFlip(compositor->drm.fd, mirror->crtc_id,
+			    mirror->next->fb_id,
+			    DRM_MODE_PAGE_FLIP_EVENT, mirror) < 0) {
+		weston_log("queueing pageflip failed for mirror %s: %m\n",
+			   mirror->base.name);
+		mirror->next = NULL;
+		return;
+	}
+
+	mirror->page_flip_pending = 1;
+	output->mirror_flips_pending++;
+}
+
 static int
 drm_output_repaint(struct weston_output *output_base,
 		   pixman_region32_t *damage)
@@ -584,6 +725,7 @@ drm_output_repaint(struct weston_output *output_base,
 	struct drm_output *output = (struct drm_output *) output_base;
 	struct drm_compositor *compositor =
 		(struct drm_compositor *) output->base.compositor;
+	struct drm_output *mirror;
 	struct drm_sprite *s;
 	struct drm_mode *mode;
 	int ret = 0;
@@ -619,6 +761,9 @@ drm_output_repaint(struct weston_output *output_base,
 
 	output->page_flip_pending = 1;
 
+	wl_list_for_each(mirror, &output->mirror_list, mirror_link)
+		drm_output_repaint_mirror(mirror, damage);
+
 	drm_output_set_cursor(output);
 
 	/*
@@ -727,7 +872,7 @@ vblank_handler(int fd, unsigned int frame, unsigned int sec, unsigned int usec,
 	s->current = s->next;
 	s->next = NULL;
 
-	if (!output->page_flip_pending) {
+	if (!output->page_flip_pending && !output->mirror_flips_pending) {
 		msecs = sec * 1000 + usec / 1000;
 		weston_output_finish_frame(&output->base, msecs);
 	}
@@ -736,34 +881,66 @@ vblank_handler(int fd, unsigned int frame, unsigned int sec, unsigned int usec,
 static void
 drm_output_destroy(struct weston_output *output_base);
 
+static void
+drm_output_destroy_mirror(struct drm_output *mirror);
+
+static void
+drm_compositor_add_outputs(struct drm_compositor *ec);
+
+static void
+drm_output_flip_done(struct drm_output *output,
+		     unsigned int sec, unsigned int usec)
+{
+	struct drm_compositor *c =
+		(struct drm_compositor *) output->base.compositor;
+	uint32_t msecs;
+
+	if (output->page_flip_pending || output->mirror_flips_pending)
+		return;
+
+	if (output->destroy_pending) {
+		drm_output_destroy(&output->base);
+		/* The hotplug that asked for it is done, bring the
+		 * mirrors back on their own as update_outputs() does. */
+		drm_compositor_add_outputs(c);
+	} else if (!output->vblank_pending) {
+		msecs = sec * 1000 + usec / 1000;
+		weston_output_finish_frame(&output->base, msecs);
+
+		/* We can't call this from frame_notify, because the output's
+		 * repaint needed flag is cleared just after that */
+		if (output->recorder)
+			weston_output_schedule_repaint(&output->base);
+	}
+}
+
 static void
 page_flip_handler(int fd, unsigned int frame,
 		  unsigned int sec, unsigned int usec, void *data)
 {
 	struct drm_output *output = (struct drm_output *) data;
-	uint32_t msecs;
+	struct drm_output *source = output->mirror_of;
 
 	/* We don't set page_flip_pending on start_repaint_loop, in that case
 	 * we just want to page flip to the current buffer to get an accurate
 	 * timestamp */
 	if (output->page_flip_pending) {
-		drm_output_release_fb(output, output->current);
+		/* A mirror doesn't own the fbs it shows. */
+		if (!source)
+			drm_output_release_fb(output, output->current);
 		output->current = output->next;
 		output->next = NULL;
 	}
 
 	output->page_flip_pending = 0;
 
-	if (output->destroy_pending)
-		drm_output_destroy(&output->base);
-	else if (!output->vblank_pending) {
-		msecs = sec * 1000 + usec / 1000;
-		weston_output_finish_frame(&output->base, msecs);
-
-		/* We can't call this from frame_notify, because the output's
-		 * repaint needed flag is cleared just after that */
-		if (output->recorder)
-			weston_output_schedule_repaint(&output->base);
+	if (source) {
+		if (output->destroy_pending)
+			drm_output_destroy_mirror(output);
+		source->mirror_flips_pending--;
+		drm_output_flip_done(source, sec, usec);
+	} else {
+		drm_output_flip_done(output, sec, usec);
 	}
 }
 
@@ -805,13 +982,11 @@ drm_view_transform_supported(struct weston_view *ev)
 
 static struct weston_plane *
 drm_output_prepare_overlay_view(struct weston_output *output_base,
-				struct weston_view *ev)
+				struct weston_view *ev, struct drm_sprite *s)
 {
 	struct weston_compositor *ec = output_base->compositor;
 	struct drm_compositor *c =(struct drm_compositor *) ec;
 	struct weston_buffer_viewport *viewport = &ev->surface->buffer_viewport;
-	struct drm_sprite *s;
-	int found = 0;
 	struct gbm_bo *bo;
 	pixman_region32_t dest_rect, src_rect;
 	pixman_box32_t *box, tbox;
@@ -845,18 +1020,10 @@ drm_output_prepare_overlay_view(struct weston_output *output_base,
 	if (!drm_view_transform_supported(ev))
 		return NULL;
 
-	wl_list_for_each(s, &c->sprite_list, link) {
-		if (!drm_sprite_crtc_supported(output_base, s->possible_crtcs))
-			continue;
-
-		if (!s->next) {
-			found = 1;
-			break;
-		}
-	}
-
-	/* No sprites available */
-	if (!found)
+	/* The sprite was picked by the plane policy, see
+	 * drm_assign_planes(). */
+	if (s->next || !drm_sprite_crtc_supported(output_base,
+						  s->possible_crtcs))
 		return NULL;
 
 	bo = gbm_bo_import(c->gbm, GBM_BO_IMPORT_WL_BUFFER,
@@ -1038,31 +1205,245 @@ drm_output_set_cursor(struct drm_output *output)
 	}
 }
 
+static uint32_t
+drm_view_policy_flags(struct drm_output *output, struct weston_view *ev)
+{
+	struct weston_buffer *buffer = ev->surface->buffer_ref.buffer;
+	struct weston_buffer_viewport *viewport = &ev->surface->buffer_viewport;
+	int32_t width, height;
+	uint32_t flags = 0;
+
+	if (buffer == NULL)
+		return PLANE_POLICY_VIEW_PRIMARY;
+
+	if (ev->geometry.x == output->base.x &&
+	    ev->geometry.y == output->base.y &&
+	    buffer->width == output->base.current_mode->width &&
+	    buffer->height == output->base.current_mode->height &&
+	    output->base.transform == viewport->buffer.transform &&
+	    !ev->transform.enabled)
+		flags |= PLANE_POLICY_VIEW_FULLSCREEN;
+	else if (ev->output_mask != (1u << output->base.id))
+		return PLANE_POLICY_VIEW_PRIMARY;
+
+	if (wl_shm_buffer_get(buffer->resource))
+		flags |= PLANE_POLICY_VIEW_SHM;
+
+	if (ev->alpha != 1.0f)
+		flags |= PLANE_POLICY_VIEW_ALPHA;
+
+	if (!drm_view_transform_supported(ev) ||
+	    viewport->buffer.transform != output->base.transform ||
+	    viewport->buffer.scale != output->base.current_scale)
+		flags |= PLANE_POLICY_VIEW_TRANSFORMED;
+
+	if (viewport->buffer.transform & 1) {
+		width = buffer->height / viewport->buffer.scale;
+		height = buffer->width / viewport->buffer.scale;
+	} else {
+		width = buffer->width / viewport->buffer.scale;
+		height = buffer->height / viewport->buffer.scale;
+	}
+	if (width != ev->surface->width || height != ev->surface->height ||
+	    (ev->transform.enabled &&
+	     (ev->transform.matrix.type & WESTON_MATRIX_TRANSFORM_SCALE)))
+		flags |= PLANE_POLICY_VIEW_SCALED;
+
+	return flags;
+}
+
+static void
+drm_log_plane_scene(struct drm_output *output,
+		    const struct plane_policy_plane *planes, int count_planes,
+		    const struct plane_policy_view *views, int count_views,
+		    const int *assignment, int64_t cost)
+{
+	static const char *plane_types[] = {
+		[PLANE_POLICY_CURSOR] = "cursor",
+		[PLANE_POLICY_SCANOUT] = "scanout",
+		[PLANE_POLICY_OVERLAY] = "overlay",
+	};
+	static const char *view_flags[] = {
+		"primary", "shm", "alpha", "scaled", "transformed", "fullscreen"
+	};
+	const struct plane_policy_plane *plane;
+	const struct plane_policy_view *view;
+	uint32_t f;
+	unsigned k;
+	int i, j;
+
+	weston_log("plane policy scene for %s, %lld pixels composited:\n",
+		   output->base.name, (long long) cost);
+	weston_log_continue(STAMP_SPACE "output %d %d\n",
+			    output->base.width, output->base.height);
+
+	for (i = 0; i < count_planes; i++) {
+		plane = &planes[i];
+		weston_log_continue(STAMP_SPACE "plane %s zpos=%d",
+				    plane_types[plane->type], plane->zpos);
+		if (plane->can_scale)
+			weston_log_continue(" scale");
+		if (plane->max_width)
+			weston_log_continue(" max=%dx%d",
+					    plane->max_width,
+					    plane->max_height);
+		for (j = 0; j < plane->count_formats; j++) {
+			f = plane->formats[j];
+			weston_log_continue("%s%.4s", j ? "," : " formats=",
+					    (char *) &f);
+		}
+		weston_log_continue("\n");
+	}
+
+	for (i = 0; i < count_views; i++) {
+		view = &views[i];
+		weston_log_continue(STAMP_SPACE "view %d %d %d %d",
+				    view->x1, view->y1, view->x2, view->y2);
+		if (view->format) {
+			f = view->format;
+			weston_log_continue(" format=%.4s", (char *) &f);
+		}
+		for (k = 0; k < ARRAY_LENGTH(view_flags); k++)
+			if (view->flags & (1 << k))
+				weston_log_continue(" %s", view_flags[k]);
+		if (assignment[i] == PLANE_POLICY_PRIMARY)
+			weston_log_continue(" # primary\n");
+		else
+			weston_log_continue(" # %s\n",
+				plane_types[planes[assignment[i]].type]);
+	}
+}
+
+static int
+drm_output_grow_policy_views(struct drm_output *output, int count)
+{
+	struct plane_policy_view *views;
+	int *assignment;
+
+	views = realloc(output->policy_views, count * sizeof *views);
+	if (!views)
+		return -1;
+	output->policy_views = views;
+
+	assignment = realloc(output->policy_assignment,
+			     count * sizeof *assignment);
+	if (!assignment)
+		return -1;
+	output->policy_assignment = assignment;
+
+	output->max_policy_views = count;
+
+	return 0;
+}
+
+static void
+drm_output_free_policy(struct drm_output *output)
+{
+	free(output->policy_planes);
+	free(output->policy_sprites);
+	free(output->policy_views);
+	free(output->policy_assignment);
+}
+
 static void
 drm_assign_planes(struct weston_output *output)
 {
 	struct drm_compositor *c =
 		(struct drm_compositor *) output->compositor;
+	struct drm_output *drm_output = (struct drm_output *) output;
+	int mirrored = !wl_list_empty(&drm_output->mirror_list);
 	struct weston_view *ev, *next;
 	pixman_region32_t overlap, surface_overlap;
 	struct weston_plane *primary, *next_plane;
+	struct plane_policy_plane *planes;
+	struct plane_policy_view *views;
+	struct drm_sprite **sprites, *s;
+	pixman_box32_t *box;
+	int count_planes = 0, count_views = 0;
+	int *assignment;
+	int64_t cost;
+	int i, p;
 
 	/*
-	 * Find a surface for each sprite in the output using some heuristics:
-	 * 1) size
-	 * 2) frequency of update
-	 * 3) opacity (though some hw might support alpha blending)
-	 * 4) clipping (this can be fixed with color keys)
+	 * Which view goes on which plane is decided by the policy in
+	 * plane-policy.c, from an abstract description of the planes and
+	 * views. It prefers, in this order, the cursor, scanout and sprite
+	 * planes, and takes the assignment that leaves the least area to
+	 * composite. The sprites are meant for large, often updated,
+	 * opaque views such as video: when they can be scanned out
+	 * directly, the primary plane may not need to update at all.
 	 *
-	 * The idea is to save on blitting since this should save power.
-	 * If we can get a large video surface on the sprite for example,
-	 * the main display surface may not need to update at all, and
-	 * the client buffer can be used directly for the sprite surface
-	 * as we do for flipping full screen surfaces.
+	 * The mirrors of an output only get its primary plane, so when
+	 * there are any, everything is composited.
 	 */
+	count_views = wl_list_length(&c->base.view_list);
+	if (count_views + 1 > drm_output->max_policy_views &&
+	    drm_output_grow_policy_views(drm_output, count_views + 1) < 0) {
+		weston_log("failed to allocate plane assignment\n");
+		count_views = 0;
+		goto out;
+	}
+
+	planes = drm_output->policy_planes;
+	sprites = drm_output->policy_sprites;
+	views = drm_output->policy_views;
+	assignment = drm_output->policy_assignment;
+	i = 2 + wl_list_length(&c->sprite_list);
+	memset(planes, 0, i * sizeof *planes);
+	memset(sprites, 0, i * sizeof *sprites);
+	memset(views, 0, count_views * sizeof *views);
+
+	if (c->gbm && !c->cursors_are_broken && !mirrored &&
+	    output->transform == WL_OUTPUT_TRANSFORM_NORMAL) {
+		planes[count_planes].type = PLANE_POLICY_CURSOR;
+		planes[count_planes].max_width = 64;
+		planes[count_planes].max_height = 64;
+		count_planes++;
+	}
+
+	if (c->gbm && !mirrored) {
+		planes[count_planes].type = PLANE_POLICY_SCANOUT;
+		count_planes++;
+	}
+
+	wl_list_for_each(s, &c->sprite_list, link) {
+		if (!c->gbm || c->sprites_are_broken || s->next || mirrored ||
+		    !drm_sprite_crtc_supported(output, s->possible_crtcs))
+			continue;
+
+		planes[count_planes].type = PLANE_POLICY_OVERLAY;
+		planes[count_planes].can_scale = 1;
+		planes[count_planes].count_formats = s->count_formats;
+		planes[count_planes].formats = s->formats;
+		sprites[count_planes] = s;
+		count_planes++;
+	}
+
+	i = 0;
+	wl_list_for_each(ev, &c->base.view_list, link) {
+		box = pixman_region32_extents(&ev->transform.boundingbox);
+		views[i].x1 = box->x1 - output->x;
+		views[i].y1 = box->y1 - output->y;
+		views[i].x2 = box->x2 - output->x;
+		views[i].y2 = box->y2 - output->y;
+		views[i].flags = drm_view_policy_flags(drm_output, ev);
+		i++;
+	}
+
+	cost = plane_policy_assign(planes, count_planes, views, count_views,
+				   output->width, output->height, assignment);
+
+	if (c->dump_plane_scene) {
+		c->dump_plane_scene = 0;
+		drm_log_plane_scene(drm_output, planes, count_planes,
+				    views, count_views, assignment, cost);
+	}
+
+out:
 	pixman_region32_init(&overlap);
 	primary = &c->base.primary_plane;
 
+	i = 0;
 	wl_list_for_each_safe(ev, next, &c->base.view_list, link) {
 		struct weston_surface *es = ev->surface;
 
@@ -1082,19 +1463,26 @@ drm_assign_planes(struct weston_output *output)
 		else
 			es->keep_buffer = 0;
 
+		p = i < count_views ? assignment[i++] : PLANE_POLICY_PRIMARY;
+
+		/* Setting up a plane can still fail, in which case the view
+		 * is composited after all, and so must everything below it
+		 * that it overlaps. */
 		pixman_region32_init(&surface_overlap);
 		pixman_region32_intersect(&surface_overlap, &overlap,
 					  &ev->transform.boundingbox);
 
 		next_plane = NULL;
-		if (pixman_region32_not_empty(&surface_overlap))
+		if (p == PLANE_POLICY_PRIMARY ||
+		    pixman_region32_not_empty(&surface_overlap))
 			next_plane = primary;
-		if (next_plane == NULL)
+		else if (planes[p].type == PLANE_POLICY_CURSOR)
 			next_plane = drm_output_prepare_cursor_view(output, ev);
-		if (next_plane == NULL)
+		else if (planes[p].type == PLANE_POLICY_SCANOUT)
 			next_plane = drm_output_prepare_scanout_view(output, ev);
-		if (next_plane == NULL)
-			next_plane = drm_output_prepare_overlay_view(output, ev);
+		else
+			next_plane = drm_output_prepare_overlay_view(output, ev,
+								     sprites[p]);
 		if (next_plane == NULL)
 			next_plane = primary;
 		weston_view_move_to_plane(ev, next_plane);
@@ -1110,6 +1498,50 @@ drm_assign_planes(struct weston_output *output)
 static void
 drm_output_fini_pixman(struct drm_output *output);
 
+static void
+drm_output_fini_dumb(struct drm_output *output);
+
+static void
+drm_output_destroy_mirror(struct drm_output *mirror)
+{
+	struct drm_compositor *c =
+		(struct drm_compositor *) mirror->base.compositor;
+	drmModeCrtcPtr origcrtc = mirror->original_crtc;
+	struct drm_mode *mode, *next;
+
+	if (mirror->page_flip_pending) {
+		mirror->destroy_pending = 1;
+		weston_log("destroy mirror while page flip pending\n");
+		return;
+	}
+
+	wl_list_remove(&mirror->mirror_link);
+
+	drmModeFreeProperty(mirror->dpms_prop);
+
+	/* Restore original CRTC state */
+	drmModeSetCrtc(c->drm.fd, origcrtc->crtc_id, origcrtc->buffer_id,
+		       origcrtc->x, origcrtc->y,
+		       &mirror->connector_id, 1, &origcrtc->mode);
+	drmModeFreeCrtc(origcrtc);
+
+	c->crtc_allocator &= ~(1 << mirror->crtc_id);
+	c->connector_allocator &= ~(1 << mirror->connector_id);
+
+	if (mirror->mirror_scaled) {
+		drm_output_fini_dumb(mirror);
+		pixman_region32_fini(&mirror->previous_damage);
+	}
+
+	wl_list_for_each_safe(mode, next, &mirror->base.mode_list, base.link) {
+		wl_list_remove(&mode->base.link);
+		free(mode);
+	}
+
+	free(mirror->base.name);
+	free(mirror);
+}
+
 static void
 drm_output_destroy(struct weston_output *output_base)
 {
@@ -1117,13 +1549,17 @@ drm_output_destroy(struct weston_output *output_base)
 	struct drm_compositor *c =
 		(struct drm_compositor *) output->base.compositor;
 	drmModeCrtcPtr origcrtc = output->original_crtc;
+	struct drm_output *mirror, *next;
 
-	if (output->page_flip_pending) {
+	if (output->page_flip_pending || output->mirror_flips_pending) {
 		output->destroy_pending = 1;
 		weston_log("destroy output while page flip pending\n");
 		return;
 	}
 
+	wl_list_for_each_safe(mirror, next, &output->mirror_list, mirror_link)
+		drm_output_destroy_mirror(mirror);
+
 	if (output->backlight)
 		backlight_destroy(output->backlight);
 
@@ -1153,6 +1589,7 @@ drm_output_destroy(struct weston_output *output_base)
 
 	weston_output_destroy(&output->base);
 
+	drm_output_free_policy(output);
 	free(output);
 }
 
@@ -1215,6 +1652,12 @@ drm_output_switch_mode(struct weston_output *output_base, struct weston_mode *mo
 	if (&drm_mode->base == output->base.current_mode)
 		return 0;
 
+	if (!wl_list_empty(&output->mirror_list)) {
+		weston_log("%s, can't switch mode of mirrored output %s\n",
+			   __func__, output->base.name);
+		return -1;
+	}
+
 	output->base.current_mode->flags = 0;
 
 	output->base.current_mode = &drm_mode->base;
@@ -1475,6 +1918,10 @@ drm_set_dpms(struct weston_output *output_base, enum dpms_enum level)
 	struct drm_output *output = (struct drm_output *) output_base;
 	struct weston_compositor *ec = output_base->compositor;
 	struct drm_compositor *c = (struct drm_compositor *) ec;
+	struct drm_output *mirror;
+
+	wl_list_for_each(mirror, &output->mirror_list, mirror_link)
+		drm_set_dpms(&mirror->base, level);
 
 	if (!output->dpms_prop)
 		return;
@@ -1574,14 +2021,12 @@ drm_output_init_egl(struct drm_output *output, struct drm_compositor *ec)
 }
 
 static int
-drm_output_init_pixman(struct drm_output *output, struct drm_compositor *c)
+drm_output_init_dumb(struct drm_output *output, struct drm_compositor *c)
 {
 	int w = output->base.current_mode->width;
 	int h = output->base.current_mode->height;
 	unsigned int i;
 
-	/* FIXME error checking */
-
 	for (i = 0; i < ARRAY_LENGTH(output->dumb); i++) {
 		output->dumb[i] = drm_fb_create_dumb(c, w, h);
 		if (!output->dumb[i])
@@ -1595,15 +2040,19 @@ drm_output_init_pixman(struct drm_output *output, struct drm_compositor *c)
 			goto err;
 	}
 
-	if (pixman_renderer_output_create(&output->base) < 0)
-		goto err;
-
-	pixman_region32_init_rect(&output->previous_damage,
-				  output->base.x, output->base.y, output->base.width, output->base.height);
-
 	return 0;
 
 err:
+	drm_output_fini_dumb(output);
+
+	return -1;
+}
+
+static void
+drm_output_fini_dumb(struct drm_output *output)
+{
+	unsigned int i;
+
 	for (i = 0; i < ARRAY_LENGTH(output->dumb); i++) {
 		if (output->dumb[i])
 			drm_fb_destroy_dumb(output->dumb[i]);
@@ -1613,24 +2062,70 @@ err:
 		output->dumb[i] = NULL;
 		output->image[i] = NULL;
 	}
+}
 
-	return -1;
+static int
+drm_output_init_pixman(struct drm_output *output, struct drm_compositor *c)
+{
+	if (drm_output_init_dumb(output, c) < 0)
+		return -1;
+
+	if (pixman_renderer_output_create(&output->base) < 0) {
+		drm_output_fini_dumb(output);
+		return -1;
+	}
+
+	pixman_region32_init_rect(&output->previous_damage,
+				  output->base.x, output->base.y, output->base.width, output->base.height);
+
+	return 0;
 }
 
 static void
 drm_output_fini_pixman(struct drm_output *output)
 {
-	unsigned int i;
-
 	pixman_renderer_output_destroy(&output->base);
 	pixman_region32_fini(&output->previous_damage);
 
-	for (i = 0; i < ARRAY_LENGTH(output->dumb); i++) {
-		drm_fb_destroy_dumb(output->dumb[i]);
-		pixman_image_unref(output->image[i]);
-		output->dumb[i] = NULL;
-		output->image[i] = NULL;
+	drm_output_fini_dumb(output);
+}
+
+static int
+drm_output_init_mirror(struct drm_output *output, struct drm_output *source)
+{
+	struct drm_compositor *c =
+		(struct drm_compositor *) source->base.compositor;
+	struct weston_mode *mode = output->base.current_mode;
+
+	output->base.compositor = &c->base;
+
+	if (mode->width != source->base.current_mode->width ||
+	    mode->height != source->base.current_mode->height) {
+		if (drm_output_init_dumb(output, c) < 0) {
+			weston_log("Failed to init mirror buffers\n");
+			return -1;
+		}
+
+		pixman_region32_init_rect(&output->previous_damage,
+					  0, 0, mode->width, mode->height);
+		output->mirror_scaled = 1;
 	}
+
+	output->base.set_dpms = drm_set_dpms;
+
+	output->mirror_of = source;
+	wl_list_insert(source->mirror_list.prev, &output->mirror_link);
+
+	weston_log("Output %s, (connector %d, crtc %d) mirrors %s%s\n",
+		   output->base.name, output->connector_id, output->crtc_id,
+		   source->base.name,
+		   output->mirror_scaled ? ", scaled" : "");
+	weston_log_continue(STAMP_SPACE "mode %dx%d@%.1f\n",
+			    mode->width, mode->height, mode->refresh / 1000.0);
+
+	weston_output_schedule_repaint(&source->base);
+
+	return 0;
 }
 
 static void
@@ -1888,13 +2383,54 @@ get_gbm_format_from_section(struct weston_config_section *section,
 	return ret;
 }
 
+static void
+connector_get_name(drmModeConnector *connector, char *name, size_t size)
+{
+	const char *type_name;
+
+	if (connector->connector_type < ARRAY_LENGTH(connector_type_names))
+		type_name = connector_type_names[connector->connector_type];
+	else
+		type_name = "UNKNOWN";
+	snprintf(name, size, "%s%d", type_name, connector->connector_type_id);
+}
+
+static int
+connector_is_mirror(struct drm_compositor *ec, drmModeConnector *connector)
+{
+	struct weston_config_section *section;
+	char name[32], *s;
+	int ret;
+
+	connector_get_name(connector, name, sizeof name);
+	section = weston_config_get_section(ec->base.config, "output", "name",
+					    name);
+	weston_config_section_get_string(section, "mirror", &s, NULL);
+	ret = s != NULL;
+	free(s);
+
+	return ret;
+}
+
+static struct drm_output *
+drm_compositor_find_output(struct drm_compositor *ec, const char *name)
+{
+	struct drm_output *output;
+
+	wl_list_for_each(output, &ec->base.output_list, base.link)
+		if (strcmp(output->base.name, name) == 0)
+			return output;
+
+	return NULL;
+}
+
 static int
 create_output_for_connector(struct drm_compositor *ec,
 			    drmModeRes *resources,
 			    drmModeConnector *connector,
 			    int x, int y, struct udev_device *drm_device)
 {
-	struct drm_output *output;
+	struct drm_output *output, *source = NULL;
 	struct drm_mode *drm_mode, *next, *preferred, *current, *configured, *best;
 	struct weston_mode *m;
 	struct weston_config_section *section;
@@ -1903,7 +2439,6 @@ create_output_for_connector(struct drm_compositor *ec,
 	drmModeCrtc *crtc;
 	int i, width, height, scale;
 	char name[32], *s;
-	const char *type_name;
 	enum output_config config;
 	uint32_t transform;
 
@@ -1922,12 +2457,9 @@ create_output_for_connector(struct drm_compositor *ec,
 	output->base.model = "unknown";
 	output->base.serial_number = "unknown";
 	wl_list_init(&output->base.mode_list);
+	wl_list_init(&output->mirror_list);
 
-	if (connector->connector_type < ARRAY_LENGTH(connector_type_names))
-		type_name = connector_type_names[connector->connector_type];
-	else
-		type_name = "UNKNOWN";
-	snprintf(name, 32, "%s%d", type_name, connector->connector_type_id);
+	connector_get_name(connector, name, sizeof name);
 	output->base.name = strdup(name);
 
 	section = weston_config_get_section(ec->base.config, "output", "name",
@@ -1964,6 +2496,16 @@ create_output_for_connector(struct drm_compositor *ec,
 	setup_output_seat_constraint(ec, &output->base, s);
 	free(s);
 
+	weston_config_section_get_string(section, "mirror", &s, NULL);
+	if (s) {
+		source = drm_compositor_find_output(ec, s);
+		if (!source)
+			weston_log("Output %s mirrors unknown output %s, "
+				   "using it on its own\n",
+				   output->base.name, s);
+	}
+	free(s);
+
 	output->crtc_id = resources->crtcs[i];
 	output->pipe = i;
 	ec->crtc_allocator |= (1 << output->crtc_id);
@@ -2048,8 +2590,48 @@ create_output_for_connector(struct drm_compositor *ec,
 		goto err_free;
 	}
 
+	/* Unless told otherwise, a mirror takes the mode of its source
+	 * if it can, so that it scans out the same fb. Only pixman can
+	 * scale the frames to another mode. */
+	if (source && config != OUTPUT_CONFIG_MODE &&
+	    config != OUTPUT_CONFIG_MODELINE) {
+		m = source->base.current_mode;
+		wl_list_for_each(drm_mode, &output->base.mode_list, base.link) {
+			if (drm_mode->base.width == m->width &&
+			    drm_mode->base.height == m->height) {
+				output->base.current_mode = &drm_mode->base;
+				break;
+			}
+		}
+	}
+
+	if (source && !ec->use_pixman &&
+	    (output->base.current_mode->width !=
+	     source->base.current_mode->width ||
+	     output->base.current_mode->height !=
+	     source->base.current_mode->height)) {
+		weston_log("Output %s can't mirror %s in another mode with "
+			   "the GL renderer, using it on its own\n",
+			   output->base.name, source->base.name);
+		source = NULL;
+	}
+
 	output->base.current_mode->flags |= WL_OUTPUT_MODE_CURRENT;
 
+	if (source) {
+		if (drm_output_init_mirror(output, source) < 0)
+			goto err_free;
+
+		return 0;
+	}
+
+	/* cursor, scanout and the sprites, see drm_assign_planes() */
+	i = 2 + wl_list_length(&ec->sprite_list);
+	output->policy_planes = calloc(i, sizeof *output->policy_planes);
+	output->policy_sprites = calloc(i, sizeof *output->policy_sprites);
+	if (!output->policy_planes || !output->policy_sprites)
+		goto err_free;
+
 	weston_output_init(&output->base, &ec->base, x, y,
 			   connector->mmWidth, connector->mmHeight,
 			   transform, scale);
@@ -2124,6 +2706,7 @@ err_free:
 	drmModeFreeCrtc(output->original_crtc);
 	ec->crtc_allocator &= ~(1 << output->crtc_id);
 	ec->connector_allocator &= ~(1 << output->connector_id);
+	drm_output_free_policy(output);
 	free(output);
 
 	return -1;
@@ -2198,14 +2781,78 @@ destroy_sprites(struct drm_compositor *compositor)
 	}
 }
 
+/* Create outputs for the connected connectors that have none yet. The
+ * ones mirroring another output come last, so that they find it. */
+static void
+create_new_outputs(struct drm_compositor *ec, drmModeRes *resources,
+		   uint32_t option_connector, struct udev_device *drm_device)
+{
+	drmModeConnector *connector;
+	struct weston_output *last;
+	int i, pass;
+	int x = 0, y = 0;
+
+	for (pass = 0; pass < 2; pass++) {
+		for (i = 0; i < resources->count_connectors; i++) {
+			connector = drmModeGetConnector(ec->drm.fd,
+							resources->connectors[i]);
+			if (connector == NULL)
+				continue;
+
+			if (connector->connection == DRM_MODE_CONNECTED &&
+			    !(ec->connector_allocator &
+			      (1 << connector->connector_id)) &&
+			    (option_connector == 0 ||
+			     connector->connector_id == option_connector) &&
+			    connector_is_mirror(ec, connector) == pass) {
+				/* XXX: not yet needed, we die with 0 outputs */
+				if (!wl_list_empty(&ec->base.output_list)) {
+					last = container_of(ec->base.output_list.prev,
+							    struct weston_output,
+							    link);
+					x = last->x + last->width;
+				}
+
+				create_output_for_connector(ec, resources,
+							    connector, x, y,
+							    drm_device);
+			}
+
+			drmModeFreeConnector(connector);
+		}
+	}
+}
+
+/* create_new_outputs() outside of a hotplug event */
+static void
+drm_compositor_add_outputs(struct drm_compositor *ec)
+{
+	drmModeRes *resources;
+	struct udev_device *drm_device = NULL;
+	struct stat st;
+
+	resources = drmModeGetResources(ec->drm.fd);
+	if (!resources) {
+		weston_log("drmModeGetResources failed\n");
+		return;
+	}
+
+	if (fstat(ec->drm.fd, &st) == 0)
+		drm_device = udev_device_new_from_devnum(ec->udev, 'c',
+							 st.st_rdev);
+
+	create_new_outputs(ec, resources, 0, drm_device);
+
+	if (drm_device)
+		udev_device_unref(drm_device);
+	drmModeFreeResources(resources);
+}
+
 static int
 create_outputs(struct drm_compositor *ec, uint32_t option_connector,
 	       struct udev_device *drm_device)
 {
-	drmModeConnector *connector;
 	drmModeRes *resources;
-	int i;
-	int x = 0, y = 0;
 
 	resources = drmModeGetResources(ec->drm.fd);
 	if (!resources) {
@@ -2227,29 +2874,7 @@ create_outputs(struct drm_compositor *ec, uint32_t option_connector,
 	ec->num_crtcs = resources->count_crtcs;
 	memcpy(ec->crtcs, resources->crtcs, sizeof(uint32_t) * ec->num_crtcs);
 
-	for (i = 0; i < resources->count_connectors; i++) {
-		connector = drmModeGetConnector(ec->drm.fd,
-						resources->connectors[i]);
-		if (connector == NULL)
-			continue;
-
-		if (connector->connection == DRM_MODE_CONNECTED &&
-		    (option_connector == 0 ||
-		     connector->connector_id == option_connector)) {
-			if (create_output_for_connector(ec, resources,
-							connector, x, y,
-							drm_device) < 0) {
-				drmModeFreeConnector(connector);
-				continue;
-			}
-
-			x += container_of(ec->base.output_list.prev,
-					  struct weston_output,
-					  link)->width;
-		}
-
-		drmModeFreeConnector(connector);
-	}
+	create_new_outputs(ec, resources, option_connector, drm_device);
 
 	if (wl_list_empty(&ec->base.output_list)) {
 		weston_log("No currently active connector found.\n");
@@ -2267,8 +2892,7 @@ update_outputs(struct drm_compositor *ec, struct udev_device *drm_device)
 {
 	drmModeConnector *connector;
 	drmModeRes *resources;
-	struct drm_output *output, *next;
-	int x = 0, y = 0;
+	struct drm_output *output, *next, *mirror, *mirror_next;
 	uint32_t connected = 0, disconnects = 0;
 	int i;
 
@@ -2293,31 +2917,31 @@ update_outputs(struct drm_compositor *ec, struct udev_device *drm_device)
 
 		connected |= (1 << connector_id);
 
-		if (!(ec->connector_allocator & (1 << connector_id))) {
-			struct weston_output *last =
-				container_of(ec->base.output_list.prev,
-					     struct weston_output, link);
-
-			/* XXX: not yet needed, we die with 0 outputs */
-			if (!wl_list_empty(&ec->base.output_list))
-				x = last->x + last->width;
-			else
-				x = 0;
-			y = 0;
-			create_output_for_connector(ec, resources,
-						    connector, x, y,
-						    drm_device);
+		if (!(ec->connector_allocator & (1 << connector_id)))
 			weston_log("connector %d connected\n", connector_id);
 
-		}
 		drmModeFreeConnector(connector);
 	}
-	drmModeFreeResources(resources);
 
+	/* Disconnects go first: the mirrors of an output that is gone
+	 * are brought back on their own below. */
 	disconnects = ec->connector_allocator & ~connected;
 	if (disconnects) {
 		wl_list_for_each_safe(output, next, &ec->base.output_list,
 				      base.link) {
+			wl_list_for_each_safe(mirror, mirror_next,
+					      &output->mirror_list,
+					      mirror_link) {
+				if (!(disconnects &
+				      (1 << mirror->connector_id)))
+					continue;
+
+				disconnects &= ~(1 << mirror->connector_id);
+				weston_log("connector %d disconnected\n",
+					   mirror->connector_id);
+				drm_output_destroy_mirror(mirror);
+			}
+
 			if (disconnects & (1 << output->connector_id)) {
 				disconnects &= ~(1 << output->connector_id);
 				weston_log("connector %d disconnected\n",
@@ -2327,6 +2951,9 @@ update_outputs(struct drm_compositor *ec, struct udev_device *drm_device)
 		}
 	}
 
+	create_new_outputs(ec, resources, 0, drm_device);
+	drmModeFreeResources(resources);
+
 	/* FIXME: handle zero outputs, without terminating */	
 	if (ec->connector_allocator == 0)
 		wl_display_terminate(ec->base.wl_display);
@@ -2398,11 +3025,29 @@ drm_destroy(struct weston_compositor *ec)
 static void
 drm_compositor_set_modes(struct drm_compositor *compositor)
 {
-	struct drm_output *output;
+	struct drm_output *output, *mirror;
 	struct drm_mode *drm_mode;
 	int ret;
 
 	wl_list_for_each(output, &compositor->base.output_list, base.link) {
+		wl_list_for_each(mirror, &output->mirror_list, mirror_link) {
+			if (!mirror->current)
+				continue;
+
+			drm_mode = (struct drm_mode *) mirror->base.current_mode;
+			ret = drmModeSetCrtc(compositor->drm.fd,
+					     mirror->crtc_id,
+					     mirror->current->fb_id, 0, 0,
+					     &mirror->connector_id, 1,
+					     &drm_mode->mode_info);
+			if (ret < 0)
+				weston_log("failed to set mode %dx%d for "
+					   "mirror %s: %m\n",
+					   drm_mode->base.width,
+					   drm_mode->base.height,
+					   mirror->base.name);
+		}
+
 		if (!output->current) {
 			/* If something that would cause the output to
 			 * switch mode happened while in another vt, we
@@ -2551,6 +3196,10 @@ planes_binding(struct weston_seat *seat, uint32_t time, uint32_t key, void *data
 	case KEY_O:
 		c->sprites_hidden ^= 1;
 		break;
+	case KEY_P:
+		c->dump_plane_scene = 1;
+		weston_compositor_schedule_repaint(&c->base);
+		break;
 	default:
 		break;
 	}
@@ -2669,7 +3318,7 @@ recorder_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
 static void
 switch_to_gl_renderer(struct drm_compositor *c)
 {
-	struct drm_output *output;
+	struct drm_output *output, *mirror, *next;
 
 	if (!c->use_pixman)
 		return;
@@ -2683,8 +3332,20 @@ switch_to_gl_renderer(struct drm_compositor *c)
 		return;
 	}
 
-	wl_list_for_each(output, &c->base.output_list, base.link)
+	wl_list_for_each(output, &c->base.output_list, base.link) {
+		wl_list_for_each_safe(mirror, next,
+				      &output->mirror_list, mirror_link) {
+			if (!mirror->mirror_scaled)
+				continue;
+
+			weston_log("Output %s can't mirror %s in another mode "
+				   "with the GL renderer, turning it off\n",
+				   mirror->base.name, output->base.name);
+			drm_output_destroy_mirror(mirror);
+		}
+
 		pixman_renderer_output_destroy(&output->base);
+	}
 
 	c->base.renderer->destroy(&c->base);
 
@@ -2851,6 +3512,8 @@ drm_compositor_create(struct wl_display *display,
 					    planes_binding, ec);
 	weston_compositor_add_debug_binding(&ec->base, KEY_V,
 					    planes_binding, ec);
+	weston_compositor_add_debug_binding(&ec->base, KEY_P,
+					    planes_binding, ec);
 	weston_compositor_add_debug_binding(&ec->base, KEY_Q,
 					    recorder_binding, ec);
 	weston_compositor_add_debug_binding(&ec->base, KEY_W,
@@ -28,10 +28,16 @@
 #include <sys/time.h>
 
 #include "compositor.h"
+#ifdef BUILD_HEADLESS_REPLAY
+#include "evdev.h"
+#endif
 
 struct headless_compositor {
 	struct weston_compositor base;
 	struct weston_seat fake_seat;
+#ifdef BUILD_HEADLESS_REPLAY
+	struct evdev_replay *replay;
+#endif
 };
 
 struct headless_output {
@@ -160,6 +166,10 @@ headless_destroy(struct weston_compositor *ec)
 {
 	struct headless_compositor *c = (struct headless_compositor *) ec;
 
+#ifdef BUILD_HEADLESS_REPLAY
+	if (c->replay)
+		evdev_replay_destroy(c->replay);
+#endif
 	headless_input_destroy(c);
 	weston_compositor_shutdown(ec);
 
@@ -169,6 +179,7 @@ headless_destroy(struct weston_compositor *ec)
 static struct weston_compositor *
 headless_compositor_create(struct wl_display *display,
 			   int width, int height, const char *display_name,
+			   const char *replay, int replay_speed,
 			   int *argc, char *argv[],
 			   struct weston_config *config)
 {
@@ -193,6 +204,15 @@ headless_compositor_create(struct wl_display *display,
 	if (noop_renderer_init(&c->base) < 0)
 		goto err_input;
 
+#ifdef BUILD_HEADLESS_REPLAY
+	if (replay) {
+		c->replay = evdev_replay_create(&c->fake_seat,
+						replay, replay_speed);
+		if (c->replay == NULL)
+			goto err_input;
+	}
+#endif
+
 	return &c->base;
 
 err_input:
@@ -210,15 +230,26 @@ backend_init(struct wl_display *display, int *argc, char *argv[],
 {
 	int width = 1024, height = 640;
 	char *display_name = NULL;
+	char *replay = NULL;
+	int replay_speed = 1;
+	struct weston_compositor *ec;
 
 	const struct weston_option headless_options[] = {
 		{ WESTON_OPTION_INTEGER, "width", 0, &width },
 		{ WESTON_OPTION_INTEGER, "height", 0, &height },
+#ifdef BUILD_HEADLESS_REPLAY
+		{ WESTON_OPTION_STRING, "replay", 0, &replay },
+		{ WESTON_OPTION_INTEGER, "replay-speed", 0, &replay_speed },
+#endif
 	};
 
 	parse_options(headless_options,
 		      ARRAY_LENGTH(headless_options), argc, argv);
 
-	return headless_compositor_create(display, width, height, display_name,
-					  argc, argv, config);
+	ec = headless_compositor_create(display, width, height, display_name,
+					replay, replay_speed,
+					argc, argv, config);
+	free(replay);
+
+	return ec;
 }
@@ -25,6 +25,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
 #include <linux/input.h>
 
 #if HAVE_FREERDP_VERSION_H
@@ -50,6 +54,8 @@
 #define MAX_FREERDP_FDS 32
 #define DEFAULT_AXIS_STEP_DISTANCE wl_fixed_from_int(10)
 #define RDP_MODE_FREQ 60 * 1000
+#define RDP_MAX_BANDS 8
+#define RFX_TILE_SIZE 64
 
 struct rdp_compositor_config {
 	int width;
@@ -82,6 +88,56 @@ struct rdp_compositor {
 enum peer_item_flags {
 	RDP_PEER_ACTIVATED      = (1 << 0),
 	RDP_PEER_OUTPUT_ENABLED = (1 << 1),
+	RDP_PEER_ENCODE_WAITING = (1 << 2),
+};
+
+enum rdp_codec {
+	RDP_CODEC_RFX,
+	RDP_CODEC_NSC,
+	RDP_CODEC_COUNT
+};
+
+/* A stripe of the damage, a whole number of tile rows high, encoded
+ * on its own so that the stripes can be encoded in parallel. */
+struct rdp_band {
+	RFX_CONTEXT *rfx_context;
+	NSC_CONTEXT *nsc_context;
+	RFX_RECT *rfx_rects;
+	wStream *stream;
+	pixman_region32_t damage;
+};
+
+/* One encoder per codec, shared by all the peers using that codec, so
+ * that the damage of a frame is only encoded once for all of them. */
+struct rdp_encoder {
+	enum rdp_codec codec;
+	int refcount;
+
+	struct rdp_band bands[RDP_MAX_BANDS];
+	int count_bands;
+
+	/* the bands hold this damage of the current frame */
+	int valid;
+	pixman_region32_t damage;
+};
+
+/* Worker threads encoding bands off the compositor thread. When the
+ * last queued band is done, done_fd wakes the event loop up to send
+ * the frame to the peers waiting for it. */
+struct rdp_encode_pool {
+	pthread_t threads[RDP_MAX_BANDS];
+	int count_threads;
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	int destroying;
+
+	pixman_image_t *image;
+	struct rdp_band *queue[RDP_MAX_BANDS * RDP_CODEC_COUNT];
+	int queued, next, remaining;
+
+	int done_fd;
+	struct wl_event_source *done_source;
 };
 
 struct rdp_peers_item {
@@ -89,14 +145,35 @@ struct rdp_peers_item {
 	freerdp_peer *peer;
 	struct weston_seat seat;
 
+	struct rdp_encoder *encoder;	/* NULL for raw bitmaps */
+	BYTE *flip_buffer;
+	pixman_region32_t pending_damage;
+	uint32_t frames_in_flight;
+
 	struct wl_list link;
 };
 
+struct rdp_tile_stats {
+	uint64_t tiles_checked;
+	uint64_t tiles_unchanged;
+	uint64_t pixels_sent;
+	uint64_t bytes_sent;
+	uint64_t pixels_saved;	/* once per peer that would have got them */
+};
+
 struct rdp_output {
 	struct weston_output base;
 	struct wl_event_source *finish_frame_timer;
 	pixman_image_t *shadow_surface;
 
+	/* hashes of the tiles of the shadow surface, 0 when unknown, to
+	 * tell the damage that left the pixels as they were */
+	uint64_t *tile_hashes;
+	int tiles_x, tiles_y;
+	struct rdp_tile_stats stats;
+
+	struct rdp_encoder *encoders[RDP_CODEC_COUNT];
+	struct rdp_encode_pool pool;
 	struct wl_list peers;
 };
 
@@ -105,10 +182,6 @@ struct rdp_peer_context {
 
 	struct rdp_compositor *rdpCompositor;
 	struct wl_event_source *events[MAX_FREERDP_FDS];
-	RFX_CONTEXT *rfx_context;
-	wStream *encode_stream;
-	RFX_RECT *rfx_rects;
-	NSC_CONTEXT *nsc_context;
 
 	struct rdp_peers_item item;
 };
@@ -128,92 +201,352 @@ rdp_compositor_config_init(struct rdp_compositor_config *config) {
 }
 
 static void
-rdp_peer_refresh_rfx(pixman_region32_t *damage, pixman_image_t *image, freerdp_peer *peer)
+rdp_band_fini(struct rdp_band *band)
+{
+	if (band->rfx_context)
+		rfx_context_free(band->rfx_context);
+	if (band->nsc_context)
+		nsc_context_free(band->nsc_context);
+	if (band->stream)
+		Stream_Free(band->stream, TRUE);
+	free(band->rfx_rects);
+	pixman_region32_fini(&band->damage);
+}
+
+static int
+rdp_band_init(struct rdp_band *band, enum rdp_codec codec,
+	      int width, int height)
 {
+	pixman_region32_init(&band->damage);
+
+	switch (codec) {
+	case RDP_CODEC_RFX:
+#if FREERDP_VERSION_MAJOR == 1 && FREERDP_VERSION_MINOR == 1
+		band->rfx_context = rfx_context_new();
+#else
+		band->rfx_context = rfx_context_new(TRUE);
+#endif
+		if (!band->rfx_context)
+			return -1;
+		band->rfx_context->mode = RLGR3;
+		band->rfx_context->width = width;
+		band->rfx_context->height = height;
+		rfx_context_set_pixel_format(band->rfx_context,
+					     RDP_PIXEL_FORMAT_B8G8R8A8);
+		break;
+	case RDP_CODEC_NSC:
+		band->nsc_context = nsc_context_new();
+		if (!band->nsc_context)
+			return -1;
+		nsc_context_set_pixel_format(band->nsc_context,
+					     RDP_PIXEL_FORMAT_B8G8R8A8);
+		break;
+	default:
+		return -1;
+	}
+
+	band->stream = Stream_New(NULL, 65536);
+	if (!band->stream)
+		return -1;
+
+	return 0;
+}
+
+/* Runs on the worker threads: touches nothing but the band and the
+ * shadow surface, which is not drawn to until the frame is sent. */
+static void
+rdp_band_encode(struct rdp_band *band, pixman_image_t *image)
+{
+	pixman_region32_t *damage = &band->damage;
 	int width, height, nrects, i;
 	pixman_box32_t *region, *rects;
 	uint32_t *ptr;
 	RFX_RECT *rfxRect;
-	rdpUpdate *update = peer->update;
-	SURFACE_BITS_COMMAND *cmd = &update->surface_bits_command;
-	RdpPeerContext *context = (RdpPeerContext *)peer->context;
 
-	Stream_Clear(context->encode_stream);
-	Stream_SetPosition(context->encode_stream, 0);
+	Stream_Clear(band->stream);
+	Stream_SetPosition(band->stream, 0);
 
 	width = (damage->extents.x2 - damage->extents.x1);
 	height = (damage->extents.y2 - damage->extents.y1);
 
-	cmd->destLeft = damage->extents.x1;
-	cmd->destTop = damage->extents.y1;
-	cmd->destRight = damage->extents.x2;
-	cmd->destBottom = damage->extents.y2;
-	cmd->bpp = 32;
-	cmd->codecID = peer->settings->RemoteFxCodecId;
-	cmd->width = width;
-	cmd->height = height;
-
 	ptr = pixman_image_get_data(image) + damage->extents.x1 +
-				damage->extents.y1 * (pixman_image_get_stride(image) / sizeof(uint32_t));
+				damage->extents.y1 * (pixman_image_get_stride(image) / (int) sizeof(uint32_t));
 
-	rects = pixman_region32_rectangles(damage, &nrects);
-	context->rfx_rects = realloc(context->rfx_rects, nrects * sizeof *rfxRect);
+	if (band->rfx_context) {
+		rects = pixman_region32_rectangles(damage, &nrects);
+		band->rfx_rects = realloc(band->rfx_rects, nrects * sizeof *rfxRect);
 
-	for (i = 0; i < nrects; i++) {
-		region = &rects[i];
-		rfxRect = &context->rfx_rects[i];
+		for (i = 0; i < nrects; i++) {
+			region = &rects[i];
+			rfxRect = &band->rfx_rects[i];
 
-		rfxRect->x = (region->x1 - damage->extents.x1);
-		rfxRect->y = (region->y1 - damage->extents.y1);
-		rfxRect->width = (region->x2 - region->x1);
-		rfxRect->height = (region->y2 - region->y1);
+			rfxRect->x = (region->x1 - damage->extents.x1);
+			rfxRect->y = (region->y1 - damage->extents.y1);
+			rfxRect->width = (region->x2 - region->x1);
+			rfxRect->height = (region->y2 - region->y1);
+		}
+
+		rfx_compose_message(band->rfx_context, band->stream, band->rfx_rects, nrects,
+				(BYTE *)ptr, width, height,
+				pixman_image_get_stride(image)
+		);
+	} else {
+		nsc_compose_message(band->nsc_context, band->stream, (BYTE *)ptr,
+				width, height,
+				pixman_image_get_stride(image));
 	}
+}
 
-	rfx_compose_message(context->rfx_context, context->encode_stream, context->rfx_rects, nrects,
-			(BYTE *)ptr, width, height,
-			pixman_image_get_stride(image)
-	);
+static void
+rdp_encoder_destroy(struct rdp_encoder *encoder)
+{
+	int i;
 
-	cmd->bitmapDataLength = Stream_GetPosition(context->encode_stream);
-	cmd->bitmapData = Stream_Buffer(context->encode_stream);
+	for (i = 0; i < encoder->count_bands; i++)
+		rdp_band_fini(&encoder->bands[i]);
+	pixman_region32_fini(&encoder->damage);
+	free(encoder);
+}
+
+static struct rdp_encoder *
+rdp_encoder_create(enum rdp_codec codec, int count_bands,
+		   int width, int height)
+{
+	struct rdp_encoder *encoder;
+	int i;
+
+	encoder = zalloc(sizeof *encoder);
+	if (!encoder)
+		return NULL;
+
+	encoder->codec = codec;
+	pixman_region32_init(&encoder->damage);
+
+	for (i = 0; i < count_bands; i++) {
+		encoder->count_bands++;
+		if (rdp_band_init(&encoder->bands[i], codec, width, height) < 0) {
+			rdp_encoder_destroy(encoder);
+			return NULL;
+		}
+	}
 
-	update->SurfaceBits(update->context, cmd);
+	return encoder;
 }
 
+/* Forget the encoded frame, and make the next one start with the
+ * headers a new peer needs. */
+static void
+rdp_encoder_reset(struct rdp_encoder *encoder, int width, int height)
+{
+	RFX_CONTEXT *rfx_context;
+	int i;
+
+	for (i = 0; i < encoder->count_bands; i++) {
+		rfx_context = encoder->bands[i].rfx_context;
+		if (!rfx_context)
+			continue;
 
+		rfx_context->width = width;
+		rfx_context->height = height;
+		rfx_context_reset(rfx_context);
+	}
+	encoder->valid = 0;
+}
+
+/* Splits the damage in stripes of whole tile rows, so that the tiles
+ * are the same as when encoding the damage in one go. */
 static void
-rdp_peer_refresh_nsc(pixman_region32_t *damage, pixman_image_t *image, freerdp_peer *peer)
+rdp_encoder_split(struct rdp_encoder *encoder, pixman_region32_t *damage)
 {
-	int width, height;
-	uint32_t *ptr;
-	rdpUpdate *update = peer->update;
-	SURFACE_BITS_COMMAND *cmd = &update->surface_bits_command;
-	RdpPeerContext *context = (RdpPeerContext *)peer->context;
+	pixman_box32_t *extents = &damage->extents;
+	struct rdp_band *band;
+	int rows, rows_per_band, y1, y2, i;
+
+	rows = (extents->y2 - extents->y1 + RFX_TILE_SIZE - 1) / RFX_TILE_SIZE;
+	rows_per_band = (rows + encoder->count_bands - 1) / encoder->count_bands;
+
+	for (i = 0; i < encoder->count_bands; i++) {
+		band = &encoder->bands[i];
+		y1 = extents->y1 + i * rows_per_band * RFX_TILE_SIZE;
+		y2 = y1 + rows_per_band * RFX_TILE_SIZE;
+		if (y2 > extents->y2)
+			y2 = extents->y2;
+
+		if (y1 >= y2) {
+			pixman_region32_fini(&band->damage);
+			pixman_region32_init(&band->damage);
+			continue;
+		}
 
-	Stream_Clear(context->encode_stream);
-	Stream_SetPosition(context->encode_stream, 0);
+		pixman_region32_intersect_rect(&band->damage, damage,
+					       extents->x1, y1,
+					       extents->x2 - extents->x1,
+					       y2 - y1);
+	}
+}
 
-	width = (damage->extents.x2 - damage->extents.x1);
-	height = (damage->extents.y2 - damage->extents.y1);
+static void *
+rdp_encode_worker(void *data)
+{
+	struct rdp_encode_pool *pool = data;
+	struct rdp_band *band;
+	pixman_image_t *image;
 
-	cmd->destLeft = damage->extents.x1;
-	cmd->destTop = damage->extents.y1;
-	cmd->destRight = damage->extents.x2;
-	cmd->destBottom = damage->extents.y2;
-	cmd->bpp = 32;
-	cmd->codecID = peer->settings->NSCodecId;
-	cmd->width = width;
-	cmd->height = height;
+	pthread_mutex_lock(&pool->mutex);
 
-	ptr = pixman_image_get_data(image) + damage->extents.x1 +
-				damage->extents.y1 * (pixman_image_get_stride(image) / sizeof(uint32_t));
+	while (!pool->destroying) {
+		if (pool->next == pool->queued) {
+			pthread_cond_wait(&pool->work_cond, &pool->mutex);
+			continue;
+		}
+
+		band = pool->queue[pool->next++];
+		image = pool->image;
+		pthread_mutex_unlock(&pool->mutex);
+
+		rdp_band_encode(band, image);
+
+		pthread_mutex_lock(&pool->mutex);
+		if (--pool->remaining == 0) {
+			pthread_cond_signal(&pool->done_cond);
+			eventfd_write(pool->done_fd, 1);
+		}
+	}
+
+	pthread_mutex_unlock(&pool->mutex);
+
+	return NULL;
+}
+
+/* Starts encoding the damage of the shadow surface into the encoder's
+ * bands; rdp_output_wait_encode() tells when they are ready. */
+static void
+rdp_output_queue_encode(struct rdp_output *output,
+			struct rdp_encoder *encoder, pixman_region32_t *damage)
+{
+	struct rdp_encode_pool *pool = &output->pool;
+	struct rdp_band *band;
+	int i;
+
+	rdp_encoder_split(encoder, damage);
+	pixman_region32_copy(&encoder->damage, damage);
+	encoder->valid = 1;
+
+	if (pool->count_threads == 0) {
+		for (i = 0; i < encoder->count_bands; i++) {
+			band = &encoder->bands[i];
+			if (pixman_region32_not_empty(&band->damage))
+				rdp_band_encode(band, output->shadow_surface);
+		}
+		return;
+	}
+
+	pthread_mutex_lock(&pool->mutex);
+
+	if (pool->remaining == 0)
+		pool->queued = pool->next = 0;
+	pool->image = output->shadow_surface;
+
+	for (i = 0; i < encoder->count_bands; i++) {
+		band = &encoder->bands[i];
+		if (!pixman_region32_not_empty(&band->damage))
+			continue;
+
+		pool->queue[pool->queued++] = band;
+		pool->remaining++;
+	}
+
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+static void
+rdp_output_wait_encode(struct rdp_output *output)
+{
+	struct rdp_encode_pool *pool = &output->pool;
+
+	if (pool->count_threads == 0)
+		return;
+
+	pthread_mutex_lock(&pool->mutex);
+	while (pool->remaining > 0)
+		pthread_cond_wait(&pool->done_cond, &pool->mutex);
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+static struct rdp_encoder *
+rdp_output_get_encoder(struct rdp_output *output, enum rdp_codec codec)
+{
+	struct rdp_encoder *encoder = output->encoders[codec];
+	int count_bands;
+
+	if (!encoder) {
+		count_bands = output->pool.count_threads;
+		if (count_bands < 1)
+			count_bands = 1;
+
+		encoder = rdp_encoder_create(codec, count_bands,
+					     output->base.width,
+					     output->base.height);
+		if (!encoder)
+			return NULL;
+		output->encoders[codec] = encoder;
+	}
+
+	encoder->refcount++;
+
+	return encoder;
+}
 
-	nsc_compose_message(context->nsc_context, context->encode_stream, (BYTE *)ptr,
-			cmd->width,	cmd->height,
-			pixman_image_get_stride(image));
-	cmd->bitmapDataLength = Stream_GetPosition(context->encode_stream);
-	cmd->bitmapData = Stream_Buffer(context->encode_stream);
-	update->SurfaceBits(update->context, cmd);
+static void
+rdp_output_put_encoder(struct rdp_output *output, struct rdp_encoder *encoder)
+{
+	if (--encoder->refcount > 0)
+		return;
+
+	/* the workers may still be on its bands */
+	rdp_output_wait_encode(output);
+
+	output->encoders[encoder->codec] = NULL;
+	rdp_encoder_destroy(encoder);
+}
+
+static uint64_t
+rdp_peer_send_encoded(struct rdp_encoder *encoder, freerdp_peer *peer)
+{
+	rdpUpdate *update = peer->update;
+	SURFACE_BITS_COMMAND *cmd = &update->surface_bits_command;
+	pixman_box32_t *extents;
+	struct rdp_band *band;
+	uint64_t bytes = 0;
+	int i;
+
+	for (i = 0; i < encoder->count_bands; i++) {
+		band = &encoder->bands[i];
+		if (!pixman_region32_not_empty(&band->damage))
+			continue;
+
+		extents = &band->damage.extents;
+		cmd->destLeft = extents->x1;
+		cmd->destTop = extents->y1;
+		cmd->destRight = extents->x2;
+		cmd->destBottom = extents->y2;
+		cmd->bpp = 32;
+		if (encoder->codec == RDP_CODEC_RFX)
+			cmd->codecID = peer->settings->RemoteFxCodecId;
+		else
+			cmd->codecID = peer->settings->NSCodecId;
+		cmd->width = extents->x2 - extents->x1;
+		cmd->height = extents->y2 - extents->y1;
+
+		cmd->bitmapDataLength = Stream_GetPosition(band->stream);
+		cmd->bitmapData = Stream_Buffer(band->stream);
+
+		update->SurfaceBits(update->context, cmd);
+		bytes += cmd->bitmapDataLength;
+	}
+
+	return bytes;
 }
 
 static void
@@ -229,76 +562,398 @@ pixman_image_flipped_subrect(const pixman_box32_t *rect, pixman_image_t *img, BY
 		   memcpy(dest, src, toCopy);
 }
 
-static void
-rdp_peer_refresh_raw(pixman_region32_t *region, pixman_image_t *image, freerdp_peer *peer)
+/* Sends the rectangle in chunks the peer accepts. Raw bitmaps are
+ * bottom-up: the chunks are copied upside down into flip_buffer, or,
+ * with no flip_buffer, sent straight from the shadow surface, which
+ * works for whole rows only. */
+static uint64_t
+rdp_peer_send_raw_rect(freerdp_peer *peer, pixman_image_t *image,
+		       pixman_box32_t *rect, BYTE **flip_buffer)
 {
 	rdpUpdate *update = peer->update;
 	SURFACE_BITS_COMMAND *cmd = &update->surface_bits_command;
-	SURFACE_FRAME_MARKER *marker = &update->surface_frame_marker;
-	pixman_box32_t *rect, subrect;
-	int nrects, i;
+	BYTE *data = (BYTE *)pixman_image_get_data(image);
+	int stride = pixman_image_get_stride(image);
+	pixman_box32_t subrect;
+	uint64_t bytes = 0;
 	int heightIncrement, remainingHeight, top;
 
-	rect = pixman_region32_rectangles(region, &nrects);
-	if (!nrects)
-		return;
-
-	marker->frameId++;
-	marker->frameAction = SURFACECMD_FRAMEACTION_BEGIN;
-	update->SurfaceFrameMarker(peer->context, marker);
-
 	cmd->bpp = 32;
 	cmd->codecID = 0;
+	cmd->destLeft = rect->x1;
+	cmd->destRight = rect->x2;
+	cmd->width = rect->x2 - rect->x1;
+
+	heightIncrement = peer->settings->MultifragMaxRequestSize / (16 + cmd->width * 4);
+	if (heightIncrement < 1)
+		heightIncrement = 1;
+	remainingHeight = rect->y2 - rect->y1;
+	top = rect->y1;
+
+	subrect.x1 = rect->x1;
+	subrect.x2 = rect->x2;
+
+	while (remainingHeight) {
+		cmd->height = (remainingHeight > heightIncrement) ? heightIncrement : remainingHeight;
+		cmd->destTop = top;
+		cmd->destBottom = top + cmd->height;
+		cmd->bitmapDataLength = cmd->width * cmd->height * 4;
+
+		subrect.y1 = top;
+		subrect.y2 = top + cmd->height;
+		if (flip_buffer) {
+			*flip_buffer = realloc(*flip_buffer, cmd->bitmapDataLength);
+			if (!*flip_buffer)
+				break;
+			pixman_image_flipped_subrect(&subrect, image, *flip_buffer);
+			cmd->bitmapData = *flip_buffer;
+		} else {
+			cmd->bitmapData = data + (subrect.y2 - 1) * stride;
+		}
 
-	for (i = 0; i < nrects; i++, rect++) {
-		/*weston_log("rect(%d,%d, %d,%d)\n", rect->x1, rect->y1, rect->x2, rect->y2);*/
-		cmd->destLeft = rect->x1;
-		cmd->destRight = rect->x2;
-		cmd->width = rect->x2 - rect->x1;
+		update->SurfaceBits(peer->context, cmd);
+		bytes += cmd->bitmapDataLength;
 
-		heightIncrement = peer->settings->MultifragMaxRequestSize / (16 + cmd->width * 4);
-		remainingHeight = rect->y2 - rect->y1;
-		top = rect->y1;
+		remainingHeight -= cmd->height;
+		top += cmd->height;
+	}
 
-		subrect.x1 = rect->x1;
-		subrect.x2 = rect->x2;
+	cmd->bitmapData = NULL;
 
-		while (remainingHeight) {
-			   cmd->height = (remainingHeight > heightIncrement) ? heightIncrement : remainingHeight;
-			   cmd->destTop = top;
-			   cmd->destBottom = top + cmd->height;
-			   cmd->bitmapDataLength = cmd->width * cmd->height * 4;
-			   cmd->bitmapData = (BYTE *)realloc(cmd->bitmapData, cmd->bitmapDataLength);
+	return bytes;
+}
 
-			   subrect.y1 = top;
-			   subrect.y2 = top + cmd->height;
-			   pixman_image_flipped_subrect(&subrect, image, cmd->bitmapData);
+static uint64_t
+rdp_peer_refresh_raw(pixman_region32_t *region, pixman_image_t *image, freerdp_peer *peer)
+{
+	RdpPeerContext *context = (RdpPeerContext *)peer->context;
+	int width = pixman_image_get_width(image);
+	pixman_region32_t rows, rest;
+	pixman_box32_t *rect;
+	uint64_t bytes = 0;
+	int nrects, i;
 
-			   /*weston_log("*  sending (%d,%d, %d,%d)\n", subrect.x1, subrect.y1, subrect.x2, subrect.y2); */
-			   update->SurfaceBits(peer->context, cmd);
+	/* Rectangles spanning most of the width are widened to whole rows,
+	 * which the bottom-up shadow surface holds just as the peer wants
+	 * them; only the narrower ones need a copy. */
+	pixman_region32_init(&rows);
+	if (pixman_image_get_stride(image) == -width * 4) {
+		rect = pixman_region32_rectangles(region, &nrects);
+		for (i = 0; i < nrects; i++)
+			if ((rect[i].x2 - rect[i].x1) * 4 >= width * 3)
+				pixman_region32_union_rect(&rows, &rows,
+							   0, rect[i].y1, width,
+							   rect[i].y2 - rect[i].y1);
+	}
 
-			   remainingHeight -= cmd->height;
-			   top += cmd->height;
-		}
+	pixman_region32_init(&rest);
+	pixman_region32_subtract(&rest, region, &rows);
+
+	rect = pixman_region32_rectangles(&rows, &nrects);
+	for (i = 0; i < nrects; i++)
+		bytes += rdp_peer_send_raw_rect(peer, image, &rect[i], NULL);
+
+	rect = pixman_region32_rectangles(&rest, &nrects);
+	for (i = 0; i < nrects; i++)
+		bytes += rdp_peer_send_raw_rect(peer, image, &rect[i],
+						&context->item.flip_buffer);
+
+	pixman_region32_fini(&rows);
+	pixman_region32_fini(&rest);
+
+	return bytes;
+}
+
+static void
+rdp_shadow_surface_destroy(pixman_image_t *image, void *data)
+{
+	free(data);
+}
+
+/* The shadow surface is laid out bottom-up, as raw bitmaps are, with a
+ * negative stride: a run of whole rows can then be sent as it is. */
+static pixman_image_t *
+rdp_create_shadow_surface(int width, int height)
+{
+	pixman_image_t *image;
+	uint32_t *data;
+
+	data = calloc(height, width * 4);
+	if (!data)
+		return NULL;
+
+	image = pixman_image_create_bits(PIXMAN_x8r8g8b8, width, height,
+					 data + (height - 1) * width,
+					 -width * 4);
+	if (!image) {
+		free(data);
+		return NULL;
 	}
 
-	marker->frameAction = SURFACECMD_FRAMEACTION_END;
+	pixman_image_set_destroy_function(image, rdp_shadow_surface_destroy,
+					  data);
+
+	return image;
+}
+
+static uint64_t
+region_area(pixman_region32_t *region)
+{
+	pixman_box32_t *rects;
+	uint64_t area = 0;
+	int nrects, i;
+
+	rects = pixman_region32_rectangles(region, &nrects);
+	for (i = 0; i < nrects; i++)
+		area += (uint64_t) (rects[i].x2 - rects[i].x1) *
+			(rects[i].y2 - rects[i].y1);
+
+	return area;
+}
+
+static void
+rdp_peer_frame_marker(freerdp_peer *peer, UINT32 action)
+{
+	rdpUpdate *update = peer->update;
+	SURFACE_FRAME_MARKER *marker = &update->surface_frame_marker;
+
+	if (action == SURFACECMD_FRAMEACTION_BEGIN)
+		marker->frameId++;
+	marker->frameAction = action;
 	update->SurfaceFrameMarker(peer->context, marker);
 }
 
+/* Sends the region as one frame, from the encoder's bands if the peer
+ * has an encoder. */
 static void
-rdp_peer_refresh_region(pixman_region32_t *region, freerdp_peer *peer)
+rdp_peer_send_frame(struct rdp_peers_item *item, pixman_region32_t *region)
 {
+	freerdp_peer *peer = item->peer;
 	RdpPeerContext *context = (RdpPeerContext *)peer->context;
 	struct rdp_output *output = context->rdpCompositor->output;
-	rdpSettings *settings = peer->settings;
+	uint64_t bytes;
 
-	if (settings->RemoteFxCodec)
-		rdp_peer_refresh_rfx(region, output->shadow_surface, peer);
-	else if (settings->NSCodec)
-		rdp_peer_refresh_nsc(region, output->shadow_surface, peer);
+	rdp_peer_frame_marker(peer, SURFACECMD_FRAMEACTION_BEGIN);
+
+	if (item->encoder)
+		bytes = rdp_peer_send_encoded(item->encoder, peer);
 	else
-		rdp_peer_refresh_raw(region, output->shadow_surface, peer);
+		bytes = rdp_peer_refresh_raw(region, output->shadow_surface, peer);
+
+	output->stats.bytes_sent += bytes;
+	output->stats.pixels_sent += region_area(region);
+
+	rdp_peer_frame_marker(peer, SURFACECMD_FRAMEACTION_END);
+
+	if (peer->settings->FrameAcknowledge)
+		item->frames_in_flight++;
+}
+
+/* Waits for the frame being encoded and sends it to the peers waiting
+ * for it. */
+static void
+rdp_output_finish_encode(struct rdp_output *output)
+{
+	struct rdp_peers_item *item;
+
+	rdp_output_wait_encode(output);
+
+	wl_list_for_each(item, &output->peers, link) {
+		if (!(item->flags & RDP_PEER_ENCODE_WAITING))
+			continue;
+
+		item->flags &= ~RDP_PEER_ENCODE_WAITING;
+		rdp_peer_send_frame(item, &item->pending_damage);
+
+		pixman_region32_fini(&item->pending_damage);
+		pixman_region32_init(&item->pending_damage);
+	}
+}
+
+static int
+rdp_encode_done_handler(int fd, uint32_t mask, void *data)
+{
+	struct rdp_output *output = data;
+	eventfd_t count;
+
+	eventfd_read(fd, &count);
+	rdp_output_finish_encode(output);
+
+	return 1;
+}
+
+/* Sends the region as one frame, right away. The encoded data is reused
+ * when another peer with the same codec already got the same region of
+ * this frame. */
+static void
+rdp_peer_refresh_region(pixman_region32_t *region, freerdp_peer *peer)
+{
+	RdpPeerContext *context = (RdpPeerContext *)peer->context;
+	struct rdp_output *output = context->rdpCompositor->output;
+	struct rdp_encoder *encoder = context->item.encoder;
+
+	/* the frame in the works goes first, and frees the bands */
+	rdp_output_finish_encode(output);
+
+	if (!pixman_region32_not_empty(region))
+		return;
+
+	if (encoder && (!encoder->valid ||
+			!pixman_region32_equal(&encoder->damage, region))) {
+		rdp_output_queue_encode(output, encoder, region);
+		rdp_output_wait_encode(output);
+	}
+
+	rdp_peer_send_frame(&context->item, region);
+}
+
+/* A peer that acknowledges frames has as many unacknowledged ones as it
+ * asked for: it gets no more until it catches up, and its damage piles
+ * up meanwhile, so a slow peer skips frames rather than delaying the
+ * others. */
+static int
+rdp_peer_is_congested(struct rdp_peers_item *item)
+{
+	UINT32 max_frames = item->peer->settings->FrameAcknowledge;
+
+	return max_frames && item->frames_in_flight >= max_frames;
+}
+
+static void
+rdp_peer_flush(struct rdp_peers_item *item)
+{
+	rdp_peer_refresh_region(&item->pending_damage, item->peer);
+
+	pixman_region32_fini(&item->pending_damage);
+	pixman_region32_init(&item->pending_damage);
+}
+
+static void
+rdp_peer_refresh_full(struct rdp_peers_item *item)
+{
+	struct rdp_output *output =
+		((RdpPeerContext *) item->peer->context)->rdpCompositor->output;
+
+	pixman_region32_union_rect(&item->pending_damage,
+				   &item->pending_damage, 0, 0,
+				   output->base.width, output->base.height);
+	rdp_peer_flush(item);
+}
+
+static uint64_t
+rdp_tile_hash(const uint32_t *data, int stride, int width, int height)
+{
+	const uint64_t k = 0x9e3779b97f4a7c15ULL;
+	uint64_t h[4] = { 1, 2, 3, 4 }, w;
+	const uint32_t *row;
+	int x, y;
+
+	/* four independent lanes over pairs of pixels, so that the
+	 * multiplications do not wait for each other */
+	for (y = 0; y < height; y++) {
+		row = data + y * (stride / 4);
+		for (x = 0; x + 8 <= width; x += 8) {
+			memcpy(&w, row + x, 8);
+			h[0] = (h[0] ^ w) * k;
+			memcpy(&w, row + x + 2, 8);
+			h[1] = (h[1] ^ w) * k;
+			memcpy(&w, row + x + 4, 8);
+			h[2] = (h[2] ^ w) * k;
+			memcpy(&w, row + x + 6, 8);
+			h[3] = (h[3] ^ w) * k;
+		}
+		for (; x < width; x++)
+			h[x & 3] = (h[x & 3] ^ row[x]) * k;
+	}
+
+	w = h[0] ^ (h[1] >> 17) ^ (h[2] >> 31) ^ (h[3] >> 47);
+	w = (w ^ (w >> 29)) * k;
+	w ^= h[1] ^ (h[2] << 13) ^ (h[3] << 27);
+	w ^= w >> 32;
+
+	return w ? w : 1;
+}
+
+static void
+rdp_output_reset_tiles(struct rdp_output *output, int width, int height)
+{
+	free(output->tile_hashes);
+
+	output->tiles_x = (width + RFX_TILE_SIZE - 1) / RFX_TILE_SIZE;
+	output->tiles_y = (height + RFX_TILE_SIZE - 1) / RFX_TILE_SIZE;
+	output->tile_hashes = calloc(output->tiles_x * output->tiles_y,
+				     sizeof *output->tile_hashes);
+}
+
+/* Toolkits often redraw whole windows for a small change. Hash every
+ * tile the damage touches, and leave out of changed the tiles that are
+ * the same as after the previous repaint: every peer already has them,
+ * or still has them in its pending damage. */
+static void
+rdp_output_filter_damage(struct rdp_output *output, pixman_region32_t *damage,
+			 pixman_region32_t *changed)
+{
+	pixman_image_t *image = output->shadow_surface;
+	uint32_t *data = pixman_image_get_data(image);
+	int stride = pixman_image_get_stride(image);
+	int width = pixman_image_get_width(image);
+	int height = pixman_image_get_height(image);
+	struct rdp_peers_item *item;
+	pixman_box32_t *extents = &damage->extents;
+	pixman_region32_t unchanged;
+	pixman_box32_t tile;
+	uint64_t hash, *stored, pixels;
+	int tx, ty, peers = 0;
+
+	pixman_region32_copy(changed, damage);
+	if (!output->tile_hashes)
+		return;
+
+	pixman_region32_init(&unchanged);
+
+	for (ty = extents->y1 / RFX_TILE_SIZE;
+	     ty < output->tiles_y && ty * RFX_TILE_SIZE < extents->y2; ty++) {
+		for (tx = extents->x1 / RFX_TILE_SIZE;
+		     tx < output->tiles_x && tx * RFX_TILE_SIZE < extents->x2;
+		     tx++) {
+			tile.x1 = tx * RFX_TILE_SIZE;
+			tile.y1 = ty * RFX_TILE_SIZE;
+			tile.x2 = MIN(tile.x1 + RFX_TILE_SIZE, width);
+			tile.y2 = MIN(tile.y1 + RFX_TILE_SIZE, height);
+
+			if (pixman_region32_contains_rectangle(damage, &tile) ==
+			    PIXMAN_REGION_OUT)
+				continue;
+
+			hash = rdp_tile_hash(data + tile.y1 * (stride / 4) + tile.x1,
+					     stride, tile.x2 - tile.x1,
+					     tile.y2 - tile.y1);
+			stored = &output->tile_hashes[ty * output->tiles_x + tx];
+			output->stats.tiles_checked++;
+
+			if (*stored != hash) {
+				*stored = hash;
+				continue;
+			}
+
+			output->stats.tiles_unchanged++;
+			pixman_region32_union_rect(&unchanged, &unchanged,
+						   tile.x1, tile.y1,
+						   tile.x2 - tile.x1,
+						   tile.y2 - tile.y1);
+		}
+	}
+
+	pixman_region32_subtract(changed, changed, &unchanged);
+	pixman_region32_fini(&unchanged);
+
+	wl_list_for_each(item, &output->peers, link)
+		if ((item->flags & RDP_PEER_ACTIVATED) &&
+		    (item->flags & RDP_PEER_OUTPUT_ENABLED))
+			peers++;
+
+	pixels = region_area(damage) - region_area(changed);
+	output->stats.pixels_saved += pixels * peers;
 }
 
 static void
@@ -318,19 +973,59 @@ rdp_output_repaint(struct weston_output *output_base, pixman_region32_t *damage)
 	struct rdp_output *output = container_of(output_base, struct rdp_output, base);
 	struct weston_compositor *ec = output->base.compositor;
 	struct rdp_peers_item *outputPeer;
+	struct rdp_encoder *encoder;
+	pixman_region32_t changed;
+	int i;
+
+	/* the workers may still be reading the previous frame */
+	rdp_output_finish_encode(output);
 
 	pixman_renderer_output_set_buffer(output_base, output->shadow_surface);
 	ec->renderer->repaint_output(&output->base, damage);
 
-	if (pixman_region32_not_empty(damage)) {
+	pixman_region32_init(&changed);
+	if (pixman_region32_not_empty(damage))
+		rdp_output_filter_damage(output, damage, &changed);
+
+	if (pixman_region32_not_empty(&changed)) {
+		for (i = 0; i < RDP_CODEC_COUNT; i++)
+			if (output->encoders[i])
+				output->encoders[i]->valid = 0;
+
+		/* Peers catching up on skipped frames have damage of their
+		 * own, they are sent to right away. */
 		wl_list_for_each(outputPeer, &output->peers, link) {
 			if ((outputPeer->flags & RDP_PEER_ACTIVATED) &&
 					(outputPeer->flags & RDP_PEER_OUTPUT_ENABLED))
 			{
-				rdp_peer_refresh_region(damage, outputPeer->peer);
+				pixman_region32_union(&outputPeer->pending_damage,
+						      &outputPeer->pending_damage,
+						      &changed);
+				if (rdp_peer_is_congested(outputPeer))
+					continue;
+				if (!outputPeer->encoder ||
+				    !pixman_region32_equal(&outputPeer->pending_damage, &changed))
+					rdp_peer_flush(outputPeer);
 			}
 		}
+
+		/* The others get the frame once the workers are done with
+		 * it, from rdp_encode_done_handler(). */
+		wl_list_for_each(outputPeer, &output->peers, link) {
+			encoder = outputPeer->encoder;
+			if (!(outputPeer->flags & RDP_PEER_ACTIVATED) ||
+			    !(outputPeer->flags & RDP_PEER_OUTPUT_ENABLED) ||
+			    !encoder || rdp_peer_is_congested(outputPeer) ||
+			    !pixman_region32_equal(&outputPeer->pending_damage, &changed))
+				continue;
+
+			outputPeer->flags |= RDP_PEER_ENCODE_WAITING;
+			if (!encoder->valid ||
+			    !pixman_region32_equal(&encoder->damage, &changed))
+				rdp_output_queue_encode(output, encoder, &changed);
+		}
 	}
+	pixman_region32_fini(&changed);
 
 	pixman_region32_subtract(&ec->primary_plane.damage,
 				 &ec->primary_plane.damage, damage);
@@ -339,12 +1034,69 @@ rdp_output_repaint(struct weston_output *output_base, pixman_region32_t *damage)
 	return 0;
 }
 
+static void
+rdp_encode_pool_init(struct rdp_encode_pool *pool,
+		     struct wl_event_loop *loop, struct rdp_output *output)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int i;
+
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->work_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+
+	pool->done_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (pool->done_fd < 0) {
+		weston_log("failed to create eventfd, encoding on the main thread\n");
+		return;
+	}
+	pool->done_source = wl_event_loop_add_fd(loop, pool->done_fd,
+						 WL_EVENT_READABLE,
+						 rdp_encode_done_handler,
+						 output);
+
+	/* without workers, everything is encoded on the main thread */
+	for (i = 0; i < cpus && i < RDP_MAX_BANDS; i++) {
+		if (pthread_create(&pool->threads[i], NULL,
+				   rdp_encode_worker, pool) != 0)
+			break;
+		pool->count_threads++;
+	}
+}
+
+static void
+rdp_encode_pool_release(struct rdp_encode_pool *pool)
+{
+	int i;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->destroying = 1;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (i = 0; i < pool->count_threads; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	if (pool->done_source)
+		wl_event_source_remove(pool->done_source);
+	if (pool->done_fd >= 0)
+		close(pool->done_fd);
+
+	pthread_mutex_destroy(&pool->mutex);
+	pthread_cond_destroy(&pool->work_cond);
+	pthread_cond_destroy(&pool->done_cond);
+}
+
 static void
 rdp_output_destroy(struct weston_output *output_base)
 {
 	struct rdp_output *output = (struct rdp_output *)output_base;
 
+	rdp_output_wait_encode(output);
+	rdp_encode_pool_release(&output->pool);
+
 	wl_event_source_remove(output->finish_frame_timer);
+	free(output->tile_hashes);
 	free(output);
 }
 
@@ -388,6 +1140,7 @@ rdp_switch_mode(struct weston_output *output, struct weston_mode *target_mode) {
 	rdpSettings *settings;
 	pixman_image_t *new_shadow_buffer;
 	struct weston_mode *local_mode;
+	int i;
 
 	local_mode = ensure_matching_mode(output, target_mode);
 	if (!local_mode) {
@@ -398,6 +1151,9 @@ rdp_switch_mode(struct weston_output *output, struct weston_mode *target_mode) {
 	if (local_mode == output->current_mode)
 		return 0;
 
+	/* the shadow surface is about to go away */
+	rdp_output_finish_encode(rdpOutput);
+
 	output->current_mode->flags &= ~WL_OUTPUT_MODE_CURRENT;
 
 	output->current_mode = local_mode;
@@ -406,14 +1162,27 @@ rdp_switch_mode(struct weston_output *output, struct weston_mode *target_mode) {
 	pixman_renderer_output_destroy(output);
 	pixman_renderer_output_create(output);
 
-	new_shadow_buffer = pixman_image_create_bits(PIXMAN_x8r8g8b8, target_mode->width,
-			target_mode->height, 0, target_mode->width * 4);
+	new_shadow_buffer = rdp_create_shadow_surface(target_mode->width,
+						      target_mode->height);
 	pixman_image_composite32(PIXMAN_OP_SRC, rdpOutput->shadow_surface, 0, new_shadow_buffer,
 			0, 0, 0, 0, 0, 0, target_mode->width, target_mode->height);
 	pixman_image_unref(rdpOutput->shadow_surface);
 	rdpOutput->shadow_surface = new_shadow_buffer;
+	rdp_output_reset_tiles(rdpOutput, target_mode->width, target_mode->height);
+
+	for (i = 0; i < RDP_CODEC_COUNT; i++)
+		if (rdpOutput->encoders[i])
+			rdp_encoder_reset(rdpOutput->encoders[i],
+					  target_mode->width,
+					  target_mode->height);
 
 	wl_list_for_each(rdpPeer, &rdpOutput->peers, link) {
+		/* the damage held back may not fit the new size */
+		pixman_region32_intersect_rect(&rdpPeer->pending_damage,
+					       &rdpPeer->pending_damage, 0, 0,
+					       target_mode->width,
+					       target_mode->height);
+
 		settings = rdpPeer->peer->settings;
 		if (settings->DesktopWidth == (UINT32)target_mode->width &&
 				settings->DesktopHeight == (UINT32)target_mode->height)
@@ -461,10 +1230,7 @@ rdp_compositor_create_output(struct rdp_compositor *c, int width, int height)
 
 	output->base.make = "weston";
 	output->base.model = "rdp";
-	output->shadow_surface = pixman_image_create_bits(PIXMAN_x8r8g8b8,
-			width, height,
-		    NULL,
-		    width * 4);
+	output->shadow_surface = rdp_create_shadow_surface(width, height);
 	if (output->shadow_surface == NULL) {
 		weston_log("Failed to create surface for frame buffer.\n");
 		goto out_output;
@@ -473,8 +1239,11 @@ rdp_compositor_create_output(struct rdp_compositor *c, int width, int height)
 	if (pixman_renderer_output_create(&output->base) < 0)
 		goto out_shadow_surface;
 
+	rdp_output_reset_tiles(output, width, height);
+
 	loop = wl_display_get_event_loop(c->base.wl_display);
 	output->finish_frame_timer = wl_event_loop_add_timer(loop, finish_frame_handler, output);
+	rdp_encode_pool_init(&output->pool, loop, output);
 
 	output->base.start_repaint_loop = rdp_output_start_repaint_loop;
 	output->base.repaint = rdp_output_repaint;
@@ -502,6 +1271,23 @@ rdp_restore(struct weston_compositor *ec)
 {
 }
 
+static void
+stats_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
+	      void *data)
+{
+	struct rdp_compositor *c = data;
+	struct rdp_tile_stats *stats = &c->output->stats;
+	double bytes_per_pixel = 0.0;
+
+	if (stats->pixels_sent)
+		bytes_per_pixel = (double) stats->bytes_sent / stats->pixels_sent;
+
+	weston_log("rdp: %"PRIu64" of %"PRIu64" damaged tiles unchanged, "
+		   "%"PRIu64" bytes sent, about %.0f bytes saved\n",
+		   stats->tiles_unchanged, stats->tiles_checked,
+		   stats->bytes_sent, stats->pixels_saved * bytes_per_pixel);
+}
+
 static void
 rdp_destroy(struct weston_compositor *ec)
 {
@@ -554,21 +1340,7 @@ rdp_peer_context_new(freerdp_peer* client, RdpPeerContext* context)
 {
 	context->item.peer = client;
 	context->item.flags = RDP_PEER_OUTPUT_ENABLED;
-
-#if FREERDP_VERSION_MAJOR == 1 && FREERDP_VERSION_MINOR == 1
-	context->rfx_context = rfx_context_new();
-#else
-	context->rfx_context = rfx_context_new(TRUE);
-#endif
-	context->rfx_context->mode = RLGR3;
-	context->rfx_context->width = client->settings->DesktopWidth;
-	context->rfx_context->height = client->settings->DesktopHeight;
-	rfx_context_set_pixel_format(context->rfx_context, RDP_PIXEL_FORMAT_B8G8R8A8);
-
-	context->nsc_context = nsc_context_new();
-	nsc_context_set_pixel_format(context->nsc_context, RDP_PIXEL_FORMAT_B8G8R8A8);
-
-	context->encode_stream = Stream_New(NULL, 65536);
+	pixman_region32_init(&context->item.pending_damage);
 }
 
 static void
@@ -589,10 +1361,11 @@ rdp_peer_context_free(freerdp_peer* client, RdpPeerContext* context)
 		weston_seat_release_pointer(&context->item.seat);
 		weston_seat_release(&context->item.seat);
 	}
-	Stream_Free(context->encode_stream, TRUE);
-	nsc_context_free(context->nsc_context);
-	rfx_context_free(context->rfx_context);
-	free(context->rfx_rects);
+	if (context->item.encoder)
+		rdp_output_put_encoder(context->rdpCompositor->output,
+				       context->item.encoder);
+	pixman_region32_fini(&context->item.pending_damage);
+	free(context->item.flip_buffer);
 }
 
 
@@ -655,13 +1428,9 @@ xf_peer_post_connect(freerdp_peer* client)
 	struct rdp_output *output;
 	rdpSettings *settings;
 	rdpPointerUpdate *pointer;
-	struct xkb_context *xkbContext;
 	struct xkb_rule_names xkbRuleNames;
 	struct xkb_keymap *keymap;
 	int i;
-	pixman_box32_t box;
-	pixman_region32_t damage;
-
 
 	peerCtx = (RdpPeerContext *)client->context;
 	c = peerCtx->rdpCompositor;
@@ -719,18 +1488,27 @@ xf_peer_post_connect(freerdp_peer* client)
 	}
 
 	keymap = NULL;
-	if (xkbRuleNames.layout) {
-		xkbContext = xkb_context_new(0);
-		if (!xkbContext) {
-			weston_log("unable to create a xkb_context\n");
-			return FALSE;
-		}
-
-		keymap = xkb_keymap_new_from_names(xkbContext, &xkbRuleNames, 0);
-	}
+	if (xkbRuleNames.layout)
+		keymap = weston_compositor_get_keymap(&c->base, &xkbRuleNames);
 	weston_seat_init_keyboard(&peerCtx->item.seat, keymap);
+	if (keymap)
+		xkb_keymap_unref(keymap);
 	weston_seat_init_pointer(&peerCtx->item.seat);
 
+	if (settings->RemoteFxCodec)
+		peerCtx->item.encoder =
+			rdp_output_get_encoder(output, RDP_CODEC_RFX);
+	else if (settings->NSCodec)
+		peerCtx->item.encoder =
+			rdp_output_get_encoder(output, RDP_CODEC_NSC);
+	if (peerCtx->item.encoder) {
+		/* the workers may be on the bands of a shared encoder */
+		rdp_output_finish_encode(output);
+		rdp_encoder_reset(peerCtx->item.encoder,
+				  output->base.width, output->base.height);
+	} else if (settings->RemoteFxCodec || settings->NSCodec)
+		weston_log("failed to create encoder, sending raw bitmaps\n");
+
 	peerCtx->item.flags |= RDP_PEER_ACTIVATED;
 
 	/* disable pointer on the client side */
@@ -739,15 +1517,7 @@ xf_peer_post_connect(freerdp_peer* client)
 	pointer->PointerSystem(client->context, &pointer->pointer_system);
 
 	/* sends a full refresh */
-	box.x1 = 0;
-	box.y1 = 0;
-	box.x2 = output->base.width;
-	box.y2 = output->base.height;
-	pixman_region32_init_with_extents(&damage, &box);
-
-	rdp_peer_refresh_region(&damage, client);
-
-	pixman_region32_fini(&damage);
+	rdp_peer_refresh_full(&peerCtx->item);
 
 	return TRUE;
 }
@@ -756,10 +1526,32 @@ static BOOL
 xf_peer_activate(freerdp_peer *client)
 {
 	RdpPeerContext *context = (RdpPeerContext *)client->context;
-	rfx_context_reset(context->rfx_context);
+	struct rdp_output *output = context->rdpCompositor->output;
+
+	if (context->item.encoder) {
+		rdp_output_finish_encode(output);
+		rdp_encoder_reset(context->item.encoder,
+				  output->base.width, output->base.height);
+	}
 	return TRUE;
 }
 
+static void
+xf_surface_frame_acknowledge(rdpContext *context, UINT32 frameId)
+{
+	RdpPeerContext *peerContext = (RdpPeerContext *)context;
+	struct rdp_peers_item *item = &peerContext->item;
+
+	if (item->frames_in_flight > 0)
+		item->frames_in_flight--;
+
+	/* send what was held back while the peer was busy */
+	if ((item->flags & RDP_PEER_OUTPUT_ENABLED) &&
+	    !rdp_peer_is_congested(item) &&
+	    pixman_region32_not_empty(&item->pending_damage))
+		rdp_peer_flush(item);
+}
+
 static void
 xf_mouseEvent(rdpInput *input, UINT16 flags, UINT16 x, UINT16 y) {
 	wl_fixed_t wl_x, wl_y, axis;
@@ -826,22 +1618,10 @@ xf_extendedMouseEvent(rdpInput *input, UINT16 flags, UINT16 x, UINT16 y) {
 static void
 xf_input_synchronize_event(rdpInput *input, UINT32 flags)
 {
-	freerdp_peer *client = input->context->peer;
 	RdpPeerContext *peerCtx = (RdpPeerContext *)input->context;
-	struct rdp_output *output = peerCtx->rdpCompositor->output;
-	pixman_box32_t box;
-	pixman_region32_t damage;
 
 	/* sends a full refresh */
-	box.x1 = 0;
-	box.y1 = 0;
-	box.x2 = output->base.width;
-	box.y2 = output->base.height;
-	pixman_region32_init_with_extents(&damage, &box);
-
-	rdp_peer_refresh_region(&damage, client);
-
-	pixman_region32_fini(&damage);
+	rdp_peer_refresh_full(&peerCtx->item);
 }
 
 extern DWORD KEYCODE_TO_VKCODE_EVDEV[];
@@ -944,6 +1724,7 @@ rdp_peer_init(freerdp_peer *client, struct rdp_compositor *c)
 	client->Activate = xf_peer_activate;
 
 	client->update->SuppressOutput = xf_suppress_output;
+	client->update->SurfaceFrameAcknowledge = xf_surface_frame_acknowledge;
 
 	input = client->input;
 	input->SynchronizeEvent = xf_input_synchronize_event;
@@ -1024,6 +1805,9 @@ rdp_compositor_create(struct wl_display *display,
 	if (rdp_compositor_create_output(c, config->width, config->height) < 0)
 		goto err_compositor;
 
+	weston_compositor_add_debug_binding(&c->base, KEY_T,
+					    stats_binding, c);
+
 	c->base.capabilities |= WESTON_CAP_ARBITRARY_MODES;
 
 	if(!config->env_socket) {
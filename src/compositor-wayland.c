@@ -56,6 +56,7 @@ struct wayland_compositor {
 		struct wl_shell *shell;
 		struct _wl_fullscreen_shell *fshell;
 		struct wl_shm *shm;
+		struct wl_subcompositor *subcompositor;
 
 		struct wl_list output_list;
 
@@ -71,9 +72,18 @@ struct wayland_compositor {
 	struct wl_cursor_theme *cursor_theme;
 	struct wl_cursor *cursor;
 
+	/* pointer sprites shown as the cursor of the parent */
+	struct weston_plane cursor_plane;
+
 	struct wl_list input_list;
 };
 
+/* Copies of client buffers handed to the parent */
+struct wayland_plane_pool {
+	struct wl_list buffers;
+	struct wl_list free_buffers;
+};
+
 struct wayland_output {
 	struct weston_output base;
 
@@ -108,6 +118,26 @@ struct wayland_output {
 		struct wl_list free_buffers;
 	} shm;
 
+	/* A client view handed to the parent as a subsurface of the
+	 * output, see wayland_output_assign_planes() */
+	struct {
+		struct weston_plane base;
+		struct wl_surface *surface;
+		struct wl_subsurface *subsurface;
+		int mapped;
+		int32_t x, y;
+
+		struct weston_view *view;
+		struct wl_listener view_destroy_listener;
+		pixman_box32_t box;
+		int view_changed;
+
+		struct wayland_plane_pool pool;
+	} passthrough;
+
+	/* finishes frames the parent is not shown */
+	struct wl_event_source *finish_frame_timer;
+
 	struct weston_mode mode;
 	uint32_t scale;
 };
@@ -150,6 +180,19 @@ struct wayland_shm_buffer {
 	cairo_surface_t *c_surface;
 };
 
+struct wayland_plane_buffer {
+	struct wayland_plane_pool *pool;
+	struct wl_list link;
+	struct wl_list free_link;
+
+	struct wl_buffer *buffer;
+	void *data;
+	size_t size;
+	int32_t width, height;
+	uint32_t format;
+	pixman_region32_t damage;
+};
+
 struct wayland_input {
 	struct weston_seat base;
 	struct wayland_compositor *compositor;
@@ -164,6 +207,11 @@ struct wayland_input {
 		struct {
 			struct wl_surface *surface;
 			int32_t hx, hy;
+
+			/* the pointer sprite is set as the cursor */
+			int forwarded;
+			struct weston_buffer_reference buffer_ref;
+			struct wayland_plane_pool pool;
 		} cursor;
 	} parent;
 
@@ -302,6 +350,572 @@ wayland_output_get_shm_buffer(struct wayland_output *output)
 	return sb;
 }
 
+static void
+wayland_plane_buffer_destroy(struct wayland_plane_buffer *pb)
+{
+	wl_buffer_destroy(pb->buffer);
+	munmap(pb->data, pb->size);
+
+	pixman_region32_fini(&pb->damage);
+
+	wl_list_remove(&pb->link);
+	wl_list_remove(&pb->free_link);
+	free(pb);
+}
+
+static void
+plane_buffer_release(void *data, struct wl_buffer *buffer)
+{
+	struct wayland_plane_buffer *pb = data;
+
+	if (pb->pool) {
+		wl_list_insert(&pb->pool->free_buffers, &pb->free_link);
+	} else {
+		wayland_plane_buffer_destroy(pb);
+	}
+}
+
+static const struct wl_buffer_listener plane_buffer_listener = {
+	plane_buffer_release
+};
+
+static void
+wayland_plane_pool_init(struct wayland_plane_pool *pool)
+{
+	wl_list_init(&pool->buffers);
+	wl_list_init(&pool->free_buffers);
+}
+
+static void
+wayland_plane_pool_release(struct wayland_plane_pool *pool)
+{
+	struct wayland_plane_buffer *pb, *next;
+
+	wl_list_for_each_safe(pb, next, &pool->free_buffers, free_link)
+		wayland_plane_buffer_destroy(pb);
+
+	/* These will get thrown away when they get released */
+	wl_list_for_each_safe(pb, next, &pool->buffers, link) {
+		pb->pool = NULL;
+		wl_list_remove(&pb->link);
+		wl_list_init(&pb->link);
+	}
+}
+
+static struct wayland_plane_buffer *
+wayland_plane_pool_get_buffer(struct wayland_compositor *c,
+			      struct wayland_plane_pool *pool,
+			      int32_t width, int32_t height, uint32_t format)
+{
+	struct wayland_plane_buffer *pb;
+	struct wl_shm_pool *shm_pool;
+	int32_t stride = width * 4;
+	int fd;
+
+	if (!wl_list_empty(&pool->free_buffers)) {
+		pb = container_of(pool->free_buffers.next,
+				  struct wayland_plane_buffer, free_link);
+		if (pb->width == width && pb->height == height &&
+		    pb->format == format) {
+			wl_list_remove(&pb->free_link);
+			wl_list_init(&pb->free_link);
+
+			return pb;
+		}
+
+		wayland_plane_pool_release(pool);
+	}
+
+	pb = zalloc(sizeof *pb);
+	if (pb == NULL)
+		return NULL;
+
+	pb->size = height * stride;
+	fd = os_create_anonymous_file(pb->size);
+	if (fd < 0) {
+		weston_log("could not create an anonymous file buffer: %m\n");
+		free(pb);
+		return NULL;
+	}
+
+	pb->data = mmap(NULL, pb->size, PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd, 0);
+	if (pb->data == MAP_FAILED) {
+		weston_log("could not mmap %zu memory for data: %m\n",
+			   pb->size);
+		close(fd);
+		free(pb);
+		return NULL;
+	}
+
+	shm_pool = wl_shm_create_pool(c->parent.shm, fd, pb->size);
+	pb->buffer = wl_shm_pool_create_buffer(shm_pool, 0, width, height,
+					       stride, format);
+	wl_buffer_add_listener(pb->buffer, &plane_buffer_listener, pb);
+	wl_shm_pool_destroy(shm_pool);
+	close(fd);
+
+	pb->pool = pool;
+	pb->width = width;
+	pb->height = height;
+	pb->format = format;
+	pixman_region32_init_rect(&pb->damage, 0, 0, width, height);
+	wl_list_init(&pb->free_link);
+	wl_list_insert(&pool->buffers, &pb->link);
+
+	return pb;
+}
+
+/* Copy the damage of the buffer from the client's one, and attach it
+ * to the parent surface. */
+static void
+wayland_plane_buffer_attach(struct wayland_plane_buffer *pb,
+			    struct wl_shm_buffer *shm_buffer,
+			    struct wl_surface *surface)
+{
+	pixman_box32_t *rects;
+	int32_t stride;
+	uint8_t *src, *dst;
+	int i, n, row;
+
+	pixman_region32_intersect_rect(&pb->damage, &pb->damage,
+				       0, 0, pb->width, pb->height);
+	rects = pixman_region32_rectangles(&pb->damage, &n);
+
+	stride = wl_shm_buffer_get_stride(shm_buffer);
+	src = wl_shm_buffer_get_data(shm_buffer);
+	wl_shm_buffer_begin_access(shm_buffer);
+	for (i = 0; i < n; i++) {
+		for (row = rects[i].y1; row < rects[i].y2; row++) {
+			dst = (uint8_t *) pb->data +
+				row * pb->width * 4 + rects[i].x1 * 4;
+			memcpy(dst, src + row * stride + rects[i].x1 * 4,
+			       (rects[i].x2 - rects[i].x1) * 4);
+		}
+	}
+	wl_shm_buffer_end_access(shm_buffer);
+
+	wl_surface_attach(surface, pb->buffer, 0, 0);
+	for (i = 0; i < n; i++)
+		wl_surface_damage(surface, rects[i].x1, rects[i].y1,
+				  rects[i].x2 - rects[i].x1,
+				  rects[i].y2 - rects[i].y1);
+	pixman_region32_fini(&pb->damage);
+	pixman_region32_init(&pb->damage);
+}
+
+static void
+passthrough_view_destroyed(struct wl_listener *listener, void *data)
+{
+	struct wayland_output *output =
+		container_of(listener, struct wayland_output,
+			     passthrough.view_destroy_listener);
+
+	wl_list_remove(&output->passthrough.view_destroy_listener.link);
+	output->passthrough.view = NULL;
+	weston_output_schedule_repaint(&output->base);
+}
+
+static void
+wayland_output_set_passthrough_view(struct wayland_output *output,
+				    struct weston_view *ev)
+{
+	if (output->passthrough.view == ev)
+		return;
+
+	if (output->passthrough.view)
+		wl_list_remove(&output->passthrough.view_destroy_listener.link);
+
+	output->passthrough.view = ev;
+	output->passthrough.view_changed = 1;
+	if (ev)
+		wl_signal_add(&ev->destroy_signal,
+			      &output->passthrough.view_destroy_listener);
+}
+
+/* (Re)create the subsurface for the current parent surface, which
+ * changes on mode switches. */
+static void
+wayland_output_reset_passthrough(struct wayland_output *output)
+{
+	struct wayland_compositor *c =
+		(struct wayland_compositor *) output->base.compositor;
+	struct wl_region *region;
+
+	if (!c->parent.subcompositor)
+		return;
+
+	wayland_output_set_passthrough_view(output, NULL);
+	wayland_plane_pool_release(&output->passthrough.pool);
+
+	if (output->passthrough.subsurface)
+		wl_subsurface_destroy(output->passthrough.subsurface);
+	if (output->passthrough.surface)
+		wl_surface_destroy(output->passthrough.surface);
+
+	output->passthrough.surface =
+		wl_compositor_create_surface(c->parent.compositor);
+	wl_surface_set_user_data(output->passthrough.surface, output);
+	output->passthrough.subsurface =
+		wl_subcompositor_get_subsurface(c->parent.subcompositor,
+						output->passthrough.surface,
+						output->parent.surface);
+	output->passthrough.mapped = 0;
+
+	/* Input goes to the output surface below */
+	region = wl_compositor_create_region(c->parent.compositor);
+	wl_surface_set_input_region(output->passthrough.surface, region);
+	wl_region_destroy(region);
+}
+
+static void
+wayland_output_fini_passthrough(struct wayland_output *output)
+{
+	if (!output->passthrough.surface)
+		return;
+
+	wayland_output_set_passthrough_view(output, NULL);
+	wayland_plane_pool_release(&output->passthrough.pool);
+	wl_subsurface_destroy(output->passthrough.subsurface);
+	wl_surface_destroy(output->passthrough.surface);
+	weston_plane_release(&output->passthrough.base);
+}
+
+/* Whether the parent can show the view as it is, from a copy of its
+ * buffer: shm in a format every compositor takes, not transformed,
+ * scaled or cropped, and inside this output. */
+static int
+wayland_output_view_passthrough_ok(struct wayland_output *output,
+				   struct weston_view *ev)
+{
+	struct weston_buffer_viewport *viewport = &ev->surface->buffer_viewport;
+	struct wl_shm_buffer *shm_buffer;
+	uint32_t format;
+
+	if (ev->output_mask != (1u << output->base.id))
+		return 0;
+
+	if (ev->surface->buffer_ref.buffer == NULL)
+		return 0;
+
+	if (ev->transform.enabled || ev->alpha != 1.0f)
+		return 0;
+
+	if (viewport->buffer.transform != WL_OUTPUT_TRANSFORM_NORMAL ||
+	    viewport->buffer.scale != output->base.current_scale ||
+	    viewport->buffer.src_width != wl_fixed_from_int(-1) ||
+	    viewport->surface.width != -1)
+		return 0;
+
+	shm_buffer = wl_shm_buffer_get(ev->surface->buffer_ref.buffer->resource);
+	if (!shm_buffer)
+		return 0;
+
+	format = wl_shm_buffer_get_format(shm_buffer);
+	if (format != WL_SHM_FORMAT_ARGB8888 &&
+	    format != WL_SHM_FORMAT_XRGB8888)
+		return 0;
+
+	return pixman_region32_contains_rectangle(&output->base.region,
+			pixman_region32_extents(&ev->transform.boundingbox)) ==
+		PIXMAN_REGION_IN;
+}
+
+/* Whether the parent can show the pointer sprite as its cursor: an
+ * ARGB8888 shm buffer, drawn as is at the scale of the output. */
+static int
+wayland_input_sprite_ok(struct wayland_input *input, struct weston_view *sprite)
+{
+	struct weston_surface *surface = sprite->surface;
+	struct weston_buffer_viewport *viewport = &surface->buffer_viewport;
+	struct wl_shm_buffer *shm_buffer;
+
+	if (input->output->base.transform != WL_OUTPUT_TRANSFORM_NORMAL)
+		return 0;
+
+	if (sprite->transform.enabled || sprite->alpha != 1.0f)
+		return 0;
+
+	if (viewport->buffer.transform != WL_OUTPUT_TRANSFORM_NORMAL ||
+	    viewport->buffer.scale != input->output->base.current_scale ||
+	    viewport->buffer.src_width != wl_fixed_from_int(-1) ||
+	    viewport->surface.width != -1)
+		return 0;
+
+	if (surface->buffer_ref.buffer == NULL)
+		return 0;
+
+	shm_buffer = wl_shm_buffer_get(surface->buffer_ref.buffer->resource);
+
+	return shm_buffer &&
+		wl_shm_buffer_get_format(shm_buffer) == WL_SHM_FORMAT_ARGB8888;
+}
+
+/* Have the parent show the pointer sprite as its cursor, so that pointer
+ * motion alone needs no rendering. The sprite is only uploaded again
+ * when its buffer, content or hotspot change. */
+static void
+wayland_input_forward_sprite(struct wayland_input *input)
+{
+	struct weston_pointer *pointer = input->base.pointer;
+	struct weston_view *sprite = pointer ? pointer->sprite : NULL;
+	struct weston_surface *surface;
+	struct wl_shm_buffer *shm_buffer;
+	struct wayland_plane_buffer *pb = NULL;
+	int32_t scale, hx, hy;
+
+	/* Outside of the client area the parent shows the theme cursor */
+	if (!input->focus) {
+		input->parent.cursor.forwarded = 0;
+		weston_buffer_reference(&input->parent.cursor.buffer_ref, NULL);
+		return;
+	}
+
+	if (sprite && wayland_input_sprite_ok(input, sprite)) {
+		surface = sprite->surface;
+		scale = input->output->base.current_scale;
+		hx = pointer->hotspot_x * scale;
+		hy = pointer->hotspot_y * scale;
+
+		if (input->parent.cursor.forwarded &&
+		    input->parent.cursor.buffer_ref.buffer ==
+		    surface->buffer_ref.buffer &&
+		    !pixman_region32_not_empty(&surface->damage) &&
+		    input->parent.cursor.hx == hx &&
+		    input->parent.cursor.hy == hy)
+			return;
+
+		shm_buffer =
+			wl_shm_buffer_get(surface->buffer_ref.buffer->resource);
+		pb = wayland_plane_pool_get_buffer(input->compositor,
+						   &input->parent.cursor.pool,
+						   wl_shm_buffer_get_width(shm_buffer),
+						   wl_shm_buffer_get_height(shm_buffer),
+						   WL_SHM_FORMAT_ARGB8888);
+	}
+
+	if (!pb) {
+		/* The sprite gets composited, hide the parent's cursor */
+		if (input->parent.cursor.forwarded)
+			wl_pointer_set_cursor(input->parent.pointer,
+					      input->enter_serial, NULL, 0, 0);
+		input->parent.cursor.forwarded = 0;
+		weston_buffer_reference(&input->parent.cursor.buffer_ref, NULL);
+		return;
+	}
+
+	wl_pointer_set_cursor(input->parent.pointer, input->enter_serial,
+			      input->parent.cursor.surface, hx, hy);
+
+	pixman_region32_union_rect(&pb->damage, &pb->damage,
+				   0, 0, pb->width, pb->height);
+	wayland_plane_buffer_attach(pb, shm_buffer,
+				    input->parent.cursor.surface);
+	wl_surface_commit(input->parent.cursor.surface);
+
+	weston_buffer_reference(&input->parent.cursor.buffer_ref,
+				surface->buffer_ref.buffer);
+	input->parent.cursor.hx = hx;
+	input->parent.cursor.hy = hy;
+	input->parent.cursor.forwarded = 1;
+}
+
+static int
+wayland_compositor_sprite_forwarded(struct wayland_compositor *c,
+				    struct weston_view *ev)
+{
+	struct wayland_input *input;
+
+	wl_list_for_each(input, &c->input_list, link)
+		if (input->parent.cursor.forwarded &&
+		    input->base.pointer && input->base.pointer->sprite == ev)
+			return 1;
+
+	return 0;
+}
+
+/* Forwarded pointer sprites go to the cursor plane, shown by the
+ * parent. Then, if the parent supports subsurfaces, hand the biggest
+ * view that nothing composited covers to it, so the renderer skips it
+ * and it is copied once per frame instead of being composited and then
+ * copied with the rest of the output. */
+static void
+wayland_output_assign_planes(struct weston_output *output_base)
+{
+	struct wayland_output *output = (struct wayland_output *) output_base;
+	struct wayland_compositor *c =
+		(struct wayland_compositor *) output->base.compositor;
+	struct weston_compositor *ec = output->base.compositor;
+	struct weston_plane *plane = &output->passthrough.base;
+	struct weston_view *ev, *best = NULL;
+	struct wayland_input *input;
+	pixman_region32_t overlap;
+	pixman_box32_t *box;
+	int64_t area, best_area = 0;
+	uint32_t mask = 1u << output->base.id;
+
+	/* The parent moves the cursor by itself. */
+	pixman_region32_fini(&c->cursor_plane.damage);
+	pixman_region32_init(&c->cursor_plane.damage);
+
+	wl_list_for_each(input, &c->input_list, link)
+		wayland_input_forward_sprite(input);
+
+	pixman_region32_init(&overlap);
+	wl_list_for_each(ev, &ec->view_list, link) {
+		if (!output->passthrough.surface)
+			break;
+
+		if (!(ev->output_mask & mask) ||
+		    wayland_compositor_sprite_forwarded(c, ev))
+			continue;
+
+		box = pixman_region32_extents(&ev->transform.boundingbox);
+		area = (int64_t) (box->x2 - box->x1) * (box->y2 - box->y1);
+		if (area > best_area &&
+		    output->base.transform == WL_OUTPUT_TRANSFORM_NORMAL &&
+		    wayland_output_view_passthrough_ok(output, ev) &&
+		    pixman_region32_contains_rectangle(&overlap, box) ==
+		    PIXMAN_REGION_OUT) {
+			best = ev;
+			best_area = area;
+		}
+
+		pixman_region32_union(&overlap, &overlap,
+				      &ev->transform.boundingbox);
+	}
+	pixman_region32_fini(&overlap);
+
+	wl_list_for_each(ev, &ec->view_list, link) {
+		if (wayland_compositor_sprite_forwarded(c, ev)) {
+			/* compared with the forwarded one next time */
+			ev->surface->keep_buffer = 1;
+			weston_view_move_to_plane(ev, &c->cursor_plane);
+			continue;
+		}
+
+		if (ev->plane == &c->cursor_plane)
+			ev->surface->keep_buffer = 0;
+
+		if (ev == best) {
+			ev->surface->keep_buffer = 1;
+			weston_view_move_to_plane(ev, plane);
+		} else if (ev->plane == plane) {
+			ev->surface->keep_buffer = 0;
+			weston_view_move_to_plane(ev, &ec->primary_plane);
+		} else if (ev->plane == &c->cursor_plane ||
+			   ev->output_mask & mask) {
+			weston_view_move_to_plane(ev, &ec->primary_plane);
+		}
+	}
+
+	/* What the old view covered in the primary plane is stale. */
+	if (output->passthrough.view) {
+		box = &output->passthrough.box;
+		if (best != output->passthrough.view ||
+		    memcmp(box, pixman_region32_extents(&best->transform.boundingbox),
+			   sizeof *box) != 0)
+			pixman_region32_union_rect(&ec->primary_plane.damage,
+						   &ec->primary_plane.damage,
+						   box->x1, box->y1,
+						   box->x2 - box->x1,
+						   box->y2 - box->y1);
+	}
+
+	wayland_output_set_passthrough_view(output, best);
+	if (best)
+		output->passthrough.box =
+			*pixman_region32_extents(&best->transform.boundingbox);
+}
+
+/* Copy the damage of the view on the passthrough plane into a buffer
+ * of the parent and commit it to the subsurface; being synchronized,
+ * it is shown along with the next commit of the output surface. */
+static int
+wayland_output_update_passthrough(struct wayland_output *output)
+{
+	struct wayland_compositor *c =
+		(struct wayland_compositor *) output->base.compositor;
+	struct weston_view *ev = output->passthrough.view;
+	struct wl_surface *surface = output->passthrough.surface;
+	struct wayland_plane_buffer *pb;
+	struct wl_shm_buffer *shm_buffer;
+	pixman_region32_t damage, buffer_damage;
+	pixman_box32_t *box;
+	int32_t width, height, scale, x, y, fx = 0, fy = 0;
+
+	if (!surface)
+		return 0;
+
+	if (!ev) {
+		if (!output->passthrough.mapped)
+			return 0;
+
+		wl_surface_attach(surface, NULL, 0, 0);
+		wl_surface_commit(surface);
+		output->passthrough.mapped = 0;
+		return 1;
+	}
+
+	shm_buffer = wl_shm_buffer_get(ev->surface->buffer_ref.buffer->resource);
+	width = wl_shm_buffer_get_width(shm_buffer);
+	height = wl_shm_buffer_get_height(shm_buffer);
+	scale = output->base.current_scale;
+	box = &output->passthrough.box;
+
+	/* The plane damage is in global coordinates. */
+	if (output->passthrough.view_changed) {
+		pixman_region32_init_rect(&buffer_damage, 0, 0, width, height);
+		output->passthrough.view_changed = 0;
+	} else {
+		pixman_region32_init(&damage);
+		pixman_region32_init(&buffer_damage);
+		pixman_region32_intersect_rect(&damage,
+					       &output->passthrough.base.damage,
+					       box->x1, box->y1,
+					       box->x2 - box->x1,
+					       box->y2 - box->y1);
+		pixman_region32_translate(&damage, -box->x1, -box->y1);
+		weston_transformed_region(box->x2 - box->x1, box->y2 - box->y1,
+					  WL_OUTPUT_TRANSFORM_NORMAL, scale,
+					  &damage, &buffer_damage);
+		pixman_region32_fini(&damage);
+	}
+	pixman_region32_fini(&output->passthrough.base.damage);
+	pixman_region32_init(&output->passthrough.base.damage);
+
+	wl_list_for_each(pb, &output->passthrough.pool.buffers, link)
+		pixman_region32_union(&pb->damage, &pb->damage, &buffer_damage);
+	pixman_region32_fini(&buffer_damage);
+
+	pb = wayland_plane_pool_get_buffer(c, &output->passthrough.pool,
+					   width, height,
+					   wl_shm_buffer_get_format(shm_buffer));
+	if (!pb)
+		return 0;
+
+	wayland_plane_buffer_attach(pb, shm_buffer, surface);
+
+	/* The output surface has no buffer scale, it is in output
+	 * pixels. */
+	if (output->frame)
+		frame_interior(output->frame, &fx, &fy, 0, 0);
+	x = (box->x1 - output->base.x) * scale + fx;
+	y = (box->y1 - output->base.y) * scale + fy;
+	if (!output->passthrough.mapped ||
+	    x != output->passthrough.x || y != output->passthrough.y) {
+		wl_subsurface_set_position(output->passthrough.subsurface,
+					   x, y);
+		output->passthrough.x = x;
+		output->passthrough.y = y;
+	}
+
+	wl_surface_commit(surface);
+	output->passthrough.mapped = 1;
+
+	return 1;
+}
+
 static void
 frame_done(void *data, struct wl_callback *callback, uint32_t time)
 {
@@ -315,6 +929,29 @@ static const struct wl_callback_listener frame_listener = {
 	frame_done
 };
 
+static int
+finish_frame_handler(void *data)
+{
+	struct wayland_output *output = data;
+
+	weston_output_finish_frame(&output->base,
+				   weston_compositor_get_time());
+
+	return 1;
+}
+
+/* Nothing changed for the parent to show. Committing the output surface
+ * anyway would only have the parent repaint to send the frame callback,
+ * so time the frame ourselves. */
+static void
+wayland_output_skip_frame(struct wayland_output *output)
+{
+	int refresh = output->base.current_mode->refresh;
+
+	wl_event_source_timer_update(output->finish_frame_timer,
+				     refresh > 0 ? 1000000 / refresh : 16);
+}
+
 static void
 draw_initial_frame(struct wayland_output *output)
 {
@@ -434,7 +1071,28 @@ wayland_output_repaint_gl(struct weston_output *output_base,
 {
 	struct wayland_output *output = (struct wayland_output *) output_base;
 	struct weston_compositor *ec = output->base.compositor;
+	struct wayland_compositor *c = (struct wayland_compositor *) ec;
 	struct wl_callback *callback;
+	int passthrough_committed;
+
+	passthrough_committed = wayland_output_update_passthrough(output);
+
+	/* Only the planes changed, e.g. the pointer moved */
+	if (!pixman_region32_not_empty(damage) &&
+	    !(output->frame &&
+	      (frame_status(output->frame) & FRAME_STATUS_REPAINT))) {
+		if (!passthrough_committed) {
+			wayland_output_skip_frame(output);
+			return 0;
+		}
+
+		/* the subsurface is synchronized */
+		callback = wl_surface_frame(output->parent.surface);
+		wl_callback_add_listener(callback, &frame_listener, output);
+		wl_surface_commit(output->parent.surface);
+		wl_display_flush(c->parent.wl_display);
+		return 0;
+	}
 
 	callback = wl_surface_frame(output->parent.surface);
 	wl_callback_add_listener(callback, &frame_listener, output);
@@ -545,6 +1203,22 @@ wayland_output_repaint_pixman(struct weston_output *output_base,
 	struct wl_callback *callback;
 	struct wayland_shm_buffer *sb;
 
+	/* Only the planes changed, e.g. the pointer moved */
+	if (!pixman_region32_not_empty(damage) &&
+	    !(output->frame &&
+	      (frame_status(output->frame) & FRAME_STATUS_REPAINT))) {
+		if (!wayland_output_update_passthrough(output)) {
+			wayland_output_skip_frame(output);
+			return 0;
+		}
+
+		callback = wl_surface_frame(output->parent.surface);
+		wl_callback_add_listener(callback, &frame_listener, output);
+		wl_surface_commit(output->parent.surface);
+		wl_display_flush(c->parent.wl_display);
+		return 0;
+	}
+
 	if (output->frame) {
 		if (frame_status(output->frame) & FRAME_STATUS_REPAINT)
 			wl_list_for_each(sb, &output->shm.buffers, link)
@@ -561,6 +1235,7 @@ wayland_output_repaint_pixman(struct weston_output *output_base,
 	c->base.renderer->repaint_output(output_base, &sb->damage);
 
 	wayland_shm_buffer_attach(sb);
+	wayland_output_update_passthrough(output);
 
 	callback = wl_surface_frame(output->parent.surface);
 	wl_callback_add_listener(callback, &frame_listener, output);
@@ -583,6 +1258,8 @@ wayland_output_destroy(struct weston_output *output_base)
 	struct wayland_compositor *c =
 		(struct wayland_compositor *) output->base.compositor;
 
+	wl_event_source_remove(output->finish_frame_timer);
+
 	if (c->use_pixman) {
 		pixman_renderer_output_destroy(output_base);
 	} else {
@@ -590,6 +1267,7 @@ wayland_output_destroy(struct weston_output *output_base)
 	}
 
 	wl_egl_window_destroy(output->gl.egl_window);
+	wayland_output_fini_passthrough(output);
 	wl_surface_destroy(output->parent.surface);
 	if (output->parent.shell_surface)
 		wl_shell_surface_destroy(output->parent.shell_surface);
@@ -725,6 +1403,9 @@ wayland_output_resize_surface(struct wayland_output *output)
 	/* These will get thrown away when they get released */
 	wl_list_for_each(buffer, &output->shm.buffers, link)
 		buffer->output = NULL;
+
+	/* The parent surface may be a new one */
+	wayland_output_reset_passthrough(output);
 }
 
 static int
@@ -1022,10 +1703,27 @@ wayland_output_create(struct wayland_compositor *c, int x, int y,
 
 	wl_list_init(&output->shm.buffers);
 	wl_list_init(&output->shm.free_buffers);
+	wayland_plane_pool_init(&output->passthrough.pool);
+	output->passthrough.view_destroy_listener.notify =
+		passthrough_view_destroyed;
 
 	weston_output_init(&output->base, &c->base, x, y, width, height,
 			   transform, scale);
 
+	output->finish_frame_timer =
+		wl_event_loop_add_timer(wl_display_get_event_loop(c->base.wl_display),
+					finish_frame_handler, output);
+	if (!output->finish_frame_timer)
+		goto err_output;
+
+	if (c->parent.subcompositor) {
+		weston_plane_init(&output->passthrough.base, &c->base, 0, 0);
+		weston_compositor_stack_plane(&c->base,
+					      &output->passthrough.base,
+					      &c->base.primary_plane);
+		wayland_output_reset_passthrough(output);
+	}
+
 	if (c->use_pixman) {
 		if (wayland_output_init_pixman_renderer(output) < 0)
 			goto err_output;
@@ -1038,7 +1736,7 @@ wayland_output_create(struct wayland_compositor *c, int x, int y,
 
 	output->base.start_repaint_loop = wayland_output_start_repaint_loop;
 	output->base.destroy = wayland_output_destroy;
-	output->base.assign_planes = NULL;
+	output->base.assign_planes = wayland_output_assign_planes;
 	output->base.set_backlight = NULL;
 	output->base.set_dpms = NULL;
 	output->base.switch_mode = wayland_output_switch_mode;
@@ -1048,6 +1746,8 @@ wayland_output_create(struct wayland_compositor *c, int x, int y,
 	return output;
 
 err_output:
+	if (output->finish_frame_timer)
+		wl_event_source_remove(output->finish_frame_timer);
 	weston_output_destroy(&output->base);
 	if (output->parent.shell_surface)
 		wl_shell_surface_destroy(output->parent.shell_surface);
@@ -1296,6 +1996,8 @@ input_handle_pointer_enter(void *data, struct wl_pointer *pointer,
 		notify_pointer_focus(&input->base, &input->output->base, x, y);
 		wl_pointer_set_cursor(input->parent.pointer,
 				      input->enter_serial, NULL, 0, 0);
+		/* set the sprite again, with the new serial */
+		input->parent.cursor.forwarded = 0;
 	} else {
 		input->focus = 0;
 		notify_pointer_focus(&input->base, NULL, 0, 0);
@@ -1352,6 +2054,7 @@ input_handle_motion(void *data, struct wl_pointer *pointer,
 	} else if (!input->focus && location == THEME_LOCATION_CLIENT_AREA) {
 		wl_pointer_set_cursor(input->parent.pointer,
 				      input->enter_serial, NULL, 0, 0);
+		input->parent.cursor.forwarded = 0;
 		notify_pointer_focus(&input->base, &input->output->base, x, y);
 		input->focus = 1;
 	}
@@ -1633,6 +2336,7 @@ display_add_seat(struct wayland_compositor *c, uint32_t id)
 
 	input->parent.cursor.surface =
 		wl_compositor_create_surface(c->parent.compositor);
+	wayland_plane_pool_init(&input->parent.cursor.pool);
 }
 
 static void
@@ -1787,6 +2491,10 @@ registry_handle_global(void *data, struct wl_registry *registry, uint32_t name,
 	} else if (strcmp(interface, "wl_shm") == 0) {
 		c->parent.shm =
 			wl_registry_bind(registry, name, &wl_shm_interface, 1);
+	} else if (strcmp(interface, "wl_subcompositor") == 0) {
+		c->parent.subcompositor =
+			wl_registry_bind(registry, name,
+					 &wl_subcompositor_interface, 1);
 	}
 }
 
@@ -1841,10 +2549,13 @@ wayland_destroy(struct weston_compositor *ec)
 {
 	struct wayland_compositor *c = (struct wayland_compositor *) ec;
 
+	weston_plane_release(&c->cursor_plane);
 	weston_compositor_shutdown(ec);
 
 	if (c->parent.shm)
 		wl_shm_destroy(c->parent.shm);
+	if (c->parent.subcompositor)
+		wl_subcompositor_destroy(c->parent.subcompositor);
 
 	free(ec);
 }
@@ -1925,6 +2636,9 @@ wayland_compositor_create(struct wl_display *display, int use_pixman,
 				   config) < 0)
 		goto err_free;
 
+	weston_plane_init(&c->cursor_plane, &c->base, 0, 0);
+	weston_compositor_stack_plane(&c->base, &c->cursor_plane, NULL);
+
 	c->parent.wl_display = wl_display_connect(display_name);
 
 	if (c->parent.wl_display == NULL) {
@@ -37,6 +37,7 @@
 
 #include <xcb/xcb.h>
 #include <xcb/shm.h>
+#include <xcb/render.h>
 #ifdef HAVE_XCB_XKB
 #include <xcb/xkb.h>
 #endif
@@ -71,10 +72,20 @@ struct x11_compositor {
 	struct xkb_keymap	*xkb_keymap;
 	unsigned int		 has_xkb;
 	uint8_t			 xkb_event_base;
+	uint8_t			 shm_event_base;
 	int			 use_pixman;
 
 	int			 has_net_wm_state_fullscreen;
 
+	/* The pointer sprite, set as the cursor of the output windows */
+	struct {
+		struct weston_plane		 plane;
+		xcb_render_pictformat_t		 format;
+		xcb_cursor_t			 cursor;
+		struct weston_buffer_reference	 buffer_ref;
+		int32_t				 hx, hy;
+	} cursor;
+
 	/* We could map multi-pointer X to multiple wayland seats, but
 	 * for now we only support core X input. */
 	struct weston_seat		 core_seat;
@@ -100,6 +111,21 @@ struct x11_compositor {
 	} atom;
 };
 
+/* Damage rectangles put per frame before falling back to their extents */
+#define MAX_PUT_RECTS 16
+
+/* One of the SHM images of an output; the X server may still be
+ * reading from the other one. */
+struct x11_shm_buffer {
+	xcb_shm_seg_t		segment;
+	pixman_image_t	       *image;
+	int			shm_id;
+	void		       *buf;
+	pixman_region32_t	damage;		/* out of date in the image */
+	int			busy;		/* until the ShmCompletion */
+	int			completions;	/* ShmCompletions to come */
+};
+
 struct x11_output {
 	struct weston_output	base;
 
@@ -108,10 +134,8 @@ struct x11_output {
 	struct wl_event_source *finish_frame_timer;
 
 	xcb_gc_t		gc;
-	xcb_shm_seg_t		segment;
-	pixman_image_t	       *hw_surface;
-	int			shm_id;
-	void		       *buf;
+	struct x11_shm_buffer	shm[2];
+	int			current_shm;
 	uint8_t			depth;
 	int32_t                 scale;
 };
@@ -154,7 +178,7 @@ x11_compositor_get_keymap(struct x11_compositor *c)
 	copy_prop_value(options);
 #undef copy_prop_value
 
-	ret = xkb_map_new_from_names(c->base.xkb_context, &names, 0);
+	ret = weston_compositor_get_keymap(&c->base, &names);
 
 	free(reply);
 	return ret;
@@ -354,6 +378,12 @@ x11_output_repaint_gl(struct weston_output *output_base,
 	struct x11_output *output = (struct x11_output *)output_base;
 	struct weston_compositor *ec = output->base.compositor;
 
+	/* Only the cursor changed, which the X server draws */
+	if (!pixman_region32_not_empty(damage)) {
+		wl_event_source_timer_update(output->finish_frame_timer, 10);
+		return 0;
+	}
+
 	ec->renderer->repaint_output(output_base, damage);
 
 	pixman_region32_subtract(&ec->primary_plane.damage,
@@ -363,18 +393,20 @@ x11_output_repaint_gl(struct weston_output *output_base,
 	return 0;
 }
 
+/* Put the damaged part of the image into the window: the rectangles
+ * themselves, or their extents when there are too many of them. Only
+ * the last request asks for a ShmCompletion event. */
 static void
-set_clip_for_output(struct weston_output *output_base, pixman_region32_t *region)
+x11_output_put_damage(struct x11_output *output, struct x11_shm_buffer *sb,
+		      pixman_region32_t *region)
 {
-	struct x11_output *output = (struct x11_output *)output_base;
-	struct weston_compositor *ec = output->base.compositor;
-	struct x11_compositor *c = (struct x11_compositor *)ec;
+	struct weston_output *output_base = &output->base;
+	struct x11_compositor *c =
+		(struct x11_compositor *) output_base->compositor;
 	pixman_region32_t transformed_region;
 	pixman_box32_t *rects;
-	xcb_rectangle_t *output_rects;
-	xcb_void_cookie_t cookie;
+	int32_t width, height;
 	int nrects, i;
-	xcb_generic_error_t *err;
 
 	pixman_region32_init(&transformed_region);
 	pixman_region32_copy(&transformed_region, region);
@@ -385,36 +417,37 @@ set_clip_for_output(struct weston_output *output_base, pixman_region32_t *region
 				  output_base->current_scale,
 				  &transformed_region, &transformed_region);
 
-	rects = pixman_region32_rectangles(&transformed_region, &nrects);
-	output_rects = calloc(nrects, sizeof(xcb_rectangle_t));
+	width = pixman_image_get_width(sb->image);
+	height = pixman_image_get_height(sb->image);
+	pixman_region32_intersect_rect(&transformed_region,
+				       &transformed_region,
+				       0, 0, width, height);
 
-	if (output_rects == NULL) {
-		pixman_region32_fini(&transformed_region);
-		return;
+	rects = pixman_region32_rectangles(&transformed_region, &nrects);
+	if (nrects > MAX_PUT_RECTS) {
+		rects = pixman_region32_extents(&transformed_region);
+		nrects = 1;
 	}
 
-	for (i = 0; i < nrects; i++) {
-		output_rects[i].x = rects[i].x1;
-		output_rects[i].y = rects[i].y1;
-		output_rects[i].width = rects[i].x2 - rects[i].x1;
-		output_rects[i].height = rects[i].y2 - rects[i].y1;
+	for (i = 0; i < nrects; i++)
+		xcb_shm_put_image(c->conn, output->window, output->gc,
+				  width, height,
+				  rects[i].x1, rects[i].y1,
+				  rects[i].x2 - rects[i].x1,
+				  rects[i].y2 - rects[i].y1,
+				  rects[i].x1, rects[i].y1,
+				  output->depth, XCB_IMAGE_FORMAT_Z_PIXMAP,
+				  i == nrects - 1, sb->segment, 0);
+	xcb_flush(c->conn);
+
+	if (nrects > 0) {
+		sb->busy = 1;
+		sb->completions++;
 	}
 
 	pixman_region32_fini(&transformed_region);
-
-	cookie = xcb_set_clip_rectangles_checked(c->conn, XCB_CLIP_ORDERING_UNSORTED,
-					output->gc,
-					0, 0, nrects,
-					output_rects);
-	err = xcb_request_check(c->conn, cookie);
-	if (err != NULL) {
-		weston_log("Failed to set clip rects, err: %d\n", err->error_code);
-		free(err);
-	}
-	free(output_rects);
 }
 
-
 static int
 x11_output_repaint_shm(struct weston_output *output_base,
 		       pixman_region32_t *damage)
@@ -422,28 +455,41 @@ x11_output_repaint_shm(struct weston_output *output_base,
 	struct x11_output *output = (struct x11_output *)output_base;
 	struct weston_compositor *ec = output->base.compositor;
 	struct x11_compositor *c = (struct x11_compositor *)ec;
-	xcb_void_cookie_t cookie;
-	xcb_generic_error_t *err;
+	struct x11_shm_buffer *sb;
+	unsigned int i;
 
-	pixman_renderer_output_set_buffer(output_base, output->hw_surface);
-	ec->renderer->repaint_output(output_base, damage);
+	/* Only the cursor changed, which the X server draws */
+	if (!pixman_region32_not_empty(damage)) {
+		wl_event_source_timer_update(output->finish_frame_timer, 10);
+		return 0;
+	}
+
+	for (i = 0; i < ARRAY_LENGTH(output->shm); i++)
+		pixman_region32_union(&output->shm[i].damage,
+				      &output->shm[i].damage, damage);
+
+	sb = &output->shm[output->current_shm];
+	if (sb->busy) {
+		/* The server reads the image while handling the put
+		 * request, so a round trip is enough to be done with it.
+		 * The completion is still on its way, and must not free
+		 * the image once it is in use again. */
+		free(xcb_get_input_focus_reply(c->conn,
+					       xcb_get_input_focus(c->conn),
+					       NULL));
+		sb->busy = 0;
+	}
+
+	/* Bring the image up to date, but only send what changed
+	 * since the last frame, which the window already has. */
+	pixman_renderer_output_set_buffer(output_base, sb->image);
+	ec->renderer->repaint_output(output_base, &sb->damage);
+	pixman_region32_clear(&sb->damage);
 
 	pixman_region32_subtract(&ec->primary_plane.damage,
 				 &ec->primary_plane.damage, damage);
-	set_clip_for_output(output_base, damage);
-	cookie = xcb_shm_put_image_checked(c->conn, output->window, output->gc,
-					pixman_image_get_width(output->hw_surface),
-					pixman_image_get_height(output->hw_surface),
-					0, 0,
-					pixman_image_get_width(output->hw_surface),
-					pixman_image_get_height(output->hw_surface),
-					0, 0, output->depth, XCB_IMAGE_FORMAT_Z_PIXMAP,
-					0, output->segment, 0);
-	err = xcb_request_check(c->conn, cookie);
-	if (err != NULL) {
-		weston_log("Failed to put shm image, err: %d\n", err->error_code);
-		free(err);
-	}
+	x11_output_put_damage(output, sb, damage);
+	output->current_shm ^= 1;
 
 	wl_event_source_timer_update(output->finish_frame_timer, 10);
 	return 0;
@@ -459,22 +505,247 @@ finish_frame_handler(void *data)
 	return 1;
 }
 
+/* Largest pointer sprite set as the X cursor; bigger ones are
+ * composited. */
+#define MAX_CURSOR_SIZE 128
+
+static void
+x11_compositor_find_cursor_format(struct x11_compositor *c)
+{
+	xcb_render_query_version_reply_t *version;
+	xcb_render_query_pict_formats_reply_t *formats;
+	xcb_render_pictforminfo_iterator_t i;
+	xcb_render_directformat_t *d;
+
+	version = xcb_render_query_version_reply(c->conn,
+		xcb_render_query_version(c->conn, 0, 5), NULL);
+	if (version == NULL)
+		return;
+
+	/* ARGB cursors are in RENDER 0.5 */
+	if (version->major_version == 0 && version->minor_version < 5) {
+		free(version);
+		return;
+	}
+	free(version);
+
+	formats = xcb_render_query_pict_formats_reply(c->conn,
+		xcb_render_query_pict_formats(c->conn), NULL);
+	if (formats == NULL)
+		return;
+
+	for (i = xcb_render_query_pict_formats_formats_iterator(formats);
+	     i.rem; xcb_render_pictforminfo_next(&i)) {
+		d = &i.data->direct;
+		if (i.data->type == XCB_RENDER_PICT_TYPE_DIRECT &&
+		    i.data->depth == 32 &&
+		    d->alpha_shift == 24 && d->alpha_mask == 0xff &&
+		    d->red_shift == 16 && d->red_mask == 0xff &&
+		    d->green_shift == 8 && d->green_mask == 0xff &&
+		    d->blue_shift == 0 && d->blue_mask == 0xff) {
+			c->cursor.format = i.data->id;
+			break;
+		}
+	}
+	free(formats);
+}
+
+static void
+x11_compositor_set_cursor(struct x11_compositor *c, xcb_cursor_t cursor)
+{
+	struct x11_output *output;
+
+	wl_list_for_each(output, &c->base.output_list, base.link)
+		xcb_change_window_attributes(c->conn, output->window,
+					     XCB_CW_CURSOR, &cursor);
+
+	if (c->cursor.cursor)
+		xcb_free_cursor(c->conn, c->cursor.cursor);
+	c->cursor.cursor = cursor == c->null_cursor ? 0 : cursor;
+}
+
+/* Whether the X server can show the pointer sprite as the cursor: a
+ * small ARGB8888 shm buffer, drawn as is at the scale of every
+ * output. */
+static int
+x11_compositor_sprite_ok(struct x11_compositor *c, struct weston_view *sprite)
+{
+	struct weston_surface *surface = sprite->surface;
+	struct weston_buffer_viewport *viewport = &surface->buffer_viewport;
+	struct weston_output *output;
+	struct wl_shm_buffer *shm_buffer;
+
+	if (!c->cursor.format)
+		return 0;
+
+	wl_list_for_each(output, &c->base.output_list, link)
+		if (output->transform != WL_OUTPUT_TRANSFORM_NORMAL ||
+		    output->current_scale != viewport->buffer.scale)
+			return 0;
+
+	if (sprite->transform.enabled || sprite->alpha != 1.0f)
+		return 0;
+
+	if (viewport->buffer.transform != WL_OUTPUT_TRANSFORM_NORMAL ||
+	    viewport->buffer.src_width != wl_fixed_from_int(-1) ||
+	    viewport->surface.width != -1)
+		return 0;
+
+	if (surface->buffer_ref.buffer == NULL)
+		return 0;
+
+	shm_buffer = wl_shm_buffer_get(surface->buffer_ref.buffer->resource);
+	if (!shm_buffer ||
+	    wl_shm_buffer_get_format(shm_buffer) != WL_SHM_FORMAT_ARGB8888)
+		return 0;
+
+	return wl_shm_buffer_get_width(shm_buffer) <= MAX_CURSOR_SIZE &&
+		wl_shm_buffer_get_height(shm_buffer) <= MAX_CURSOR_SIZE;
+}
+
+/* Have the X server show the pointer sprite as the cursor of our
+ * windows, so that pointer motion alone needs no rendering. The cursor
+ * is only created again when the buffer, content or hotspot of the
+ * sprite change. Returns whether the sprite is shown that way. */
+static int
+x11_compositor_forward_sprite(struct x11_compositor *c)
+{
+	struct weston_pointer *pointer = c->core_seat.pointer;
+	struct weston_view *sprite = pointer ? pointer->sprite : NULL;
+	struct weston_surface *surface;
+	struct wl_shm_buffer *shm_buffer;
+	xcb_pixmap_t pixmap;
+	xcb_render_picture_t picture;
+	xcb_cursor_t cursor;
+	xcb_gc_t gc;
+	int32_t width, height, stride, hx, hy, scale, y;
+	uint8_t *data, *rows = NULL;
+
+	if (!sprite || !x11_compositor_sprite_ok(c, sprite))
+		goto err_hide;
+
+	surface = sprite->surface;
+	scale = surface->buffer_viewport.buffer.scale;
+	hx = pointer->hotspot_x * scale;
+	hy = pointer->hotspot_y * scale;
+
+	if (c->cursor.cursor &&
+	    c->cursor.buffer_ref.buffer == surface->buffer_ref.buffer &&
+	    !pixman_region32_not_empty(&surface->damage) &&
+	    c->cursor.hx == hx && c->cursor.hy == hy)
+		return 1;
+
+	shm_buffer = wl_shm_buffer_get(surface->buffer_ref.buffer->resource);
+	width = wl_shm_buffer_get_width(shm_buffer);
+	height = wl_shm_buffer_get_height(shm_buffer);
+	stride = wl_shm_buffer_get_stride(shm_buffer);
+
+	/* Z pixmap scanlines of a depth 32 image are not padded */
+	if (stride != width * 4) {
+		rows = malloc(width * height * 4);
+		if (rows == NULL)
+			goto err_hide;
+	}
+
+	pixmap = xcb_generate_id(c->conn);
+	xcb_create_pixmap(c->conn, 32, pixmap, c->screen->root, width, height);
+	gc = xcb_generate_id(c->conn);
+	xcb_create_gc(c->conn, gc, pixmap, 0, NULL);
+
+	data = wl_shm_buffer_get_data(shm_buffer);
+	wl_shm_buffer_begin_access(shm_buffer);
+	if (rows) {
+		for (y = 0; y < height; y++)
+			memcpy(rows + y * width * 4, data + y * stride,
+			       width * 4);
+		data = rows;
+	}
+	xcb_put_image(c->conn, XCB_IMAGE_FORMAT_Z_PIXMAP, pixmap, gc,
+		      width, height, 0, 0, 0, 32, width * height * 4, data);
+	wl_shm_buffer_end_access(shm_buffer);
+	free(rows);
+
+	picture = xcb_generate_id(c->conn);
+	xcb_render_create_picture(c->conn, picture, pixmap,
+				  c->cursor.format, 0, NULL);
+	cursor = xcb_generate_id(c->conn);
+	xcb_render_create_cursor(c->conn, cursor, picture, hx, hy);
+
+	x11_compositor_set_cursor(c, cursor);
+
+	xcb_render_free_picture(c->conn, picture);
+	xcb_free_gc(c->conn, gc);
+	xcb_free_pixmap(c->conn, pixmap);
+
+	weston_buffer_reference(&c->cursor.buffer_ref,
+				surface->buffer_ref.buffer);
+	c->cursor.hx = hx;
+	c->cursor.hy = hy;
+
+	return 1;
+
+err_hide:
+	/* The sprite gets composited, hide the X cursor */
+	if (c->cursor.cursor)
+		x11_compositor_set_cursor(c, c->null_cursor);
+	weston_buffer_reference(&c->cursor.buffer_ref, NULL);
+
+	return 0;
+}
+
+static void
+x11_output_assign_planes(struct weston_output *output_base)
+{
+	struct x11_compositor *c =
+		(struct x11_compositor *) output_base->compositor;
+	struct weston_view *ev, *sprite = NULL;
+
+	/* The X server moves the cursor by itself. */
+	pixman_region32_fini(&c->cursor.plane.damage);
+	pixman_region32_init(&c->cursor.plane.damage);
+
+	if (x11_compositor_forward_sprite(c))
+		sprite = c->core_seat.pointer->sprite;
+
+	wl_list_for_each(ev, &c->base.view_list, link) {
+		if (ev == sprite) {
+			/* compared with the forwarded one next time */
+			ev->surface->keep_buffer = 1;
+			weston_view_move_to_plane(ev, &c->cursor.plane);
+		} else {
+			if (ev->plane == &c->cursor.plane)
+				ev->surface->keep_buffer = 0;
+			weston_view_move_to_plane(ev, &c->base.primary_plane);
+		}
+	}
+}
+
 static void
 x11_output_deinit_shm(struct x11_compositor *c, struct x11_output *output)
 {
+	struct x11_shm_buffer *sb;
 	xcb_void_cookie_t cookie;
 	xcb_generic_error_t *err;
+	unsigned int i;
+
 	xcb_free_gc(c->conn, output->gc);
 
-	pixman_image_unref(output->hw_surface);
-	output->hw_surface = NULL;
-	cookie = xcb_shm_detach_checked(c->conn, output->segment);
-	err = xcb_request_check(c->conn, cookie);
-	if (err) {
-		weston_log("xcb_shm_detach failed, error %d\n", err->error_code);
-		free(err);
+	for (i = 0; i < ARRAY_LENGTH(output->shm); i++) {
+		sb = &output->shm[i];
+		if (!sb->image)
+			continue;
+
+		pixman_image_unref(sb->image);
+		sb->image = NULL;
+		pixman_region32_fini(&sb->damage);
+		cookie = xcb_shm_detach_checked(c->conn, sb->segment);
+		err = xcb_request_check(c->conn, cookie);
+		if (err) {
+			weston_log("xcb_shm_detach failed, error %d\n", err->error_code);
+			free(err);
+		}
+		shmdt(sb->buf);
 	}
-	shmdt(output->buf);
 }
 
 static void
@@ -649,6 +920,50 @@ get_depth_of_visual(xcb_screen_t *screen,
 	return 0;
 }
 
+static int
+x11_shm_buffer_init(struct x11_compositor *c, struct x11_output *output,
+		    struct x11_shm_buffer *sb, int width, int height,
+		    int bitsperpixel, pixman_format_code_t pixman_format)
+{
+	xcb_void_cookie_t cookie;
+	xcb_generic_error_t *err;
+
+	/* Create SHM segment and attach it */
+	sb->shm_id = shmget(IPC_PRIVATE, width * height * (bitsperpixel / 8), IPC_CREAT | S_IRWXU);
+	if (sb->shm_id == -1) {
+		weston_log("x11shm: failed to allocate SHM segment\n");
+		return -1;
+	}
+	sb->buf = shmat(sb->shm_id, NULL, 0 /* read/write */);
+	if (-1 == (long)sb->buf) {
+		weston_log("x11shm: failed to attach SHM segment\n");
+		return -1;
+	}
+	sb->segment = xcb_generate_id(c->conn);
+	cookie = xcb_shm_attach_checked(c->conn, sb->segment, sb->shm_id, 1);
+	err = xcb_request_check(c->conn, cookie);
+	if (err) {
+		weston_log("x11shm: xcb_shm_attach error %d\n", err->error_code);
+		free(err);
+		shmdt(sb->buf);
+		return -1;
+	}
+
+	shmctl(sb->shm_id, IPC_RMID, NULL);
+
+	/* Now create pixman image */
+	sb->image = pixman_image_create_bits(pixman_format, width, height, sb->buf,
+		width * (bitsperpixel / 8));
+
+	/* Everything is out of date in a new image */
+	pixman_region32_init(&sb->damage);
+	pixman_region32_copy(&sb->damage, &output->base.region);
+	sb->busy = 0;
+	sb->completions = 0;
+
+	return 0;
+}
+
 static int
 x11_output_init_shm(struct x11_compositor *c, struct x11_output *output,
 	int width, int height)
@@ -656,9 +971,8 @@ x11_output_init_shm(struct x11_compositor *c, struct x11_output *output,
 	xcb_screen_iterator_t iter;
 	xcb_visualtype_t *visual_type;
 	xcb_format_iterator_t fmt;
-	xcb_void_cookie_t cookie;
-	xcb_generic_error_t *err;
 	const xcb_query_extension_reply_t *ext;
+	unsigned int i;
 	int bitsperpixel = 0;
 	pixman_format_code_t pixman_format;
 
@@ -716,31 +1030,13 @@ x11_output_init_shm(struct x11_compositor *c, struct x11_output *output,
 	}
 
 
-	/* Create SHM segment and attach it */
-	output->shm_id = shmget(IPC_PRIVATE, width * height * (bitsperpixel / 8), IPC_CREAT | S_IRWXU);
-	if (output->shm_id == -1) {
-		weston_log("x11shm: failed to allocate SHM segment\n");
-		return -1;
-	}
-	output->buf = shmat(output->shm_id, NULL, 0 /* read/write */);
-	if (-1 == (long)output->buf) {
-		weston_log("x11shm: failed to attach SHM segment\n");
-		return -1;
-	}
-	output->segment = xcb_generate_id(c->conn);
-	cookie = xcb_shm_attach_checked(c->conn, output->segment, output->shm_id, 1);
-	err = xcb_request_check(c->conn, cookie);
-	if (err) {
-		weston_log("x11shm: xcb_shm_attach error %d\n", err->error_code);
-		free(err);
-		return -1;
-	}
-
-	shmctl(output->shm_id, IPC_RMID, NULL);
+	for (i = 0; i < ARRAY_LENGTH(output->shm); i++)
+		if (x11_shm_buffer_init(c, output, &output->shm[i],
+					width, height, bitsperpixel,
+					pixman_format) < 0)
+			return -1;
 
-	/* Now create pixman image */
-	output->hw_surface = pixman_image_create_bits(pixman_format, width, height, output->buf,
-		width * (bitsperpixel / 8));
+	c->shm_event_base = ext->first_event;
 
 	output->gc = xcb_generate_id(c->conn);
 	xcb_create_gc(c->conn, output->gc, output->window, 0, NULL);
@@ -865,7 +1161,7 @@ x11_compositor_create_output(struct x11_compositor *c, int x, int y,
 	else
 		output->base.repaint = x11_output_repaint_gl;
 	output->base.destroy = x11_output_destroy;
-	output->base.assign_planes = NULL;
+	output->base.assign_planes = x11_output_assign_planes;
 	output->base.set_backlight = NULL;
 	output->base.set_dpms = NULL;
 	output->base.switch_mode = NULL;
@@ -926,6 +1222,32 @@ x11_compositor_find_output(struct x11_compositor *c, xcb_window_t window)
 	assert(0);
 }
 
+static void
+x11_compositor_shm_completion(struct x11_compositor *c,
+			      xcb_shm_completion_event_t *completion)
+{
+	struct x11_output *output;
+	struct x11_shm_buffer *sb;
+	unsigned int i;
+
+	/* The window may be gone by now */
+	wl_list_for_each(output, &c->base.output_list, base.link) {
+		if (output->window != completion->drawable)
+			continue;
+
+		for (i = 0; i < ARRAY_LENGTH(output->shm); i++) {
+			sb = &output->shm[i];
+			if (sb->segment != completion->shmseg ||
+			    sb->completions == 0)
+				continue;
+
+			/* Only the last put in flight frees the image. */
+			if (--sb->completions == 0)
+				sb->busy = 0;
+		}
+	}
+}
+
 static void
 x11_compositor_delete_window(struct x11_compositor *c, xcb_window_t window)
 {
@@ -1293,6 +1615,11 @@ x11_compositor_handle_event(int fd, uint32_t mask, void *data)
 			break;
 		}
 
+		if (c->shm_event_base &&
+		    response_type == c->shm_event_base + XCB_SHM_COMPLETION)
+			x11_compositor_shm_completion(c,
+				(xcb_shm_completion_event_t *) event);
+
 #ifdef HAVE_XCB_XKB
 		if (c->has_xkb) {
 			if (response_type == c->xkb_event_base) {
@@ -1426,6 +1753,9 @@ x11_destroy(struct weston_compositor *ec)
 	wl_event_source_remove(compositor->xcb_source);
 	x11_input_destroy(compositor);
 
+	weston_buffer_reference(&compositor->cursor.buffer_ref, NULL);
+	weston_plane_release(&compositor->cursor.plane);
+
 	weston_compositor_shutdown(ec); /* destroys outputs, too */
 
 	XCloseDisplay(compositor->dpy);
@@ -1515,6 +1845,10 @@ x11_compositor_create(struct wl_display *display,
 
 	x11_compositor_get_resources(c);
 	x11_compositor_get_wm_info(c);
+	x11_compositor_find_cursor_format(c);
+
+	weston_plane_init(&c->cursor.plane, &c->base, 0, 0);
+	weston_compositor_stack_plane(&c->base, &c->cursor.plane, NULL);
 
 	if (!c->has_net_wm_state_fullscreen && fullscreen) {
 		weston_log("Can not fullscreen without window manager support"
@@ -47,6 +47,10 @@
 #include <sys/time.h>
 #include <time.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #ifdef HAVE_LIBUNWIND
 #define UNW_LOCAL_ONLY
 #include <libunwind.h>
@@ -412,6 +416,7 @@ weston_surface_create(struct weston_compositor *compositor)
 
 	pixman_region32_init(&surface->damage);
 	pixman_region32_init(&surface->opaque);
+	pixman_region32_init(&surface->inferred_opaque.region);
 	region_init_infinite(&surface->input);
 
 	wl_list_init(&surface->views);
@@ -855,11 +860,11 @@ view_compute_bbox(struct weston_view *view, int32_t sx, int32_t sy,
 {
 	float min_x = HUGE_VALF,  min_y = HUGE_VALF;
 	float max_x = -HUGE_VALF, max_y = -HUGE_VALF;
-	int32_t s[4][2] = {
-		{ sx,         sy },
-		{ sx,         sy + height },
-		{ sx + width, sy },
-		{ sx + width, sy + height }
+	struct weston_vector v[4] = {
+		{ { sx,         sy,          0.0f, 1.0f } },
+		{ { sx,         sy + height, 0.0f, 1.0f } },
+		{ { sx + width, sy,          0.0f, 1.0f } },
+		{ { sx + width, sy + height, 0.0f, 1.0f } }
 	};
 	float int_x, int_y;
 	int i;
@@ -870,9 +875,28 @@ view_compute_bbox(struct weston_view *view, int32_t sx, int32_t sy,
 		return;
 	}
 
+	/* Transform all corners in one go, rather than one
+	 * weston_view_to_global_float() call each. */
+	if (view->transform.enabled)
+		weston_matrix_transform_points(&view->transform.matrix, v, 4);
+
 	for (i = 0; i < 4; ++i) {
 		float x, y;
-		weston_view_to_global_float(view, s[i][0], s[i][1], &x, &y);
+
+		if (!view->transform.enabled) {
+			x = v[i].f[0] + view->geometry.x;
+			y = v[i].f[1] + view->geometry.y;
+		} else if (fabsf(v[i].f[3]) < 1e-6) {
+			weston_log("warning: numerical instability in "
+				   "%s(), divisor = %g\n", __func__,
+				   v[i].f[3]);
+			x = 0;
+			y = 0;
+		} else {
+			x = v[i].f[0] / v[i].f[3];
+			y = v[i].f[1] / v[i].f[3];
+		}
+
 		if (x < min_x)
 			min_x = x;
 		if (x > max_x)
@@ -1273,8 +1297,17 @@ weston_compositor_pick_view(struct weston_compositor *compositor,
 			    wl_fixed_t *vx, wl_fixed_t *vy)
 {
 	struct weston_view *view;
+	int ix = floor(wl_fixed_to_double(x));
+	int iy = floor(wl_fixed_to_double(y));
 
 	wl_list_for_each(view, &compositor->view_list, link) {
+		/* Skip the inverse transform for views nowhere near. The
+		 * bounding box is only current after a transform update. */
+		weston_view_update_transform(view);
+		if (!pixman_region32_contains_point(&view->transform.boundingbox,
+						    ix, iy, NULL))
+			continue;
+
 		weston_view_from_global_fixed(view, x, y, vx, vy);
 		if (pixman_region32_contains_point(&view->surface->input,
 						   wl_fixed_to_int(*vx),
@@ -1415,6 +1448,7 @@ weston_surface_destroy(struct weston_surface *surface)
 
 	pixman_region32_fini(&surface->damage);
 	pixman_region32_fini(&surface->opaque);
+	pixman_region32_fini(&surface->inferred_opaque.region);
 	pixman_region32_fini(&surface->input);
 
 	wl_list_for_each_safe(cb, next, &surface->frame_callback_list, link)
@@ -1768,6 +1802,9 @@ weston_output_repaint(struct weston_output *output, uint32_t msecs)
 	if (output->destroying)
 		return 0;
 
+	/* Coalesced pointer motion lands in the frame it was made for. */
+	weston_compositor_flush_motion(ec);
+
 	/* Rebuild the surface list and update surface transforms up front. */
 	weston_compositor_build_view_list(ec);
 
@@ -1786,6 +1823,7 @@ weston_output_repaint(struct weston_output *output, uint32_t msecs)
 			wl_list_insert_list(&frame_callback_list,
 					    &ev->surface->frame_callback_list);
 			wl_list_init(&ev->surface->frame_callback_list);
+			weston_latency_repaint(output, ev->surface);
 		}
 	}
 
@@ -1840,6 +1878,8 @@ weston_output_finish_frame(struct weston_output *output, uint32_t msecs)
 		wl_display_get_event_loop(compositor->wl_display);
 	int fd, r;
 
+	weston_latency_present(output);
+
 	output->frame_time = msecs;
 
 	if (output->repaint_needed &&
@@ -2041,6 +2081,207 @@ weston_surface_commit_subsurface_order(struct weston_surface *surface)
 	}
 }
 
+/* Size of the cells the inferred opaque region is built from. Finer
+ * cells find more opaque area next to translucent borders, but produce
+ * more complex regions. */
+#define OPAQUE_CELL_SIZE 32
+
+/* Returns 1 if every pixel in the width x height block has alpha 0xff. */
+static int
+argb8888_block_is_opaque(const uint32_t *pixels, int stride,
+			 int width, int height)
+{
+	const uint32_t *row;
+	uint32_t acc;
+	int x, y;
+
+	for (y = 0; y < height; y++) {
+		row = pixels + y * stride;
+		acc = 0xffffffff;
+		x = 0;
+
+#ifdef __SSE2__
+		if (width >= 4) {
+			__m128i vacc = _mm_set1_epi32(-1);
+			__m128i alpha = _mm_set1_epi32(0xff000000);
+
+			for (; x + 4 <= width; x += 4)
+				vacc = _mm_and_si128(vacc,
+					_mm_loadu_si128((const __m128i *) (row + x)));
+
+			vacc = _mm_cmpeq_epi32(_mm_and_si128(vacc, alpha),
+					       alpha);
+			if (_mm_movemask_epi8(vacc) != 0xffff)
+				return 0;
+		}
+#endif
+		for (; x < width; x++)
+			acc &= row[x];
+
+		if ((acc & 0xff000000) != 0xff000000)
+			return 0;
+	}
+
+	return 1;
+}
+
+static void
+surface_scan_opaque(struct wl_shm_buffer *shm_buffer,
+		    pixman_region32_t *damage, pixman_region32_t *found)
+{
+	const uint32_t *pixels = wl_shm_buffer_get_data(shm_buffer);
+	int stride = wl_shm_buffer_get_stride(shm_buffer) / 4;
+	pixman_box32_t *rects;
+	int i, n, x, y, w, h, run;
+
+	rects = pixman_region32_rectangles(damage, &n);
+
+	wl_shm_buffer_begin_access(shm_buffer);
+	for (i = 0; i < n; i++) {
+		for (y = rects[i].y1; y < rects[i].y2; y += OPAQUE_CELL_SIZE) {
+			h = MIN(OPAQUE_CELL_SIZE, rects[i].y2 - y);
+			run = rects[i].x1;
+			for (x = rects[i].x1; x < rects[i].x2;
+			     x += OPAQUE_CELL_SIZE) {
+				w = MIN(OPAQUE_CELL_SIZE, rects[i].x2 - x);
+				if (argb8888_block_is_opaque(pixels +
+							     y * stride + x,
+							     stride, w, h))
+					continue;
+
+				if (x > run)
+					pixman_region32_union_rect(found,
+								   found,
+								   run, y,
+								   x - run, h);
+				run = x + w;
+			}
+			if (rects[i].x2 > run)
+				pixman_region32_union_rect(found, found,
+							   run, y,
+							   rects[i].x2 - run,
+							   h);
+		}
+	}
+	wl_shm_buffer_end_access(shm_buffer);
+}
+
+static void
+inferred_opaque_clear(struct weston_surface *surface)
+{
+	empty_region(&surface->inferred_opaque.region);
+	surface->inferred_opaque.width = 0;
+	surface->inferred_opaque.height = 0;
+}
+
+/* Update the inferred opaque region of the surface from the newly
+ * committed damage, which is in surface coordinates. Only buffers that
+ * map 1:1 to the surface are scanned; anything else drops the inferred
+ * region. The region is kept for the size and format of the buffer it
+ * was found in.
+ */
+static void
+weston_surface_infer_opaque(struct weston_surface *surface,
+			    pixman_region32_t *damage, int attached)
+{
+	struct weston_buffer_viewport *vp = &surface->buffer_viewport;
+	struct weston_buffer *buffer = surface->buffer_ref.buffer;
+	struct wl_shm_buffer *shm_buffer = NULL;
+	pixman_region32_t *inferred = &surface->inferred_opaque.region;
+	pixman_region32_t scan, found;
+	pixman_box32_t *extents;
+	int i, n;
+
+	if (!surface->compositor->infer_opaque)
+		return;
+
+	if (buffer)
+		shm_buffer = wl_shm_buffer_get(buffer->resource);
+
+	if (!shm_buffer && !attached) {
+		/* The renderer let go of the buffer, which still holds
+		 * the same contents; only forget the damaged parts. */
+		pixman_region32_subtract(inferred, inferred, damage);
+		return;
+	}
+
+	if (!shm_buffer) {
+		/* Nothing to look at. */
+		inferred_opaque_clear(surface);
+		return;
+	}
+
+	if (vp->buffer.transform != WL_OUTPUT_TRANSFORM_NORMAL ||
+	    vp->buffer.scale != 1 ||
+	    vp->buffer.src_width != wl_fixed_from_int(-1) ||
+	    vp->surface.width != -1) {
+		inferred_opaque_clear(surface);
+		return;
+	}
+
+	switch (wl_shm_buffer_get_format(shm_buffer)) {
+	case WL_SHM_FORMAT_XRGB8888:
+	case WL_SHM_FORMAT_RGB565:
+	case WL_SHM_FORMAT_YUYV:
+	case WL_SHM_FORMAT_NV12:
+	case WL_SHM_FORMAT_YUV420:
+		pixman_region32_fini(inferred);
+		pixman_region32_init_rect(inferred, 0, 0,
+					  surface->width, surface->height);
+		surface->inferred_opaque.width = surface->width;
+		surface->inferred_opaque.height = surface->height;
+		surface->inferred_opaque.format =
+			wl_shm_buffer_get_format(shm_buffer);
+		return;
+	case WL_SHM_FORMAT_ARGB8888:
+		break;
+	default:
+		inferred_opaque_clear(surface);
+		return;
+	}
+
+	pixman_region32_init(&scan);
+	if (surface->inferred_opaque.width != surface->width ||
+	    surface->inferred_opaque.height != surface->height ||
+	    surface->inferred_opaque.format != WL_SHM_FORMAT_ARGB8888) {
+		/* New buffer size or format, the old result no longer
+		 * applies. */
+		empty_region(inferred);
+		pixman_region32_init_rect(&scan, 0, 0,
+					  surface->width, surface->height);
+		surface->inferred_opaque.width = surface->width;
+		surface->inferred_opaque.height = surface->height;
+		surface->inferred_opaque.format = WL_SHM_FORMAT_ARGB8888;
+	} else {
+		/* Rescan every cell touched by the damage. */
+		extents = pixman_region32_rectangles(damage, &n);
+		for (i = 0; i < n; i++) {
+			int32_t x1, y1, x2, y2;
+
+			x1 = extents[i].x1 & ~(OPAQUE_CELL_SIZE - 1);
+			y1 = extents[i].y1 & ~(OPAQUE_CELL_SIZE - 1);
+			x2 = (extents[i].x2 + OPAQUE_CELL_SIZE - 1) &
+				~(OPAQUE_CELL_SIZE - 1);
+			y2 = (extents[i].y2 + OPAQUE_CELL_SIZE - 1) &
+				~(OPAQUE_CELL_SIZE - 1);
+			pixman_region32_union_rect(&scan, &scan, x1, y1,
+						   x2 - x1, y2 - y1);
+		}
+		pixman_region32_intersect_rect(&scan, &scan, 0, 0,
+					       surface->width,
+					       surface->height);
+	}
+
+	pixman_region32_init(&found);
+	surface_scan_opaque(shm_buffer, &scan, &found);
+
+	pixman_region32_subtract(inferred, inferred, &scan);
+	pixman_region32_union(inferred, inferred, &found);
+
+	pixman_region32_fini(&found);
+	pixman_region32_fini(&scan);
+}
+
 static void
 weston_surface_commit(struct weston_surface *surface)
 {
@@ -2062,6 +2303,9 @@ weston_surface_commit(struct weston_surface *surface)
 		surface->configure(surface,
 				   surface->pending.sx, surface->pending.sy);
 
+	weston_surface_infer_opaque(surface, &surface->pending.damage,
+				    surface->pending.newly_attached);
+
 	weston_surface_reset_pending_buffer(surface);
 
 	/* wl_surface.damage */
@@ -2074,11 +2318,12 @@ weston_surface_commit(struct weston_surface *surface)
 	empty_region(&surface->pending.damage);
 
 	/* wl_surface.set_opaque_region */
-	pixman_region32_init_rect(&opaque, 0, 0,
-				  surface->width,
-				  surface->height);
-	pixman_region32_intersect(&opaque,
-				  &opaque, &surface->pending.opaque);
+	pixman_region32_init(&opaque);
+	pixman_region32_union(&opaque, &surface->pending.opaque,
+			      &surface->inferred_opaque.region);
+	pixman_region32_intersect_rect(&opaque, &opaque, 0, 0,
+				       surface->width,
+				       surface->height);
 
 	if (!pixman_region32_equal(&opaque, &surface->opaque)) {
 		pixman_region32_copy(&surface->opaque, &opaque);
@@ -2119,6 +2364,8 @@ surface_commit(struct wl_client *client, struct wl_resource *resource)
 	struct weston_surface *surface = wl_resource_get_user_data(resource);
 	struct weston_subsurface *sub = weston_surface_to_subsurface(surface);
 
+	weston_latency_commit(surface);
+
 	if (sub) {
 		weston_subsurface_commit(sub);
 		return;
@@ -2282,6 +2529,10 @@ weston_subsurface_commit_from_cache(struct weston_subsurface *sub)
 
 	if (surface->configure && sub->cached.newly_attached)
 		surface->configure(surface, sub->cached.sx, sub->cached.sy);
+
+	weston_surface_infer_opaque(surface, &sub->cached.damage,
+				    sub->cached.newly_attached);
+
 	sub->cached.sx = 0;
 	sub->cached.sy = 0;
 	sub->cached.newly_attached = 0;
@@ -2296,11 +2547,12 @@ weston_subsurface_commit_from_cache(struct weston_subsurface *sub)
 	empty_region(&sub->cached.damage);
 
 	/* wl_surface.set_opaque_region */
-	pixman_region32_init_rect(&opaque, 0, 0,
-				  surface->width,
-				  surface->height);
-	pixman_region32_intersect(&opaque,
-				  &opaque, &sub->cached.opaque);
+	pixman_region32_init(&opaque);
+	pixman_region32_union(&opaque, &sub->cached.opaque,
+			      &surface->inferred_opaque.region);
+	pixman_region32_intersect_rect(&opaque, &opaque, 0, 0,
+				       surface->width,
+				       surface->height);
 
 	if (!pixman_region32_equal(&opaque, &surface->opaque)) {
 		pixman_region32_copy(&surface->opaque, &opaque);
@@ -3121,6 +3373,7 @@ weston_output_destroy(struct weston_output *output)
 	free(output->name);
 	pixman_region32_fini(&output->region);
 	pixman_region32_fini(&output->previous_damage);
+	weston_latency_output_release(output);
 	output->compositor->output_id_pool &= ~(1 << output->id);
 
 	wl_global_destroy(output->global);
@@ -3316,6 +3569,7 @@ weston_output_init(struct weston_output *output, struct weston_compositor *c,
 	wl_signal_init(&output->destroy_signal);
 	wl_list_init(&output->animation_list);
 	wl_list_init(&output->resource_list);
+	weston_latency_output_init(output);
 
 	output->id = ffs(~output->compositor->output_id_pool) - 1;
 	output->compositor->output_id_pool |= 1 << output->id;
@@ -3692,9 +3946,17 @@ weston_compositor_init(struct weston_compositor *ec,
 	wl_list_init(&ec->axis_binding_list);
 	wl_list_init(&ec->debug_binding_list);
 
+	weston_latency_init(ec);
+
 	weston_plane_init(&ec->primary_plane, ec, 0, 0);
 	weston_compositor_stack_plane(ec, &ec->primary_plane, NULL);
 
+	s = weston_config_get_section(ec->config, "core", NULL, NULL);
+	weston_config_section_get_bool(s, "infer-opaque-regions",
+				       &ec->infer_opaque, 0);
+	weston_config_section_get_bool(s, "coalesce-motion",
+				       &ec->coalesce_motion, 0);
+
 	s = weston_config_get_section(ec->config, "keyboard", NULL, NULL);
 	weston_config_section_get_string(s, "keymap_rules",
 					 (char **) &xkb_names.rules, NULL);
@@ -3752,6 +4014,8 @@ weston_compositor_shutdown(struct weston_compositor *ec)
 	weston_binding_list_destroy_all(&ec->axis_binding_list);
 	weston_binding_list_destroy_all(&ec->debug_binding_list);
 
+	weston_latency_release(ec);
+
 	weston_plane_release(&ec->primary_plane);
 
 	wl_event_loop_destroy(ec->input_loop);
@@ -4078,6 +4342,18 @@ usage(int error_code)
 		"  --sprawl\t\tCreate one fullscreen output for every parent output\n"
 		"  --display=DISPLAY\tWayland display to connect to\n\n");
 
+#if defined(BUILD_HEADLESS_COMPOSITOR)
+	fprintf(stderr,
+		"Options for headless-backend.so:\n\n"
+		"  --width=WIDTH\t\tWidth of the output\n"
+		"  --height=HEIGHT\tHeight of the output\n"
+#if defined(BUILD_HEADLESS_REPLAY)
+		"  --replay=FILE\t\tReplay an input recording, then quit\n"
+		"  --replay-speed=N\tReplay N times faster, 0 for no delays\n"
+#endif
+		"\n");
+#endif
+
 #if defined(BUILD_RPI_COMPOSITOR) && defined(HAVE_BCM_HOST)
 	fprintf(stderr,
 		"Options for rpi-backend.so:\n\n"
@@ -173,6 +173,17 @@ enum weston_mode_switch_op {
 	WESTON_MODE_SWITCH_RESTORE_NATIVE
 };
 
+#define WESTON_LATENCY_BUCKETS 256
+
+/* Input-to-present latency, in 1 ms buckets. The last bucket also
+ * collects everything slower. */
+struct weston_latency_histogram {
+	uint32_t count;
+	uint32_t max;
+	uint64_t sum;
+	uint32_t bucket[WESTON_LATENCY_BUCKETS];
+};
+
 struct weston_output {
 	uint32_t id;
 	char *name;
@@ -201,6 +212,11 @@ struct weston_output {
 	int disable_planes;
 	int destroying;
 
+	/* Input times answered by the frame being presented, and what we
+	 * measured so far, see input-latency.c */
+	struct wl_array latency_pending;
+	struct weston_latency_histogram latency;
+
 	char *make, *model, *serial_number;
 	uint32_t subpixel;
 	uint32_t transform;
@@ -334,6 +350,14 @@ struct weston_pointer {
 	uint32_t button_count;
 
 	struct wl_listener output_destroy_listener;
+
+	/* Relative motion not given to the grab yet, with
+	 * weston_compositor::coalesce_motion set */
+	struct {
+		int pending;
+		uint32_t time;
+		wl_fixed_t x, y;
+	} coalesced;
 };
 
 
@@ -434,6 +458,9 @@ struct weston_xkb_info {
 	size_t keymap_size;
 	char *keymap_area;
 	int32_t ref_count;
+	struct wl_list link; /* weston_compositor::xkb_info_list */
+	int named; /* compiled from names, held by the keymap cache */
+	struct xkb_rule_names names;
 	xkb_mod_index_t shift_mod;
 	xkb_mod_index_t caps_mod;
 	xkb_mod_index_t ctrl_mod;
@@ -640,9 +667,19 @@ struct weston_compositor {
 	struct xkb_rule_names xkb_names;
 	struct xkb_context *xkb_context;
 	struct weston_xkb_info *xkb_info;
+	struct wl_list xkb_info_list;
 
 	/* Raw keyboard processing (no libxkbcommon initialization or handling) */
 	int use_xkbcommon;
+
+	/* Derive opaque regions from SHM buffer contents */
+	int infer_opaque;
+
+	/* Deliver relative pointer motion once per frame */
+	int coalesce_motion;
+
+	/* Per-client input latency records, see input-latency.c */
+	struct wl_list latency_client_list;
 };
 
 struct weston_buffer {
@@ -881,6 +918,21 @@ struct weston_surface {
 	/* wl_viewport resource for this surface */
 	struct wl_resource *viewport_resource;
 
+	/* Opaque region found by scanning the alpha channel of the attached
+	 * SHM buffers, in surface coordinates. Merged into 'opaque' on
+	 * commit. Only maintained if weston_compositor::infer_opaque is set.
+	 */
+	struct {
+		pixman_region32_t region;
+		int32_t width, height; /* buffer size the region belongs to */
+		uint32_t format; /* and its wl_shm format */
+	} inferred_opaque;
+
+	/* Time of the input event the last content commit answered, until
+	 * the surface is repainted. */
+	int latency_pending;
+	uint32_t latency_time;
+
 	/* All the pending state, that wl_surface.commit will apply. */
 	struct {
 		/* wl_surface.attach */
@@ -983,6 +1035,8 @@ void
 notify_motion(struct weston_seat *seat, uint32_t time,
 	      wl_fixed_t dx, wl_fixed_t dy);
 void
+weston_compositor_flush_motion(struct weston_compositor *compositor);
+void
 notify_motion_absolute(struct weston_seat *seat, uint32_t time,
 		       wl_fixed_t x, wl_fixed_t y);
 void
@@ -1220,6 +1274,24 @@ weston_compositor_init(struct weston_compositor *ec, struct wl_display *display,
 		       int *argc, char *argv[], struct weston_config *config);
 void
 weston_compositor_shutdown(struct weston_compositor *ec);
+void
+weston_latency_init(struct weston_compositor *ec);
+void
+weston_latency_release(struct weston_compositor *ec);
+void
+weston_latency_output_init(struct weston_output *output);
+void
+weston_latency_output_release(struct weston_output *output);
+void
+weston_latency_input(struct weston_surface *surface, uint32_t time);
+void
+weston_latency_commit(struct weston_surface *surface);
+void
+weston_latency_repaint(struct weston_output *output,
+		       struct weston_surface *surface);
+void
+weston_latency_present(struct weston_output *output);
+
 void
 weston_output_init_zoom(struct weston_output *output);
 void
@@ -1259,6 +1331,9 @@ void
 weston_seat_repick(struct weston_seat *seat);
 void
 weston_seat_update_keymap(struct weston_seat *seat, struct xkb_keymap *keymap);
+struct xkb_keymap *
+weston_compositor_get_keymap(struct weston_compositor *ec,
+			     const struct xkb_rule_names *names);
 
 void
 weston_seat_release(struct weston_seat *seat);
@@ -0,0 +1,562 @@
+/*
+ * Copyright © 2014 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Recording and replay of evdev input streams.
+ *
+ * When WESTON_EVDEV_RECORD names a file, every evdev device that gets
+ * created is described in it and every event read from the kernel is
+ * appended to it, after mtdev conversion.  The file is plain text, one
+ * item per line:
+ *
+ *   D <id> <bustype> <vendor> <product> <version> <name>
+ *   P <id> <property>...
+ *   B <id> <event type> <code>...       (event type 0 lists the types)
+ *   A <id> <code> <value> <min> <max> <fuzz> <flat> <resolution>
+ *   E <id> <sec> <usec> <type> <code> <value>
+ *
+ * A replay reads such a file back, creates a device from each description
+ * and feeds the events through evdev_device_process_events(), so they take
+ * the same dispatch, acceleration filter and notify_*() paths as live
+ * input.  Event timestamps are passed on unchanged, which keeps the
+ * acceleration deterministic regardless of the replay speed.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <linux/input.h>
+#include <mtdev.h>
+
+#include "compositor.h"
+#include "evdev.h"
+
+static FILE *record_file;
+static int record_checked;
+static int record_next_id;
+
+static FILE *
+record_get_file(void)
+{
+	const char *path;
+
+	if (record_checked)
+		return record_file;
+	record_checked = 1;
+
+	path = getenv("WESTON_EVDEV_RECORD");
+	if (path == NULL)
+		return NULL;
+
+	record_file = fopen(path, "w");
+	if (record_file == NULL) {
+		weston_log("failed to open input recording %s: %s\n",
+			   path, strerror(errno));
+		return NULL;
+	}
+
+	weston_log("recording input events to %s\n", path);
+	fprintf(record_file, "# weston evdev recording\n");
+
+	return record_file;
+}
+
+static void
+record_bit_list(FILE *fp, const unsigned long *bits, unsigned int nbits)
+{
+	unsigned int i;
+
+	for (i = 0; i < nbits; i++)
+		if (TEST_BIT(bits, i))
+			fprintf(fp, " %u", i);
+	fprintf(fp, "\n");
+}
+
+void
+evdev_record_device(struct evdev_device *device,
+		    const struct evdev_device_info *info)
+{
+	struct evdev_device_info copy;
+	FILE *fp;
+	unsigned int i;
+	int id;
+
+	fp = record_get_file();
+	if (fp == NULL)
+		return;
+
+	/* The events we record come out of mtdev already converted to
+	 * protocol B, so describe the device the way a replay has to
+	 * treat it. */
+	copy = *info;
+	if (device->mtdev) {
+		copy.abs_bits[LONG(ABS_MT_SLOT)] |= BIT(ABS_MT_SLOT);
+		copy.absinfo[ABS_MT_SLOT].value = device->mt.slot;
+		copy.absinfo[ABS_MT_SLOT].maximum =
+			device->mtdev->caps.slot.maximum;
+	}
+
+	id = record_next_id++;
+	device->record_id = id;
+
+	fprintf(fp, "D %d %04x %04x %04x %04x %s\n", id,
+		copy.id.bustype, copy.id.vendor,
+		copy.id.product, copy.id.version, device->devname);
+
+	fprintf(fp, "P %d", id);
+	record_bit_list(fp, copy.prop_bits, sizeof(copy.prop_bits) * 8);
+	fprintf(fp, "B %d 0", id);
+	record_bit_list(fp, copy.ev_bits, EV_CNT);
+	fprintf(fp, "B %d %d", id, EV_KEY);
+	record_bit_list(fp, copy.key_bits, KEY_CNT);
+	fprintf(fp, "B %d %d", id, EV_REL);
+	record_bit_list(fp, copy.rel_bits, REL_CNT);
+	fprintf(fp, "B %d %d", id, EV_ABS);
+	record_bit_list(fp, copy.abs_bits, ABS_CNT);
+
+	for (i = 0; i < ABS_CNT; i++) {
+		if (!TEST_BIT(copy.abs_bits, i))
+			continue;
+		fprintf(fp, "A %d %u %d %d %d %d %d %d\n", id, i,
+			copy.absinfo[i].value,
+			copy.absinfo[i].minimum, copy.absinfo[i].maximum,
+			copy.absinfo[i].fuzz, copy.absinfo[i].flat,
+			copy.absinfo[i].resolution);
+	}
+
+	fflush(fp);
+}
+
+void
+evdev_record_events(struct evdev_device *device,
+		    struct input_event *ev, int count)
+{
+	int i;
+
+	if (device->record_id < 0 || record_file == NULL)
+		return;
+
+	for (i = 0; i < count; i++)
+		fprintf(record_file, "E %d %ld %ld %u %u %d\n",
+			device->record_id,
+			(long) ev[i].time.tv_sec, (long) ev[i].time.tv_usec,
+			ev[i].type, ev[i].code, ev[i].value);
+
+	fflush(record_file);
+}
+
+struct replay_device {
+	int id;
+	char *name;
+	struct evdev_device_info info;
+	struct evdev_device *device;
+};
+
+struct evdev_replay {
+	struct weston_seat *seat;
+	struct wl_event_source *timer;
+	int speed;
+
+	struct wl_array devices;	/* struct replay_device */
+	struct wl_array events;		/* struct input_event */
+	struct wl_array event_devices;	/* unsigned int, index in devices */
+	unsigned int count, pos;
+
+	struct timespec start;
+	int64_t first_us;
+
+	struct {
+		unsigned int events, frames;
+		uint64_t total_ns, max_frame_ns;
+	} stats;
+};
+
+static struct replay_device *
+replay_find_device(struct evdev_replay *replay, int id)
+{
+	struct replay_device *d;
+
+	wl_array_for_each(d, &replay->devices)
+		if (d->id == id)
+			return d;
+
+	return NULL;
+}
+
+static int
+replay_parse_bits(struct replay_device *d, int type, const char *list)
+{
+	unsigned long *bits;
+	unsigned int nbits;
+	char *end;
+	long bit;
+
+	switch (type) {
+	case -1:
+		bits = d->info.prop_bits;
+		nbits = sizeof(d->info.prop_bits) * 8;
+		break;
+	case 0:
+		bits = d->info.ev_bits;
+		nbits = EV_CNT;
+		break;
+	case EV_KEY:
+		bits = d->info.key_bits;
+		nbits = KEY_CNT;
+		break;
+	case EV_REL:
+		bits = d->info.rel_bits;
+		nbits = REL_CNT;
+		break;
+	case EV_ABS:
+		bits = d->info.abs_bits;
+		nbits = ABS_CNT;
+		break;
+	default:
+		/* Other event types carry nothing we configure from. */
+		return 0;
+	}
+
+	for (;;) {
+		errno = 0;
+		bit = strtol(list, &end, 10);
+		if (end == list)
+			break;
+		if (errno != 0 || bit < 0 || bit >= (long) nbits)
+			return -1;
+		bits[LONG(bit)] |= BIT(bit);
+		list = end;
+	}
+
+	return 0;
+}
+
+static int
+replay_parse_line(struct evdev_replay *replay, char *line)
+{
+	struct replay_device *d;
+	struct input_event *ev;
+	struct input_absinfo *abs;
+	unsigned int bustype, vendor, product, version;
+	unsigned int type, code, *index;
+	long sec, usec;
+	int id, t, value, n;
+	size_t len;
+
+	len = strlen(line);
+	if (len > 0 && line[len - 1] == '\n')
+		line[len - 1] = '\0';
+
+	switch (line[0]) {
+	case '\0':
+	case '#':
+		return 0;
+
+	case 'D':
+		if (sscanf(line, "D %d %x %x %x %x %n", &id, &bustype,
+			   &vendor, &product, &version, &n) != 5)
+			return -1;
+		if (replay_find_device(replay, id))
+			return -1;
+		d = wl_array_add(&replay->devices, sizeof *d);
+		if (d == NULL)
+			return -1;
+		memset(d, 0, sizeof *d);
+		d->id = id;
+		d->name = strdup(line + n);
+		d->info.id.bustype = bustype;
+		d->info.id.vendor = vendor;
+		d->info.id.product = product;
+		d->info.id.version = version;
+		return 0;
+
+	case 'P':
+		if (sscanf(line, "P %d%n", &id, &n) != 1)
+			return -1;
+		d = replay_find_device(replay, id);
+		if (d == NULL)
+			return -1;
+		return replay_parse_bits(d, -1, line + n);
+
+	case 'B':
+		if (sscanf(line, "B %d %d%n", &id, &t, &n) != 2)
+			return -1;
+		d = replay_find_device(replay, id);
+		if (d == NULL)
+			return -1;
+		return replay_parse_bits(d, t, line + n);
+
+	case 'A':
+		if (sscanf(line, "A %d %u %n", &id, &code, &n) != 2)
+			return -1;
+		d = replay_find_device(replay, id);
+		if (d == NULL || code >= ABS_CNT)
+			return -1;
+		abs = &d->info.absinfo[code];
+		if (sscanf(line + n, "%d %d %d %d %d %d",
+			   &abs->value, &abs->minimum, &abs->maximum,
+			   &abs->fuzz, &abs->flat, &abs->resolution) != 6)
+			return -1;
+		return 0;
+
+	case 'E':
+		if (sscanf(line, "E %d %ld %ld %u %u %d", &id, &sec, &usec,
+			   &type, &code, &value) != 6)
+			return -1;
+		d = replay_find_device(replay, id);
+		if (d == NULL)
+			return -1;
+		ev = wl_array_add(&replay->events, sizeof *ev);
+		index = wl_array_add(&replay->event_devices, sizeof *index);
+		if (ev == NULL || index == NULL)
+			return -1;
+		ev->time.tv_sec = sec;
+		ev->time.tv_usec = usec;
+		ev->type = type;
+		ev->code = code;
+		ev->value = value;
+		*index = d - (struct replay_device *) replay->devices.data;
+		replay->count++;
+		return 0;
+
+	default:
+		return -1;
+	}
+}
+
+static int
+replay_load(struct evdev_replay *replay, const char *path)
+{
+	FILE *fp;
+	char *line = NULL;
+	size_t size = 0;
+	int lineno = 0, ret = 0;
+
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		weston_log("failed to open input replay %s: %s\n",
+			   path, strerror(errno));
+		return -1;
+	}
+
+	while (getline(&line, &size, fp) != -1) {
+		lineno++;
+		if (replay_parse_line(replay, line) < 0) {
+			weston_log("%s:%d: malformed input recording\n",
+				   path, lineno);
+			ret = -1;
+			break;
+		}
+	}
+
+	free(line);
+	fclose(fp);
+
+	return ret;
+}
+
+static int64_t
+event_time_us(const struct input_event *ev)
+{
+	return (int64_t) ev->time.tv_sec * 1000000 + ev->time.tv_usec;
+}
+
+static int64_t
+timespec_diff_ns(const struct timespec *a, const struct timespec *b)
+{
+	return (int64_t) (a->tv_sec - b->tv_sec) * 1000000000 +
+		(a->tv_nsec - b->tv_nsec);
+}
+
+static void
+replay_finish(struct evdev_replay *replay)
+{
+	double total_ms, per_event_us;
+
+	total_ms = replay->stats.total_ns / 1000000.0;
+	per_event_us = replay->stats.events ?
+		replay->stats.total_ns / 1000.0 / replay->stats.events : 0.0;
+
+	weston_log("input replay done: %u events in %u frames, "
+		   "%.3f ms processing, %.2f us per event, "
+		   "%.2f us worst frame\n",
+		   replay->stats.events, replay->stats.frames,
+		   total_ms, per_event_us,
+		   replay->stats.max_frame_ns / 1000.0);
+
+	wl_display_terminate(replay->seat->compositor->wl_display);
+}
+
+static int
+replay_timer_func(void *data)
+{
+	struct evdev_replay *replay = data;
+	struct input_event *events = replay->events.data;
+	unsigned int *event_devices = replay->event_devices.data;
+	struct replay_device *devices = replay->devices.data;
+	struct evdev_device *device;
+	struct timespec now, t0, t1;
+	int64_t elapsed_us, due_us, ns;
+	unsigned int pos, end;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed_us = timespec_diff_ns(&now, &replay->start) / 1000;
+
+	while (replay->pos < replay->count) {
+		pos = replay->pos;
+
+		if (replay->speed > 0) {
+			due_us = (event_time_us(&events[pos]) -
+				  replay->first_us) / replay->speed;
+			if (due_us > elapsed_us) {
+				wl_event_source_timer_update(replay->timer,
+					(due_us - elapsed_us + 999) / 1000);
+				return 1;
+			}
+		}
+
+		/* Hand over one device frame at a time, the way
+		 * evdev_device_data() gets them from the kernel. */
+		end = pos;
+		while (end < replay->count &&
+		       event_devices[end] == event_devices[pos]) {
+			end++;
+			if (events[end - 1].type == EV_SYN &&
+			    events[end - 1].code == SYN_REPORT)
+				break;
+		}
+
+		device = devices[event_devices[pos]].device;
+		if (device) {
+			clock_gettime(CLOCK_MONOTONIC, &t0);
+			evdev_device_process_events(device, &events[pos],
+						    end - pos);
+			clock_gettime(CLOCK_MONOTONIC, &t1);
+
+			ns = timespec_diff_ns(&t1, &t0);
+			replay->stats.total_ns += ns;
+			if ((uint64_t) ns > replay->stats.max_frame_ns)
+				replay->stats.max_frame_ns = ns;
+			replay->stats.events += end - pos;
+			replay->stats.frames++;
+		}
+
+		replay->pos = end;
+	}
+
+	replay_finish(replay);
+
+	return 1;
+}
+
+struct evdev_replay *
+evdev_replay_create(struct weston_seat *seat, const char *path, int speed)
+{
+	struct weston_compositor *ec = seat->compositor;
+	struct evdev_replay *replay;
+	struct replay_device *d;
+	struct weston_output *output;
+	struct wl_event_loop *loop;
+
+	replay = zalloc(sizeof *replay);
+	if (replay == NULL)
+		return NULL;
+
+	replay->seat = seat;
+	replay->speed = speed;
+	wl_array_init(&replay->devices);
+	wl_array_init(&replay->events);
+	wl_array_init(&replay->event_devices);
+
+	if (replay_load(replay, path) < 0)
+		goto err;
+
+	wl_array_for_each(d, &replay->devices) {
+		d->device = evdev_device_create_replay(seat, d->name,
+						       &d->info);
+		if (d->device == EVDEV_UNHANDLED_DEVICE) {
+			weston_log("replay: skipping events of %s\n",
+				   d->name);
+			d->device = NULL;
+			continue;
+		}
+		if (d->device == NULL) {
+			weston_log("replay: failed to create device %s\n",
+				   d->name);
+			goto err;
+		}
+
+		if (!wl_list_empty(&ec->output_list)) {
+			output = container_of(ec->output_list.next,
+					      struct weston_output, link);
+			evdev_device_set_output(d->device, output);
+		}
+	}
+
+	if (replay->count > 0)
+		replay->first_us =
+			event_time_us((struct input_event *)
+				      replay->events.data);
+
+	loop = wl_display_get_event_loop(ec->wl_display);
+	replay->timer = wl_event_loop_add_timer(loop, replay_timer_func,
+						replay);
+	if (replay->timer == NULL)
+		goto err;
+
+	clock_gettime(CLOCK_MONOTONIC, &replay->start);
+	wl_event_source_timer_update(replay->timer, 1);
+
+	weston_log("replaying %u input events from %s\n",
+		   replay->count, path);
+
+	return replay;
+
+err:
+	evdev_replay_destroy(replay);
+	return NULL;
+}
+
+void
+evdev_replay_destroy(struct evdev_replay *replay)
+{
+	struct replay_device *d;
+
+	if (replay->timer)
+		wl_event_source_remove(replay->timer);
+
+	wl_array_for_each(d, &replay->devices) {
+		if (d->device)
+			evdev_device_destroy(d->device);
+		free(d->name);
+	}
+
+	wl_array_release(&replay->devices);
+	wl_array_release(&replay->events);
+	wl_array_release(&replay->event_devices);
+	free(replay);
+}
@@ -158,18 +158,14 @@ struct touchpad_dispatch {
 };
 
 static enum touchpad_model
-get_touchpad_model(struct evdev_device *device)
+get_touchpad_model(const struct input_id *id)
 {
-	struct input_id id;
 	unsigned int i;
 
-	if (ioctl(device->fd, EVIOCGID, &id) < 0)
-		return TOUCHPAD_MODEL_UNKNOWN;
-
 	for (i = 0; i < ARRAY_LENGTH(touchpad_spec_table); i++)
-		if (touchpad_spec_table[i].vendor == id.vendor &&
+		if (touchpad_spec_table[i].vendor == id->vendor &&
 		    (!touchpad_spec_table[i].product ||
-		     touchpad_spec_table[i].product == id.product))
+		     touchpad_spec_table[i].product == id->product))
 			return touchpad_spec_table[i].model;
 
 	return TOUCHPAD_MODEL_UNKNOWN;
@@ -701,15 +697,12 @@ touchpad_parse_config(struct touchpad_dispatch *touchpad, double diagonal)
 
 static int
 touchpad_init(struct touchpad_dispatch *touchpad,
-	      struct evdev_device *device)
+	      struct evdev_device *device,
+	      const struct evdev_device_info *info)
 {
 	struct weston_motion_filter *accel;
 	struct wl_event_loop *loop;
 
-	unsigned long prop_bits[INPUT_PROP_MAX];
-	struct input_absinfo absinfo;
-	unsigned long abs_bits[NBITS(ABS_MAX)];
-
 	bool has_buttonpad;
 
 	double width;
@@ -720,18 +713,15 @@ touchpad_init(struct touchpad_dispatch *touchpad,
 	touchpad->device = device;
 
 	/* Detect model */
-	touchpad->model = get_touchpad_model(device);
+	touchpad->model = get_touchpad_model(&info->id);
 
-	ioctl(device->fd, EVIOCGPROP(sizeof(prop_bits)), prop_bits);
-	has_buttonpad = TEST_BIT(prop_bits, INPUT_PROP_BUTTONPAD);
+	has_buttonpad = TEST_BIT(info->prop_bits, INPUT_PROP_BUTTONPAD);
 
 	/* Configure pressure */
-	ioctl(device->fd, EVIOCGBIT(EV_ABS, sizeof(abs_bits)), abs_bits);
-	if (TEST_BIT(abs_bits, ABS_PRESSURE)) {
-		ioctl(device->fd, EVIOCGABS(ABS_PRESSURE), &absinfo);
+	if (TEST_BIT(info->abs_bits, ABS_PRESSURE)) {
 		configure_touchpad_pressure(touchpad,
-					    absinfo.minimum,
-					    absinfo.maximum);
+					    info->absinfo[ABS_PRESSURE].minimum,
+					    info->absinfo[ABS_PRESSURE].maximum);
 	}
 
 	/* Configure acceleration factor */
@@ -783,7 +773,8 @@ touchpad_init(struct touchpad_dispatch *touchpad,
 }
 
 struct evdev_dispatch *
-evdev_touchpad_create(struct evdev_device *device)
+evdev_touchpad_create(struct evdev_device *device,
+		      const struct evdev_device_info *info)
 {
 	struct touchpad_dispatch *touchpad;
 
@@ -791,7 +782,7 @@ evdev_touchpad_create(struct evdev_device *device)
 	if (touchpad == NULL)
 		return NULL;
 
-	if (touchpad_init(touchpad, device) != 0) {
+	if (touchpad_init(touchpad, device, info) != 0) {
 		free(touchpad);
 		return NULL;
 	}
@@ -404,9 +404,9 @@ fallback_dispatch_create(void)
 	return dispatch;
 }
 
-static void
-evdev_process_events(struct evdev_device *device,
-		     struct input_event *ev, int count)
+void
+evdev_device_process_events(struct evdev_device *device,
+			    struct input_event *ev, int count)
 {
 	struct evdev_dispatch *dispatch = device->dispatch;
 	struct input_event *e, *end;
@@ -455,21 +455,48 @@ evdev_device_data(int fd, uint32_t mask, void *data)
 			return 1;
 		}
 
-		evdev_process_events(device, ev, len / sizeof ev[0]);
+		evdev_record_events(device, ev, len / sizeof ev[0]);
+		evdev_device_process_events(device, ev, len / sizeof ev[0]);
 
 	} while (len > 0);
 
 	return 1;
 }
 
+static void
+evdev_device_info_query(int fd, struct evdev_device_info *info)
+{
+	unsigned int i;
+
+	memset(info, 0, sizeof *info);
+
+	ioctl(fd, EVIOCGID, &info->id);
+	ioctl(fd, EVIOCGPROP(sizeof(info->prop_bits)), info->prop_bits);
+	ioctl(fd, EVIOCGBIT(0, sizeof(info->ev_bits)), info->ev_bits);
+	if (TEST_BIT(info->ev_bits, EV_ABS)) {
+		ioctl(fd, EVIOCGBIT(EV_ABS, sizeof(info->abs_bits)),
+		      info->abs_bits);
+		for (i = 0; i < ABS_CNT; i++)
+			if (TEST_BIT(info->abs_bits, i))
+				ioctl(fd, EVIOCGABS(i), &info->absinfo[i]);
+	}
+	if (TEST_BIT(info->ev_bits, EV_REL))
+		ioctl(fd, EVIOCGBIT(EV_REL, sizeof(info->rel_bits)),
+		      info->rel_bits);
+	if (TEST_BIT(info->ev_bits, EV_KEY))
+		ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(info->key_bits)),
+		      info->key_bits);
+}
+
 static int
-evdev_configure_device(struct evdev_device *device)
+evdev_configure_device(struct evdev_device *device,
+		       const struct evdev_device_info *info)
 {
-	struct input_absinfo absinfo;
-	unsigned long ev_bits[NBITS(EV_MAX)];
-	unsigned long abs_bits[NBITS(ABS_MAX)];
-	unsigned long rel_bits[NBITS(REL_MAX)];
-	unsigned long key_bits[NBITS(KEY_MAX)];
+	const unsigned long *ev_bits = info->ev_bits;
+	const unsigned long *abs_bits = info->abs_bits;
+	const unsigned long *rel_bits = info->rel_bits;
+	const unsigned long *key_bits = info->key_bits;
+	const struct input_absinfo *absinfo = info->absinfo;
 	int has_abs, has_rel, has_mt;
 	int has_button, has_keyboard, has_touch;
 	unsigned int i;
@@ -481,21 +508,15 @@ evdev_configure_device(struct evdev_device *device)
 	has_keyboard = 0;
 	has_touch = 0;
 
-	ioctl(device->fd, EVIOCGBIT(0, sizeof(ev_bits)), ev_bits);
 	if (TEST_BIT(ev_bits, EV_ABS)) {
-		ioctl(device->fd, EVIOCGBIT(EV_ABS, sizeof(abs_bits)),
-		      abs_bits);
-
 		if (TEST_BIT(abs_bits, ABS_X)) {
-			ioctl(device->fd, EVIOCGABS(ABS_X), &absinfo);
-			device->abs.min_x = absinfo.minimum;
-			device->abs.max_x = absinfo.maximum;
+			device->abs.min_x = absinfo[ABS_X].minimum;
+			device->abs.max_x = absinfo[ABS_X].maximum;
 			has_abs = 1;
 		}
 		if (TEST_BIT(abs_bits, ABS_Y)) {
-			ioctl(device->fd, EVIOCGABS(ABS_Y), &absinfo);
-			device->abs.min_y = absinfo.minimum;
-			device->abs.max_y = absinfo.maximum;
+			device->abs.min_y = absinfo[ABS_Y].minimum;
+			device->abs.max_y = absinfo[ABS_Y].maximum;
 			has_abs = 1;
 		}
                 /* We only handle the slotted Protocol B in weston.
@@ -503,14 +524,10 @@ evdev_configure_device(struct evdev_device *device)
                    require mtdev for conversion. */
 		if (TEST_BIT(abs_bits, ABS_MT_POSITION_X) &&
 		    TEST_BIT(abs_bits, ABS_MT_POSITION_Y)) {
-			ioctl(device->fd, EVIOCGABS(ABS_MT_POSITION_X),
-			      &absinfo);
-			device->abs.min_x = absinfo.minimum;
-			device->abs.max_x = absinfo.maximum;
-			ioctl(device->fd, EVIOCGABS(ABS_MT_POSITION_Y),
-			      &absinfo);
-			device->abs.min_y = absinfo.minimum;
-			device->abs.max_y = absinfo.maximum;
+			device->abs.min_x = absinfo[ABS_MT_POSITION_X].minimum;
+			device->abs.max_x = absinfo[ABS_MT_POSITION_X].maximum;
+			device->abs.min_y = absinfo[ABS_MT_POSITION_Y].minimum;
+			device->abs.max_y = absinfo[ABS_MT_POSITION_Y].maximum;
 			device->is_mt = 1;
 			has_touch = 1;
 			has_mt = 1;
@@ -524,25 +541,19 @@ evdev_configure_device(struct evdev_device *device)
 				}
 				device->mt.slot = device->mtdev->caps.slot.value;
 			} else {
-				ioctl(device->fd, EVIOCGABS(ABS_MT_SLOT),
-				      &absinfo);
-				device->mt.slot = absinfo.value;
+				device->mt.slot = absinfo[ABS_MT_SLOT].value;
 			}
 		}
 	}
 	if (TEST_BIT(ev_bits, EV_REL)) {
-		ioctl(device->fd, EVIOCGBIT(EV_REL, sizeof(rel_bits)),
-		      rel_bits);
 		if (TEST_BIT(rel_bits, REL_X) || TEST_BIT(rel_bits, REL_Y))
 			has_rel = 1;
 	}
 	if (TEST_BIT(ev_bits, EV_KEY)) {
-		ioctl(device->fd, EVIOCGBIT(EV_KEY, sizeof(key_bits)),
-		      key_bits);
 		if (TEST_BIT(key_bits, BTN_TOOL_FINGER) &&
 		    !TEST_BIT(key_bits, BTN_TOOL_PEN) &&
 		    (has_abs || has_mt)) {
-			device->dispatch = evdev_touchpad_create(device);
+			device->dispatch = evdev_touchpad_create(device, info);
 			weston_log("input device %s, %s is a touchpad\n",
 				   device->devname, device->devnode);
 		}
@@ -625,18 +636,15 @@ evdev_device_set_output(struct evdev_device *device,
 		      &device->output_destroy_listener);
 }
 
-struct evdev_device *
-evdev_device_create(struct weston_seat *seat, const char *path, int device_fd)
+static struct evdev_device *
+evdev_device_alloc(struct weston_seat *seat, const char *path, int device_fd)
 {
 	struct evdev_device *device;
-	struct weston_compositor *ec;
-	char devname[256] = "unknown";
 
 	device = zalloc(sizeof *device);
 	if (device == NULL)
 		return NULL;
 
-	ec = seat->compositor;
 	device->seat = seat;
 	device->seat_caps = 0;
 	device->is_mt = 0;
@@ -647,25 +655,61 @@ evdev_device_create(struct weston_seat *seat, const char *path, int device_fd)
 	device->rel.dy = 0;
 	device->dispatch = NULL;
 	device->fd = device_fd;
+	device->record_id = -1;
 	device->pending_event = EVDEV_NONE;
 	wl_list_init(&device->link);
 
+	return device;
+}
+
+/* Returns 0 on success, 1 if the device has nothing we handle and -1 on
+ * error.  The caller destroys the device in the last two cases. */
+static int
+evdev_device_setup(struct evdev_device *device,
+		   const struct evdev_device_info *info)
+{
+	if (evdev_configure_device(device, info) == -1)
+		return -1;
+
+	if (device->seat_caps == 0)
+		return 1;
+
+	/* If the dispatch was not set up use the fallback. */
+	if (device->dispatch == NULL)
+		device->dispatch = fallback_dispatch_create();
+	if (device->dispatch == NULL)
+		return -1;
+
+	return 0;
+}
+
+struct evdev_device *
+evdev_device_create(struct weston_seat *seat, const char *path, int device_fd)
+{
+	struct evdev_device *device;
+	struct evdev_device_info info;
+	struct weston_compositor *ec;
+	char devname[256] = "unknown";
+	int ret;
+
+	device = evdev_device_alloc(seat, path, device_fd);
+	if (device == NULL)
+		return NULL;
+
+	ec = seat->compositor;
+
 	ioctl(device->fd, EVIOCGNAME(sizeof(devname)), devname);
 	devname[sizeof(devname) - 1] = '\0';
 	device->devname = strdup(devname);
 
-	if (evdev_configure_device(device) == -1)
-		goto err;
+	evdev_device_info_query(device->fd, &info);
 
-	if (device->seat_caps == 0) {
+	ret = evdev_device_setup(device, &info);
+	if (ret == 1) {
 		evdev_device_destroy(device);
 		return EVDEV_UNHANDLED_DEVICE;
 	}
-
-	/* If the dispatch was not set up use the fallback. */
-	if (device->dispatch == NULL)
-		device->dispatch = fallback_dispatch_create();
-	if (device->dispatch == NULL)
+	if (ret < 0)
 		goto err;
 
 	device->source = wl_event_loop_add_fd(ec->input_loop, device->fd,
@@ -674,6 +718,8 @@ evdev_device_create(struct weston_seat *seat, const char *path, int device_fd)
 	if (device->source == NULL)
 		goto err;
 
+	evdev_record_device(device, &info);
+
 	return device;
 
 err:
@@ -681,6 +727,34 @@ err:
 	return NULL;
 }
 
+/* Create a device without a file descriptor behind it.  Events are fed in
+ * by the caller through evdev_device_process_events(). */
+struct evdev_device *
+evdev_device_create_replay(struct weston_seat *seat, const char *name,
+			   const struct evdev_device_info *info)
+{
+	struct evdev_device *device;
+	int ret;
+
+	device = evdev_device_alloc(seat, "replay", -1);
+	if (device == NULL)
+		return NULL;
+
+	device->devname = strdup(name);
+
+	ret = evdev_device_setup(device, info);
+	if (ret == 1) {
+		evdev_device_destroy(device);
+		return EVDEV_UNHANDLED_DEVICE;
+	}
+	if (ret < 0) {
+		evdev_device_destroy(device);
+		return NULL;
+	}
+
+	return device;
+}
+
 void
 evdev_device_destroy(struct evdev_device *device)
 {
@@ -704,7 +778,8 @@ evdev_device_destroy(struct evdev_device *device)
 	wl_list_remove(&device->link);
 	if (device->mtdev)
 		mtdev_close_delete(device->mtdev);
-	close(device->fd);
+	if (device->fd >= 0)
+		close(device->fd);
 	free(device->devname);
 	free(device->devnode);
 	free(device->output_name);
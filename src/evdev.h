@@ -58,6 +58,7 @@ struct evdev_device {
 	char *devname;
 	char *output_name;
 	int fd;
+	int record_id;
 	struct {
 		int min_x, max_x, min_y, max_y;
 		uint32_t seat_slot;
@@ -96,6 +97,19 @@ struct evdev_device {
 #define TEST_BIT(array, bit)    ((array[LONG(bit)] >> OFF(bit)) & 1)
 /* end copied */
 
+/* Everything evdev_configure_device() and the touchpad driver need to know
+ * about a device, either queried from the kernel or read back from an
+ * input recording. */
+struct evdev_device_info {
+	struct input_id id;
+	unsigned long prop_bits[NBITS(INPUT_PROP_MAX)];
+	unsigned long ev_bits[NBITS(EV_MAX)];
+	unsigned long abs_bits[NBITS(ABS_MAX)];
+	unsigned long rel_bits[NBITS(REL_MAX)];
+	unsigned long key_bits[NBITS(KEY_MAX)];
+	struct input_absinfo absinfo[ABS_CNT];
+};
+
 #define EVDEV_UNHANDLED_DEVICE ((struct evdev_device *) 1)
 
 struct evdev_dispatch;
@@ -116,7 +130,8 @@ struct evdev_dispatch {
 };
 
 struct evdev_dispatch *
-evdev_touchpad_create(struct evdev_device *device);
+evdev_touchpad_create(struct evdev_device *device,
+		      const struct evdev_device_info *info);
 
 void
 evdev_led_update(struct evdev_device *device, enum weston_led leds);
@@ -124,6 +139,14 @@ evdev_led_update(struct evdev_device *device, enum weston_led leds);
 struct evdev_device *
 evdev_device_create(struct weston_seat *seat, const char *path, int device_fd);
 
+struct evdev_device *
+evdev_device_create_replay(struct weston_seat *seat, const char *name,
+			   const struct evdev_device_info *info);
+
+void
+evdev_device_process_events(struct evdev_device *device,
+			    struct input_event *ev, int count);
+
 void
 evdev_device_set_output(struct evdev_device *device,
 			struct weston_output *output);
@@ -134,4 +157,20 @@ void
 evdev_notify_keyboard_focus(struct weston_seat *seat,
 			    struct wl_list *evdev_devices);
 
+void
+evdev_record_device(struct evdev_device *device,
+		    const struct evdev_device_info *info);
+
+void
+evdev_record_events(struct evdev_device *device,
+		    struct input_event *ev, int count);
+
+struct evdev_replay;
+
+struct evdev_replay *
+evdev_replay_create(struct weston_seat *seat, const char *path, int speed);
+
+void
+evdev_replay_destroy(struct evdev_replay *replay);
+
 #endif /* EVDEV_H */
@@ -26,10 +26,16 @@
 #include <GLES2/gl2ext.h>
 
 #include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
 #include <ctype.h>
 #include <float.h>
 #include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <linux/input.h>
 
 #include "gl-renderer.h"
@@ -38,6 +44,11 @@
 #include <EGL/eglext.h>
 #include "weston-egl-ext.h"
 
+#if defined(GL_NV_pixel_buffer_object) && defined(GL_EXT_map_buffer_range) && \
+    defined(GL_OES_mapbuffer)
+#define GL_RENDERER_PBO_UPLOAD 1
+#endif
+
 struct gl_shader {
 	GLuint program;
 	GLuint vertex_shader, fragment_shader;
@@ -46,6 +57,39 @@ struct gl_shader {
 	GLint alpha_uniform;
 	GLint color_uniform;
 	const char *vertex_source, *fragment_source;
+
+	/* uniform values last set, valid while uniform_serial matches
+	 * gl_renderer::batch_serial */
+	uint32_t uniform_serial;
+	GLfloat alpha;
+	GLfloat color[4];
+};
+
+/* A run of triangles in gl_renderer::vertices sharing all GL state.
+ * draw_view() records these and batch_flush() submits them in order,
+ * after merging neighbours with identical state.
+ */
+struct gl_draw {
+	struct gl_shader *shader;
+	GLenum target;
+	GLuint textures[3];
+	int num_textures;
+	GLint filter;
+	int blend;
+	GLfloat alpha;
+	GLfloat color[4];
+	int first, count;	/* in vertices */
+};
+
+struct gl_batch_stats {
+	unsigned int frames;
+	unsigned int polygons;	/* draw calls without batching */
+	unsigned int draw_calls;
+	unsigned int programs;
+	unsigned int textures;
+	unsigned int uniforms;
+	unsigned int blend;
+	unsigned int vertices;
 };
 
 #define BUFFER_DAMAGE_COUNT 2
@@ -116,15 +160,22 @@ struct gl_renderer {
 	struct weston_renderer base;
 	int fragment_shader_debug;
 	int fan_debug;
+	int batch_debug;
 	struct weston_binding *fragment_binding;
 	struct weston_binding *fan_binding;
+	struct weston_binding *batch_binding;
 
 	EGLDisplay egl_display;
 	EGLContext egl_context;
 	EGLConfig egl_config;
 
+	/* triangles of the frame: x, y, s, t per vertex */
 	struct wl_array vertices;
-	struct wl_array vtxcnt;
+	struct wl_array draws;
+	struct wl_array clip_scratch;
+	GLuint vbo;
+	uint32_t batch_serial;
+	struct gl_batch_stats stats;
 
 	PFNGLEGLIMAGETARGETTEXTURE2DOESPROC image_target_texture_2d;
 	PFNEGLCREATEIMAGEKHRPROC create_image;
@@ -136,6 +187,18 @@ struct gl_renderer {
 
 	int has_unpack_subimage;
 
+#ifdef GL_RENDERER_PBO_UPLOAD
+	/* Ring of staging memory for wl_shm texture uploads. Damage is
+	 * copied in at upload_offset and the GL transfers it to the
+	 * texture asynchronously. */
+	int has_pbo_upload;
+	PFNGLMAPBUFFERRANGEEXTPROC map_buffer_range;
+	PFNGLUNMAPBUFFEROESPROC unmap_buffer;
+	GLuint upload_pbo;
+	GLsizeiptr upload_size;
+	GLintptr upload_offset;
+#endif
+
 	PFNEGLBINDWAYLANDDISPLAYWL bind_display;
 	PFNEGLUNBINDWAYLANDDISPLAYWL unbind_display;
 	PFNEGLQUERYWAYLANDBUFFERWL query_buffer;
@@ -143,6 +206,16 @@ struct gl_renderer {
 
 	int has_egl_image_external;
 
+#ifdef GL_OES_get_program_binary
+	/* Linked programs are kept in program_cache_dir, named after a
+	 * hash of the GL driver strings and the shader sources. */
+	int has_program_binary;
+	PFNGLGETPROGRAMBINARYOESPROC get_program_binary;
+	PFNGLPROGRAMBINARYOESPROC program_binary;
+	char *program_cache_dir;
+	uint64_t program_cache_seed;
+#endif
+
 	int has_egl_buffer_age;
 
 	int has_configless_context;
@@ -225,69 +298,40 @@ gl_renderer_print_egl_error_state(void)
 
 /*
  * Compute the boundary vertices of the intersection of the global coordinate
- * aligned rectangle 'rect', and an arbitrary quadrilateral produced from
- * 'surf_rect' when transformed from surface coordinates into global coordinates.
- * The vertices are written to 'ex' and 'ey', and the return value is the
- * number of vertices. Vertices are produced in clockwise winding order.
+ * aligned rectangle 'rect', and an arbitrary quadrilateral 'surf', a surface
+ * rectangle already transformed into global coordinates, with bounding box
+ * 'bbox'. The vertices are written to 'ex' and 'ey', and the return value is
+ * the number of vertices. Vertices are produced in clockwise winding order.
  * Guarantees to produce either zero vertices, or 3-8 vertices with non-zero
  * polygon area.
  */
 static int
-calculate_edges(struct weston_view *ev, pixman_box32_t *rect,
-		pixman_box32_t *surf_rect, GLfloat *ex, GLfloat *ey)
+calculate_edges(const struct clip_box *rect, const struct polygon8 *surf,
+		const struct clip_box *bbox, GLfloat *ex, GLfloat *ey)
 {
-
 	struct clip_context ctx;
-	int i, n;
-	GLfloat min_x, max_x, min_y, max_y;
-	struct polygon8 surf = {
-		{ surf_rect->x1, surf_rect->x2, surf_rect->x2, surf_rect->x1 },
-		{ surf_rect->y1, surf_rect->y1, surf_rect->y2, surf_rect->y2 },
-		4
-	};
-
-	ctx.clip.x1 = rect->x1;
-	ctx.clip.y1 = rect->y1;
-	ctx.clip.x2 = rect->x2;
-	ctx.clip.y2 = rect->y2;
-
-	/* transform surface to screen space: */
-	for (i = 0; i < surf.n; i++)
-		weston_view_to_global_float(ev, surf.x[i], surf.y[i],
-					    &surf.x[i], &surf.y[i]);
-
-	/* find bounding box: */
-	min_x = max_x = surf.x[0];
-	min_y = max_y = surf.y[0];
-
-	for (i = 1; i < surf.n; i++) {
-		min_x = min(min_x, surf.x[i]);
-		max_x = max(max_x, surf.x[i]);
-		min_y = min(min_y, surf.y[i]);
-		max_y = max(max_y, surf.y[i]);
-	}
+	struct polygon8 polygon = *surf;
+	int n;
 
 	/* First, simple bounding box check to discard early transformed
 	 * surface rects that do not intersect with the clip region:
 	 */
-	if ((min_x >= ctx.clip.x2) || (max_x <= ctx.clip.x1) ||
-	    (min_y >= ctx.clip.y2) || (max_y <= ctx.clip.y1))
+	if ((bbox->x1 >= rect->x2) || (bbox->x2 <= rect->x1) ||
+	    (bbox->y1 >= rect->y2) || (bbox->y2 <= rect->y1))
 		return 0;
 
-	/* Simple case, bounding box edges are parallel to surface edges,
-	 * there will be only four edges.  We just need to clip the surface
-	 * vertices to the clip rect bounds:
-	 */
-	if (!ev->transform.enabled)
-		return clip_simple(&ctx, &surf, ex, ey);
+	ctx.clip.x1 = rect->x1;
+	ctx.clip.y1 = rect->y1;
+	ctx.clip.x2 = rect->x2;
+	ctx.clip.y2 = rect->y2;
 
-	/* Transformed case: use a general polygon clipping algorithm to
+	/* Use a general polygon clipping algorithm to
 	 * clip the surface rectangle with each side of 'rect'.
 	 * The algorithm is Sutherland-Hodgman, as explained in
 	 * http://www.codeguru.com/cpp/misc/misc/graphics/article.php/c8965/Polygon-Clipping.htm
 	 * but without looking at any of that code.
 	 */
-	n = clip_transformed(&ctx, &surf, ex, ey);
+	n = clip_transformed(&ctx, &polygon, ex, ey);
 
 	if (n < 3)
 		return 0;
@@ -295,42 +339,142 @@ calculate_edges(struct weston_view *ev, pixman_box32_t *rect,
 	return n;
 }
 
+/* Append the convex polygon ex, ey as a list of triangles with texture
+ * coordinates, returns the new end of the vertex data. */
+static GLfloat *
+emit_polygon(struct weston_view *ev, GLfloat *v,
+	     const GLfloat *ex, const GLfloat *ey, int n)
+{
+	struct gl_surface_state *gs = get_surface_state(ev->surface);
+	GLfloat inv_width = 1.0 / gs->pitch;
+	GLfloat inv_height = 1.0 / gs->height;
+	GLfloat fan[8][4];
+	GLfloat sx, sy, bx, by;
+	int k;
+
+	for (k = 0; k < n; k++) {
+		weston_view_from_global_float(ev, ex[k], ey[k], &sx, &sy);
+		/* position: */
+		fan[k][0] = ex[k];
+		fan[k][1] = ey[k];
+		/* texcoord: */
+		weston_surface_to_buffer_float(ev->surface, sx, sy, &bx, &by);
+		fan[k][2] = bx * inv_width;
+		if (gs->y_inverted)
+			fan[k][3] = by * inv_height;
+		else
+			fan[k][3] = (gs->height - by) * inv_height;
+	}
+
+	/* The first vertex of the fan can be chosen arbitrarily, since the
+	 * area is guaranteed to be convex. Emit it as a list of triangles,
+	 * so that all polygons of a frame can go in one draw call. */
+	for (k = 1; k < n - 1; k++) {
+		memcpy(v, fan[0], sizeof fan[0]);
+		memcpy(v + 4, fan[k], sizeof fan[k]);
+		memcpy(v + 8, fan[k + 1], sizeof fan[k + 1]);
+		v += 12;
+	}
+
+	return v;
+}
+
 static int
 texture_region(struct weston_view *ev, pixman_region32_t *region,
 		pixman_region32_t *surf_region)
 {
-	struct gl_surface_state *gs = get_surface_state(ev->surface);
 	struct weston_compositor *ec = ev->surface->compositor;
 	struct gl_renderer *gr = get_renderer(ec);
-	GLfloat *v, inv_width, inv_height;
-	unsigned int *vtxcnt, nvtx = 0;
+	struct clip_box *clips, *boxes, *out;
+	GLfloat *v, *start;
 	pixman_box32_t *rects, *surf_rects;
-	int i, j, k, nrects, nsurf;
+	int i, j, k, n, nrects, nsurf;
+	size_t reserved;
 
 	rects = pixman_region32_rectangles(region, &nrects);
 	surf_rects = pixman_region32_rectangles(surf_region, &nsurf);
 
 	/* worst case we can have 8 vertices per rect (ie. clipped into
-	 * an octagon):
+	 * an octagon), which makes 6 triangles:
 	 */
-	v = wl_array_add(&gr->vertices, nrects * nsurf * 8 * 4 * sizeof *v);
-	vtxcnt = wl_array_add(&gr->vtxcnt, nrects * nsurf * sizeof *vtxcnt);
+	reserved = nrects * nsurf * 6 * 3 * 4 * sizeof *v;
+	start = v = wl_array_add(&gr->vertices, reserved);
+	if (!v)
+		return 0;
 
-	inv_width = 1.0 / gs->pitch;
-        inv_height = 1.0 / gs->height;
+	gr->clip_scratch.size = 0;
+	clips = wl_array_add(&gr->clip_scratch,
+			     (nrects + nsurf + nrects * nsurf) * sizeof *clips);
+	if (!clips)
+		goto out;
+	boxes = clips + nrects;
+	out = boxes + nsurf;
 
 	for (i = 0; i < nrects; i++) {
-		pixman_box32_t *rect = &rects[i];
+		clips[i].x1 = rects[i].x1;
+		clips[i].y1 = rects[i].y1;
+		clips[i].x2 = rects[i].x2;
+		clips[i].y2 = rects[i].y2;
+	}
+
+	if (!ev->transform.enabled) {
+		/* The view is only translated, so each intersection of a
+		 * surface rect with a clip rect is a rectangle, and no
+		 * polygon clipping is needed at all. */
 		for (j = 0; j < nsurf; j++) {
-			pixman_box32_t *surf_rect = &surf_rects[j];
-			GLfloat sx, sy, bx, by;
+			weston_view_to_global_float(ev,
+						    surf_rects[j].x1,
+						    surf_rects[j].y1,
+						    &boxes[j].x1, &boxes[j].y1);
+			weston_view_to_global_float(ev,
+						    surf_rects[j].x2,
+						    surf_rects[j].y2,
+						    &boxes[j].x2, &boxes[j].y2);
+		}
+
+		n = clip_boxes(boxes, nsurf, clips, nrects, out);
+		for (i = 0; i < n; i++) {
+			GLfloat ex[4] = { out[i].x1, out[i].x2,
+					  out[i].x2, out[i].x1 };
+			GLfloat ey[4] = { out[i].y1, out[i].y1,
+					  out[i].y2, out[i].y2 };
+
+			v = emit_polygon(ev, v, ex, ey, 4);
+		}
+		gr->stats.polygons += n;
+
+		goto out;
+	}
+
+	for (j = 0; j < nsurf; j++) {
+		pixman_box32_t *surf_rect = &surf_rects[j];
+		struct polygon8 surf = {
+			{ surf_rect->x1, surf_rect->x2, surf_rect->x2, surf_rect->x1 },
+			{ surf_rect->y1, surf_rect->y1, surf_rect->y2, surf_rect->y2 },
+			4
+		};
+		struct clip_box *bbox = &boxes[j];
+
+		/* transform surface to screen space, once for all clip
+		 * rects, and find the bounding box: */
+		for (k = 0; k < surf.n; k++)
+			weston_view_to_global_float(ev, surf.x[k], surf.y[k],
+						    &surf.x[k], &surf.y[k]);
+
+		bbox->x1 = bbox->x2 = surf.x[0];
+		bbox->y1 = bbox->y2 = surf.y[0];
+		for (k = 1; k < surf.n; k++) {
+			bbox->x1 = min(bbox->x1, surf.x[k]);
+			bbox->x2 = max(bbox->x2, surf.x[k]);
+			bbox->y1 = min(bbox->y1, surf.y[k]);
+			bbox->y2 = max(bbox->y2, surf.y[k]);
+		}
+
+		for (i = 0; i < nrects; i++) {
 			GLfloat ex[8], ey[8];          /* edge points in screen space */
-			int n;
 
 			/* The transformed surface, after clipping to the clip region,
 			 * can have as many as eight sides, emitted as a triangle-fan.
-			 * The first vertex in the triangle fan can be chosen arbitrarily,
-			 * since the area is guaranteed to be convex.
 			 *
 			 * If a corner of the transformed surface falls outside of the
 			 * clip region, instead of emitting one vertex for the corner
@@ -341,119 +485,95 @@ texture_region(struct weston_view *ev, pixman_region32_t *region,
 			 * form the intersection of the clip rect and the transformed
 			 * surface.
 			 */
-			n = calculate_edges(ev, rect, surf_rect, ex, ey);
+			n = calculate_edges(&clips[i], &surf, bbox, ex, ey);
 			if (n < 3)
 				continue;
 
-			/* emit edge points: */
-			for (k = 0; k < n; k++) {
-				weston_view_from_global_float(ev, ex[k], ey[k],
-							      &sx, &sy);
-				/* position: */
-				*(v++) = ex[k];
-				*(v++) = ey[k];
-				/* texcoord: */
-				weston_surface_to_buffer_float(ev->surface,
-							       sx, sy,
-							       &bx, &by);
-				*(v++) = bx * inv_width;
-				if (gs->y_inverted) {
-					*(v++) = by * inv_height;
-				} else {
-					*(v++) = (gs->height - by) * inv_height;
-				}
-			}
-
-			vtxcnt[nvtx++] = n;
+			v = emit_polygon(ev, v, ex, ey, n);
+			gr->stats.polygons++;
 		}
 	}
 
-	return nvtx;
+out:
+	gr->vertices.size -= reserved - (v - start) * sizeof *v;
+
+	return (v - start) / 4;
 }
 
-static void
-triangle_fan_debug(struct weston_view *view, int first, int count)
+static int
+draw_state_equal(const struct gl_draw *a, const struct gl_draw *b)
 {
-	struct weston_compositor *compositor = view->surface->compositor;
-	struct gl_renderer *gr = get_renderer(compositor);
 	int i;
-	GLushort *buffer;
-	GLushort *index;
-	int nelems;
-	static int color_idx = 0;
-	static const GLfloat color[][4] = {
-			{ 1.0, 0.0, 0.0, 1.0 },
-			{ 0.0, 1.0, 0.0, 1.0 },
-			{ 0.0, 0.0, 1.0, 1.0 },
-			{ 1.0, 1.0, 1.0, 1.0 },
-	};
 
-	nelems = (count - 1 + count - 2) * 2;
+	if (a->shader != b->shader ||
+	    a->target != b->target ||
+	    a->num_textures != b->num_textures ||
+	    a->filter != b->filter ||
+	    a->blend != b->blend ||
+	    a->alpha != b->alpha)
+		return 0;
 
-	buffer = malloc(sizeof(GLushort) * nelems);
-	index = buffer;
+	for (i = 0; i < a->num_textures; i++)
+		if (a->textures[i] != b->textures[i])
+			return 0;
 
-	for (i = 1; i < count; i++) {
-		*index++ = first;
-		*index++ = first + i;
-	}
+	if (a->shader->color_uniform != -1)
+		for (i = 0; i < 4; i++)
+			if (a->color[i] != b->color[i])
+				return 0;
 
-	for (i = 2; i < count; i++) {
-		*index++ = first + i - 1;
-		*index++ = first + i;
-	}
-
-	glUseProgram(gr->solid_shader.program);
-	glUniform4fv(gr->solid_shader.color_uniform, 1,
-			color[color_idx++ % ARRAY_LENGTH(color)]);
-	glDrawElements(GL_LINES, nelems, GL_UNSIGNED_SHORT, buffer);
-	glUseProgram(gr->current_shader->program);
-	free(buffer);
+	return 1;
 }
 
 static void
 repaint_region(struct weston_view *ev, pixman_region32_t *region,
-		pixman_region32_t *surf_region)
+	       pixman_region32_t *surf_region, struct gl_shader *shader,
+	       GLint filter, int blend)
 {
 	struct weston_compositor *ec = ev->surface->compositor;
 	struct gl_renderer *gr = get_renderer(ec);
-	GLfloat *v;
-	unsigned int *vtxcnt;
-	int i, first, nfans;
+	struct gl_surface_state *gs = get_surface_state(ev->surface);
+	struct gl_draw draw, *last = NULL;
+	int i, first, count;
 
 	/* The final region to be painted is the intersection of
 	 * 'region' and 'surf_region'. However, 'region' is in the global
 	 * coordinates, and 'surf_region' is in the surface-local
 	 * coordinates. texture_region() will iterate over all pairs of
 	 * rectangles from both regions, compute the intersection
-	 * polygon for each pair, and store it as a triangle fan if
-	 * it has a non-zero area (at least 3 vertices1, actually).
+	 * polygon for each pair, and store it as triangles if
+	 * it has a non-zero area (at least 3 vertices, actually).
 	 */
-	nfans = texture_region(ev, region, surf_region);
-
-	v = gr->vertices.data;
-	vtxcnt = gr->vtxcnt.data;
-
-	/* position: */
-	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof *v, &v[0]);
-	glEnableVertexAttribArray(0);
-
-	/* texcoord: */
-	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof *v, &v[2]);
-	glEnableVertexAttribArray(1);
+	first = gr->vertices.size / (4 * sizeof(GLfloat));
+	count = texture_region(ev, region, surf_region);
+	if (count == 0)
+		return;
 
-	for (i = 0, first = 0; i < nfans; i++) {
-		glDrawArrays(GL_TRIANGLE_FAN, first, vtxcnt[i]);
-		if (gr->fan_debug)
-			triangle_fan_debug(ev, first, vtxcnt[i]);
-		first += vtxcnt[i];
+	memset(&draw, 0, sizeof draw);
+	draw.shader = shader;
+	draw.target = gs->target;
+	draw.num_textures = gs->num_textures;
+	for (i = 0; i < gs->num_textures; i++)
+		draw.textures[i] = gs->textures[i];
+	draw.filter = filter;
+	draw.blend = blend;
+	draw.alpha = ev->alpha;
+	memcpy(draw.color, gs->color, sizeof draw.color);
+	draw.first = first;
+	draw.count = count;
+
+	if (gr->draws.size > 0)
+		last = (struct gl_draw *)
+			((char *) gr->draws.data + gr->draws.size) - 1;
+
+	if (last && !gr->fan_debug && draw_state_equal(last, &draw)) {
+		last->count += count;
+		return;
 	}
 
-	glDisableVertexAttribArray(1);
-	glDisableVertexAttribArray(0);
-
-	gr->vertices.size = 0;
-	gr->vtxcnt.size = 0;
+	last = wl_array_add(&gr->draws, sizeof draw);
+	if (last)
+		*last = draw;
 }
 
 static int
@@ -504,20 +624,35 @@ use_shader(struct gl_renderer *gr, struct gl_shader *shader)
 }
 
 static void
-shader_uniforms(struct gl_shader *shader,
-		struct weston_view *view,
+shader_uniforms(struct gl_renderer *gr, struct gl_draw *draw,
 		struct weston_output *output)
 {
+	struct gl_shader *shader = draw->shader;
 	int i;
-	struct gl_surface_state *gs = get_surface_state(view->surface);
 
-	glUniformMatrix4fv(shader->proj_uniform,
-			   1, GL_FALSE, output->matrix.d);
-	glUniform4fv(shader->color_uniform, 1, gs->color);
-	glUniform1f(shader->alpha_uniform, view->alpha);
+	if (shader->uniform_serial != gr->batch_serial) {
+		glUniformMatrix4fv(shader->proj_uniform,
+				   1, GL_FALSE, output->matrix.d);
+		for (i = 0; i < 3; i++)
+			glUniform1i(shader->tex_uniforms[i], i);
+		shader->uniform_serial = gr->batch_serial;
+		shader->alpha = -1.0;
+		shader->color[0] = -1.0;
+		gr->stats.uniforms++;
+	}
 
-	for (i = 0; i < gs->num_textures; i++)
-		glUniform1i(shader->tex_uniforms[i], i);
+	if (shader->alpha != draw->alpha) {
+		glUniform1f(shader->alpha_uniform, draw->alpha);
+		shader->alpha = draw->alpha;
+		gr->stats.uniforms++;
+	}
+
+	if (shader->color_uniform != -1 &&
+	    memcmp(shader->color, draw->color, sizeof draw->color) != 0) {
+		glUniform4fv(shader->color_uniform, 1, draw->color);
+		memcpy(shader->color, draw->color, sizeof draw->color);
+		gr->stats.uniforms++;
+	}
 }
 
 static void
@@ -527,12 +662,12 @@ draw_view(struct weston_view *ev, struct weston_output *output,
 	struct weston_compositor *ec = ev->surface->compositor;
 	struct gl_renderer *gr = get_renderer(ec);
 	struct gl_surface_state *gs = get_surface_state(ev->surface);
+	struct gl_shader *shader;
 	/* repaint bounding region in global coordinates: */
 	pixman_region32_t repaint;
 	/* non-opaque region in surface coordinates: */
 	pixman_region32_t surface_blend;
 	GLint filter;
-	int i;
 
 	/* In case of a runtime switch of renderers, we may not have received
 	 * an attach for this surface since the switch. In that case we don't
@@ -548,29 +683,12 @@ draw_view(struct weston_view *ev, struct weston_output *output,
 	if (!pixman_region32_not_empty(&repaint))
 		goto out;
 
-	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
-
-	if (gr->fan_debug) {
-		use_shader(gr, &gr->solid_shader);
-		shader_uniforms(&gr->solid_shader, ev, output);
-	}
-
-	use_shader(gr, gs->shader);
-	shader_uniforms(gs->shader, ev, output);
-
 	if (ev->transform.enabled || output->zoom.active ||
 	    output->current_scale != ev->surface->buffer_viewport.buffer.scale)
 		filter = GL_LINEAR;
 	else
 		filter = GL_NEAREST;
 
-	for (i = 0; i < gs->num_textures; i++) {
-		glActiveTexture(GL_TEXTURE0 + i);
-		glBindTexture(gs->target, gs->textures[i]);
-		glTexParameteri(gs->target, GL_TEXTURE_MIN_FILTER, filter);
-		glTexParameteri(gs->target, GL_TEXTURE_MAG_FILTER, filter);
-	}
-
 	/* blended region is whole surface minus opaque region: */
 	pixman_region32_init_rect(&surface_blend, 0, 0,
 				  ev->surface->width, ev->surface->height);
@@ -578,29 +696,23 @@ draw_view(struct weston_view *ev, struct weston_output *output,
 
 	/* XXX: Should we be using ev->transform.opaque here? */
 	if (pixman_region32_not_empty(&ev->surface->opaque)) {
-		if (gs->shader == &gr->texture_shader_rgba) {
+		shader = gs->shader;
+		if (shader == &gr->texture_shader_rgba) {
 			/* Special case for RGBA textures with possibly
 			 * bad data in alpha channel: use the shader
 			 * that forces texture alpha = 1.0.
 			 * Xwayland surfaces need this.
 			 */
-			use_shader(gr, &gr->texture_shader_rgbx);
-			shader_uniforms(&gr->texture_shader_rgbx, ev, output);
+			shader = &gr->texture_shader_rgbx;
 		}
 
-		if (ev->alpha < 1.0)
-			glEnable(GL_BLEND);
-		else
-			glDisable(GL_BLEND);
-
-		repaint_region(ev, &repaint, &ev->surface->opaque);
+		repaint_region(ev, &repaint, &ev->surface->opaque,
+			       shader, filter, ev->alpha < 1.0);
 	}
 
-	if (pixman_region32_not_empty(&surface_blend)) {
-		use_shader(gr, gs->shader);
-		glEnable(GL_BLEND);
-		repaint_region(ev, &repaint, &surface_blend);
-	}
+	if (pixman_region32_not_empty(&surface_blend))
+		repaint_region(ev, &repaint, &surface_blend,
+			       gs->shader, filter, 1);
 
 	pixman_region32_fini(&surface_blend);
 
@@ -608,15 +720,155 @@ out:
 	pixman_region32_fini(&repaint);
 }
 
+static void
+triangle_debug(struct gl_renderer *gr, struct weston_output *output,
+	       int first, int count)
+{
+	struct gl_shader *shader = &gr->solid_shader;
+	static int color_idx = 0;
+	static const GLfloat color[][4] = {
+			{ 1.0, 0.0, 0.0, 1.0 },
+			{ 0.0, 1.0, 0.0, 1.0 },
+			{ 0.0, 0.0, 1.0, 1.0 },
+			{ 1.0, 1.0, 1.0, 1.0 },
+	};
+	int i;
+
+	use_shader(gr, shader);
+	glUniformMatrix4fv(shader->proj_uniform,
+			   1, GL_FALSE, output->matrix.d);
+	glUniform1f(shader->alpha_uniform, 1.0);
+	glUniform4fv(shader->color_uniform, 1,
+			color[color_idx++ % ARRAY_LENGTH(color)]);
+	/* the solid shader uniforms no longer match any draw */
+	shader->uniform_serial = 0;
+
+	for (i = 0; i < count; i += 3)
+		glDrawArrays(GL_LINE_LOOP, first + i, 3);
+}
+
+/* Upload the vertices of all recorded draws into one buffer object and
+ * submit the draws in order, touching only the GL state that differs
+ * from the previous draw. */
+static void
+batch_flush(struct gl_renderer *gr, struct weston_output *output)
+{
+	struct gl_draw *draw;
+	GLuint bound[3] = { 0, 0, 0 };
+	GLint filters[3] = { 0, 0, 0 };
+	int blend = -1;
+	int i;
+
+	if (gr->draws.size == 0)
+		goto out;
+
+	gr->batch_serial++;
+	if (gr->batch_serial == 0)
+		gr->batch_serial++;
+
+	if (!gr->vbo)
+		glGenBuffers(1, &gr->vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, gr->vbo);
+	glBufferData(GL_ARRAY_BUFFER, gr->vertices.size, gr->vertices.data,
+		     GL_STREAM_DRAW);
+
+	/* position: */
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE,
+			      4 * sizeof(GLfloat), (void *) 0);
+	glEnableVertexAttribArray(0);
+
+	/* texcoord: */
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE,
+			      4 * sizeof(GLfloat),
+			      (void *) (2 * sizeof(GLfloat)));
+	glEnableVertexAttribArray(1);
+
+	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+	wl_array_for_each(draw, &gr->draws) {
+		if (draw->blend != blend) {
+			if (draw->blend)
+				glEnable(GL_BLEND);
+			else
+				glDisable(GL_BLEND);
+			blend = draw->blend;
+			gr->stats.blend++;
+		}
+
+		if (gr->current_shader != draw->shader)
+			gr->stats.programs++;
+		use_shader(gr, draw->shader);
+		shader_uniforms(gr, draw, output);
+
+		for (i = 0; i < draw->num_textures; i++) {
+			if (bound[i] == draw->textures[i] &&
+			    filters[i] == draw->filter)
+				continue;
+
+			glActiveTexture(GL_TEXTURE0 + i);
+			glBindTexture(draw->target, draw->textures[i]);
+			glTexParameteri(draw->target,
+					GL_TEXTURE_MIN_FILTER, draw->filter);
+			glTexParameteri(draw->target,
+					GL_TEXTURE_MAG_FILTER, draw->filter);
+			bound[i] = draw->textures[i];
+			filters[i] = draw->filter;
+			gr->stats.textures++;
+		}
+
+		glDrawArrays(GL_TRIANGLES, draw->first, draw->count);
+		gr->stats.draw_calls++;
+		gr->stats.vertices += draw->count;
+
+		if (gr->fan_debug)
+			triangle_debug(gr, output, draw->first, draw->count);
+	}
+
+	glDisableVertexAttribArray(1);
+	glDisableVertexAttribArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glActiveTexture(GL_TEXTURE0);
+
+out:
+	gr->vertices.size = 0;
+	gr->draws.size = 0;
+}
+
+static void
+batch_log_stats(struct gl_renderer *gr)
+{
+	struct gl_batch_stats *st = &gr->stats;
+
+	if (++st->frames < 60)
+		return;
+
+	if (gr->batch_debug)
+		weston_log("GL batching, per frame: %.1f polygons, "
+			   "%.1f draw calls, %.1f vertices, %.1f program, "
+			   "%.1f texture, %.1f uniform and %.1f blend changes\n",
+			   (double) st->polygons / st->frames,
+			   (double) st->draw_calls / st->frames,
+			   (double) st->vertices / st->frames,
+			   (double) st->programs / st->frames,
+			   (double) st->textures / st->frames,
+			   (double) st->uniforms / st->frames,
+			   (double) st->blend / st->frames);
+
+	memset(st, 0, sizeof *st);
+}
+
 static void
 repaint_views(struct weston_output *output, pixman_region32_t *damage)
 {
 	struct weston_compositor *compositor = output->compositor;
+	struct gl_renderer *gr = get_renderer(compositor);
 	struct weston_view *view;
 
 	wl_list_for_each_reverse(view, &compositor->view_list, link)
 		if (view->plane == &compositor->primary_plane)
 			draw_view(view, output, damage);
+
+	batch_flush(gr, output);
 }
 
 static void
@@ -734,6 +986,7 @@ draw_output_borders(struct weston_output *output,
 
 	glUniform1i(shader->tex_uniforms[0], 0);
 	glUniform1f(shader->alpha_uniform, 1);
+	shader->uniform_serial = 0;
 	glActiveTexture(GL_TEXTURE0);
 
 	if (border_status & BORDER_TOP_DIRTY)
@@ -903,6 +1156,7 @@ gl_renderer_repaint_output(struct weston_output *output,
 	border_damage |= go->border_status;
 
 	repaint_views(output, &total_damage);
+	batch_log_stats(gr);
 
 	pixman_region32_fini(&total_damage);
 	pixman_region32_fini(&buffer_damage);
@@ -996,6 +1250,118 @@ gl_renderer_read_pixels(struct weston_output *output,
 	return 0;
 }
 
+/* More damage rectangles than this are uploaded as their extents. */
+#define UPLOAD_COALESCE_RECTS 16
+
+#ifdef GL_RENDERER_PBO_UPLOAD
+
+#define UPLOAD_PBO_MIN_SIZE (4 * 1024 * 1024)
+
+/* Copy the rectangles of the buffer into the upload ring and update the
+ * bound texture from there, or specify the whole texture if full is
+ * set. Returns -1 if the caller should upload directly instead.
+ */
+static int
+upload_pbo(struct gl_renderer *gr, struct gl_surface_state *gs,
+	   struct weston_buffer *buffer, pixman_box32_t *rects, int n,
+	   int full)
+{
+	GLbitfield access = GL_MAP_WRITE_BIT_EXT |
+			    GL_MAP_INVALIDATE_RANGE_BIT_EXT |
+			    GL_MAP_UNSYNCHRONIZED_BIT_EXT;
+	int bpp = gs->gl_pixel_type == GL_UNSIGNED_BYTE ? 4 : 2;
+	int stride = wl_shm_buffer_get_stride(buffer->shm_buffer);
+	GLsizeiptr offsets[UPLOAD_COALESCE_RECTS + 1];
+	GLsizeiptr size, pitch;
+	uint8_t *src, *dst;
+	GLboolean ok;
+	int i, y, width;
+
+	/* Rows are padded to the default GL_UNPACK_ALIGNMENT of 4 and
+	 * rectangles start 16 byte aligned. */
+	size = 0;
+	for (i = 0; i < n; i++) {
+		offsets[i] = size;
+		pitch = ((rects[i].x2 - rects[i].x1) * bpp + 3) & ~3;
+		size += (pitch * (rects[i].y2 - rects[i].y1) + 15) & ~15;
+	}
+	if (size == 0)
+		return 0;
+
+	if (!gr->upload_pbo)
+		glGenBuffers(1, &gr->upload_pbo);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER_NV, gr->upload_pbo);
+
+	if (size > gr->upload_size) {
+		gr->upload_size = size > UPLOAD_PBO_MIN_SIZE ?
+			size : UPLOAD_PBO_MIN_SIZE;
+		glBufferData(GL_PIXEL_UNPACK_BUFFER_NV, gr->upload_size,
+			     NULL, GL_STREAM_DRAW);
+		gr->upload_offset = 0;
+	} else if (gr->upload_offset + size > gr->upload_size) {
+		/* Wrapping around: orphan the storage instead of waiting
+		 * for earlier transfers to finish reading it. */
+		access = GL_MAP_WRITE_BIT_EXT |
+			 GL_MAP_INVALIDATE_BUFFER_BIT_EXT;
+		gr->upload_offset = 0;
+	}
+
+	dst = gr->map_buffer_range(GL_PIXEL_UNPACK_BUFFER_NV,
+				   gr->upload_offset, size, access);
+	if (!dst) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER_NV, 0);
+		return -1;
+	}
+
+	src = wl_shm_buffer_get_data(buffer->shm_buffer);
+	wl_shm_buffer_begin_access(buffer->shm_buffer);
+	for (i = 0; i < n; i++) {
+		width = (rects[i].x2 - rects[i].x1) * bpp;
+		pitch = (width + 3) & ~3;
+		for (y = rects[i].y1; y < rects[i].y2; y++)
+			memcpy(dst + offsets[i] + (y - rects[i].y1) * pitch,
+			       src + y * stride + rects[i].x1 * bpp, width);
+	}
+	wl_shm_buffer_end_access(buffer->shm_buffer);
+
+	ok = gr->unmap_buffer(GL_PIXEL_UNPACK_BUFFER_NV);
+	if (!ok) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER_NV, 0);
+		return -1;
+	}
+
+#ifdef GL_EXT_unpack_subimage
+	if (gr->has_unpack_subimage) {
+		glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, 0);
+		glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0);
+		glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0);
+	}
+#endif
+
+	for (i = 0; i < n; i++) {
+		void *data = (void *) (gr->upload_offset + offsets[i]);
+
+		if (full)
+			glTexImage2D(GL_TEXTURE_2D, 0, gs->gl_format,
+				     rects[i].x2, rects[i].y2, 0,
+				     gs->gl_format, gs->gl_pixel_type, data);
+		else
+			glTexSubImage2D(GL_TEXTURE_2D, 0,
+					rects[i].x1, rects[i].y1,
+					rects[i].x2 - rects[i].x1,
+					rects[i].y2 - rects[i].y1,
+					gs->gl_format, gs->gl_pixel_type,
+					data);
+	}
+
+	gr->upload_offset += size;
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER_NV, 0);
+
+	return 0;
+}
+
+#endif
+
 static void
 gl_renderer_flush_damage(struct weston_surface *surface)
 {
@@ -1005,10 +1371,10 @@ gl_renderer_flush_damage(struct weston_surface *surface)
 	struct weston_view *view;
 	int texture_used;
 
-#ifdef GL_EXT_unpack_subimage
 	pixman_box32_t *rectangles;
-	void *data;
 	int i, n;
+#ifdef GL_EXT_unpack_subimage
+	void *data;
 #endif
 
 	pixman_region32_union(&gs->texture_damage,
@@ -1038,6 +1404,35 @@ gl_renderer_flush_damage(struct weston_surface *surface)
 
 	glBindTexture(GL_TEXTURE_2D, gs->textures[0]);
 
+	rectangles = pixman_region32_rectangles(&gs->texture_damage, &n);
+	if (n > UPLOAD_COALESCE_RECTS) {
+		/* Many small uploads cost more than one big one. */
+		rectangles = pixman_region32_extents(&gs->texture_damage);
+		n = 1;
+	}
+
+#ifdef GL_RENDERER_PBO_UPLOAD
+	if (gr->has_pbo_upload) {
+		pixman_box32_t rects[UPLOAD_COALESCE_RECTS];
+
+		if (gs->needs_full_upload) {
+			rects[0].x1 = 0;
+			rects[0].y1 = 0;
+			rects[0].x2 = gs->pitch;
+			rects[0].y2 = buffer->height;
+			n = 1;
+		} else {
+			for (i = 0; i < n; i++)
+				rects[i] = weston_surface_to_buffer_rect(
+						surface, rectangles[i]);
+		}
+
+		if (upload_pbo(gr, gs, buffer, rects, n,
+			       gs->needs_full_upload) == 0)
+			goto done;
+	}
+#endif
+
 	if (!gr->has_unpack_subimage) {
 		wl_shm_buffer_begin_access(buffer->shm_buffer);
 		glTexImage2D(GL_TEXTURE_2D, 0, gs->gl_format,
@@ -1064,7 +1459,6 @@ gl_renderer_flush_damage(struct weston_surface *surface)
 		goto done;
 	}
 
-	rectangles = pixman_region32_rectangles(&gs->texture_damage, &n);
 	wl_shm_buffer_begin_access(buffer->shm_buffer);
 	for (i = 0; i < n; i++) {
 		pixman_box32_t r;
@@ -1497,6 +1891,202 @@ static const char solid_fragment_shader[] =
 	"   gl_FragColor = alpha * color\n;"
 	;
 
+#ifdef GL_OES_get_program_binary
+
+#define PROGRAM_CACHE_MAGIC 0x43425057 /* "WPBC" */
+#define PROGRAM_CACHE_MAX_SIZE (16 * 1024 * 1024)
+
+struct program_cache_header {
+	uint32_t magic;
+	uint32_t format;
+	uint64_t key;
+	uint32_t length;
+};
+
+/* 64 bit FNV-1a, with a terminator so that the boundaries between
+ * strings are part of the hash. */
+static uint64_t
+hash_string(uint64_t hash, const char *str)
+{
+	const uint8_t *p;
+
+	for (p = (const uint8_t *) str; p && *p; p++) {
+		hash ^= *p;
+		hash *= 0x100000001b3ULL;
+	}
+
+	hash ^= 0xff;
+	hash *= 0x100000001b3ULL;
+
+	return hash;
+}
+
+static char *
+program_cache_get_dir(void)
+{
+	const char *xdg_cache = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+	char base[PATH_MAX];
+	char *dir;
+
+	if (xdg_cache && xdg_cache[0] == '/')
+		snprintf(base, sizeof base, "%s", xdg_cache);
+	else if (home)
+		snprintf(base, sizeof base, "%s/.cache", home);
+	else
+		return NULL;
+
+	if (mkdir(base, 0700) < 0 && errno != EEXIST)
+		return NULL;
+
+	if (asprintf(&dir, "%s/weston", base) < 0)
+		return NULL;
+
+	if (mkdir(dir, 0700) < 0 && errno != EEXIST) {
+		free(dir);
+		return NULL;
+	}
+
+	return dir;
+}
+
+static void
+program_cache_init(struct gl_renderer *gr)
+{
+	uint64_t seed = 0xcbf29ce484222325ULL;
+	GLint formats = 0;
+
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS_OES, &formats);
+	if (formats <= 0)
+		return;
+
+	gr->get_program_binary =
+		(void *) eglGetProcAddress("glGetProgramBinaryOES");
+	gr->program_binary = (void *) eglGetProcAddress("glProgramBinaryOES");
+	if (!gr->get_program_binary || !gr->program_binary)
+		return;
+
+	gr->program_cache_dir = program_cache_get_dir();
+	if (!gr->program_cache_dir)
+		return;
+
+	seed = hash_string(seed, (const char *) glGetString(GL_VENDOR));
+	seed = hash_string(seed, (const char *) glGetString(GL_RENDERER));
+	seed = hash_string(seed, (const char *) glGetString(GL_VERSION));
+	gr->program_cache_seed = seed;
+	gr->has_program_binary = 1;
+}
+
+static uint64_t
+program_cache_key(struct gl_renderer *gr, const char *vertex_source,
+		  int count, const char **fragment_sources)
+{
+	uint64_t key = gr->program_cache_seed;
+	int i;
+
+	key = hash_string(key, vertex_source);
+	for (i = 0; i < count; i++)
+		key = hash_string(key, fragment_sources[i]);
+
+	return key;
+}
+
+static void
+program_cache_path(struct gl_renderer *gr, uint64_t key,
+		   char *path, size_t size)
+{
+	snprintf(path, size, "%s/shader-%016" PRIx64 ".bin",
+		 gr->program_cache_dir, key);
+}
+
+static int
+program_cache_load(struct gl_renderer *gr, struct gl_shader *shader,
+		   uint64_t key)
+{
+	struct program_cache_header header;
+	char path[PATH_MAX];
+	void *binary = NULL;
+	GLint status = 0;
+	FILE *fp;
+
+	program_cache_path(gr, key, path, sizeof path);
+	fp = fopen(path, "rb");
+	if (!fp)
+		return -1;
+
+	if (fread(&header, sizeof header, 1, fp) != 1 ||
+	    header.magic != PROGRAM_CACHE_MAGIC || header.key != key ||
+	    header.length == 0 || header.length > PROGRAM_CACHE_MAX_SIZE)
+		goto out;
+
+	binary = malloc(header.length);
+	if (!binary || fread(binary, header.length, 1, fp) != 1)
+		goto out;
+
+	shader->program = glCreateProgram();
+	gr->program_binary(shader->program, header.format,
+			   binary, header.length);
+	glGetProgramiv(shader->program, GL_LINK_STATUS, &status);
+	if (!status) {
+		/* Driver update or corrupt file, rebuild from source. */
+		glDeleteProgram(shader->program);
+		shader->program = 0;
+	}
+
+out:
+	free(binary);
+	fclose(fp);
+
+	return status ? 0 : -1;
+}
+
+static void
+program_cache_store(struct gl_renderer *gr, struct gl_shader *shader,
+		    uint64_t key)
+{
+	struct program_cache_header header;
+	char path[PATH_MAX], tmp[PATH_MAX];
+	GLint length = 0;
+	GLenum format;
+	void *binary;
+	FILE *fp;
+	int ok;
+
+	glGetProgramiv(shader->program, GL_PROGRAM_BINARY_LENGTH_OES, &length);
+	if (length <= 0 || length > PROGRAM_CACHE_MAX_SIZE)
+		return;
+
+	binary = malloc(length);
+	if (!binary)
+		return;
+
+	gr->get_program_binary(shader->program, length, &length,
+			       &format, binary);
+
+	header.magic = PROGRAM_CACHE_MAGIC;
+	header.format = format;
+	header.key = key;
+	header.length = length;
+
+	/* Write and rename, so a concurrent reader never sees a partial
+	 * file. */
+	program_cache_path(gr, key, path, sizeof path);
+	snprintf(tmp, sizeof tmp, "%s.%d", path, getpid());
+	fp = fopen(tmp, "wb");
+	if (fp) {
+		ok = fwrite(&header, sizeof header, 1, fp) == 1 &&
+		     fwrite(binary, length, 1, fp) == 1;
+		if (fclose(fp) != 0)
+			ok = 0;
+		if (!ok || rename(tmp, path) < 0)
+			unlink(tmp);
+	}
+
+	free(binary);
+}
+
+#endif
+
 static int
 compile_shader(GLenum type, int count, const char **sources)
 {
@@ -1525,9 +2115,9 @@ shader_init(struct gl_shader *shader, struct gl_renderer *renderer,
 	GLint status;
 	int count;
 	const char *sources[3];
-
-	shader->vertex_shader =
-		compile_shader(GL_VERTEX_SHADER, 1, &vertex_source);
+#ifdef GL_OES_get_program_binary
+	uint64_t key = 0;
+#endif
 
 	if (renderer->fragment_shader_debug) {
 		sources[0] = fragment_source;
@@ -1540,6 +2130,18 @@ shader_init(struct gl_shader *shader, struct gl_renderer *renderer,
 		count = 2;
 	}
 
+#ifdef GL_OES_get_program_binary
+	if (renderer->has_program_binary) {
+		key = program_cache_key(renderer, vertex_source,
+					count, sources);
+		if (program_cache_load(renderer, shader, key) == 0)
+			goto uniforms;
+	}
+#endif
+
+	shader->vertex_shader =
+		compile_shader(GL_VERTEX_SHADER, 1, &vertex_source);
+
 	shader->fragment_shader =
 		compile_shader(GL_FRAGMENT_SHADER, count, sources);
 
@@ -1557,6 +2159,12 @@ shader_init(struct gl_shader *shader, struct gl_renderer *renderer,
 		return -1;
 	}
 
+#ifdef GL_OES_get_program_binary
+	if (renderer->has_program_binary)
+		program_cache_store(renderer, shader, key);
+
+uniforms:
+#endif
 	shader->proj_uniform = glGetUniformLocation(shader->program, "proj");
 	shader->tex_uniforms[0] = glGetUniformLocation(shader->program, "tex");
 	shader->tex_uniforms[1] = glGetUniformLocation(shader->program, "tex1");
@@ -1821,6 +2429,13 @@ gl_renderer_destroy(struct weston_compositor *ec)
 	if (gr->has_bind_display)
 		gr->unbind_display(gr->egl_display, ec->wl_display);
 
+	if (gr->vbo)
+		glDeleteBuffers(1, &gr->vbo);
+#ifdef GL_RENDERER_PBO_UPLOAD
+	if (gr->upload_pbo)
+		glDeleteBuffers(1, &gr->upload_pbo);
+#endif
+
 	/* Work around crash in egl_dri2.c's dri2_make_current() - when does this apply? */
 	eglMakeCurrent(gr->egl_display,
 		       EGL_NO_SURFACE, EGL_NO_SURFACE,
@@ -1830,12 +2445,19 @@ gl_renderer_destroy(struct weston_compositor *ec)
 	eglReleaseThread();
 
 	wl_array_release(&gr->vertices);
-	wl_array_release(&gr->vtxcnt);
+	wl_array_release(&gr->draws);
+	wl_array_release(&gr->clip_scratch);
+
+#ifdef GL_OES_get_program_binary
+	free(gr->program_cache_dir);
+#endif
 
 	if (gr->fragment_binding)
 		weston_binding_destroy(gr->fragment_binding);
 	if (gr->fan_binding)
 		weston_binding_destroy(gr->fan_binding);
+	if (gr->batch_binding)
+		weston_binding_destroy(gr->batch_binding);
 
 	free(gr);
 }
@@ -2043,6 +2665,17 @@ fan_debug_repaint_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
 	weston_compositor_damage_all(compositor);
 }
 
+static void
+batch_debug_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
+		    void *data)
+{
+	struct weston_compositor *compositor = data;
+	struct gl_renderer *gr = get_renderer(compositor);
+
+	gr->batch_debug = !gr->batch_debug;
+	memset(&gr->stats, 0, sizeof gr->stats);
+}
+
 static int
 gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 {
@@ -2114,6 +2747,24 @@ gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 	if (strstr(extensions, "GL_OES_EGL_image_external"))
 		gr->has_egl_image_external = 1;
 
+#ifdef GL_OES_get_program_binary
+	if (strstr(extensions, "GL_OES_get_program_binary"))
+		program_cache_init(gr);
+#endif
+
+#ifdef GL_RENDERER_PBO_UPLOAD
+	if (strstr(extensions, "GL_NV_pixel_buffer_object") &&
+	    strstr(extensions, "GL_EXT_map_buffer_range") &&
+	    strstr(extensions, "GL_OES_mapbuffer")) {
+		gr->map_buffer_range =
+			(void *) eglGetProcAddress("glMapBufferRangeEXT");
+		gr->unmap_buffer =
+			(void *) eglGetProcAddress("glUnmapBufferOES");
+		if (gr->map_buffer_range && gr->unmap_buffer)
+			gr->has_pbo_upload = 1;
+	}
+#endif
+
 	glActiveTexture(GL_TEXTURE0);
 
 	if (compile_shaders(ec))
@@ -2127,14 +2778,27 @@ gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 		weston_compositor_add_debug_binding(ec, KEY_F,
 						    fan_debug_repaint_binding,
 						    ec);
+	gr->batch_binding =
+		weston_compositor_add_debug_binding(ec, KEY_B,
+						    batch_debug_binding,
+						    ec);
 
 	weston_log("GL ES 2 renderer features:\n");
 	weston_log_continue(STAMP_SPACE "read-back format: %s\n",
 		ec->read_format == PIXMAN_a8r8g8b8 ? "BGRA" : "RGBA");
 	weston_log_continue(STAMP_SPACE "wl_shm sub-image to texture: %s\n",
 			    gr->has_unpack_subimage ? "yes" : "no");
+#ifdef GL_RENDERER_PBO_UPLOAD
+	weston_log_continue(STAMP_SPACE "wl_shm upload through PBO: %s\n",
+			    gr->has_pbo_upload ? "yes" : "no");
+#endif
 	weston_log_continue(STAMP_SPACE "EGL Wayland extension: %s\n",
 			    gr->has_bind_display ? "yes" : "no");
+#ifdef GL_OES_get_program_binary
+	weston_log_continue(STAMP_SPACE "shader program cache: %s\n",
+			    gr->has_program_binary ?
+			    gr->program_cache_dir : "no");
+#endif
 
 
 	return 0;
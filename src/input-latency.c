@@ -0,0 +1,323 @@
+/*
+ * Copyright © 2014 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Input-to-present latency accounting.
+ *
+ * The timestamp of an input event is remembered for the client that has
+ * the focus it is delivered to.  The next wl_surface.commit from that
+ * client which changes content moves the timestamp onto the surface, the
+ * repaint that sends the surface's frame callbacks moves it onto the
+ * output, and when that frame finishes, the time elapsed since the input
+ * event goes into a histogram for the client and one for the output.
+ * Only the oldest unanswered event of a client is tracked, so every
+ * commit yields at most one sample.
+ *
+ * The histograms are written to the log, and reset, by the debug
+ * binding mod-shift-space l.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <linux/input.h>
+
+#include "compositor.h"
+
+/* Input the client has not answered within this long is taken as ignored
+ * (pointer motion over a window that does not care, for instance), and an
+ * event time this far off our own clock is taken as coming from a
+ * different clock. */
+#define LATENCY_MAX_AGE 1000
+
+struct latency_client {
+	struct weston_compositor *compositor;
+	struct wl_listener destroy_listener;
+	struct wl_list link;
+	pid_t pid;
+
+	int pending;
+	uint32_t pending_time;
+
+	struct weston_latency_histogram histogram;
+};
+
+struct latency_sample {
+	struct latency_client *client;
+	uint32_t time;
+};
+
+static void
+latency_client_destroy(struct wl_listener *listener, void *data)
+{
+	struct latency_client *lc =
+		container_of(listener, struct latency_client,
+			     destroy_listener);
+	struct weston_output *output;
+	struct latency_sample *sample;
+
+	wl_list_for_each(output, &lc->compositor->output_list, link)
+		wl_array_for_each(sample, &output->latency_pending)
+			if (sample->client == lc)
+				sample->client = NULL;
+
+	wl_list_remove(&lc->link);
+	free(lc);
+}
+
+static struct latency_client *
+latency_client_get(struct weston_compositor *ec, struct wl_client *client,
+		   int create)
+{
+	struct latency_client *lc;
+	struct wl_listener *listener;
+
+	listener = wl_client_get_destroy_listener(client,
+						  latency_client_destroy);
+	if (listener)
+		return container_of(listener, struct latency_client,
+				    destroy_listener);
+
+	if (!create)
+		return NULL;
+
+	lc = zalloc(sizeof *lc);
+	if (lc == NULL)
+		return NULL;
+
+	lc->compositor = ec;
+	wl_client_get_credentials(client, &lc->pid, NULL, NULL);
+	lc->destroy_listener.notify = latency_client_destroy;
+	wl_client_add_destroy_listener(client, &lc->destroy_listener);
+	wl_list_insert(&ec->latency_client_list, &lc->link);
+
+	return lc;
+}
+
+static void
+histogram_add(struct weston_latency_histogram *h, uint32_t ms)
+{
+	h->count++;
+	h->sum += ms;
+	if (ms > h->max)
+		h->max = ms;
+	if (ms >= WESTON_LATENCY_BUCKETS)
+		ms = WESTON_LATENCY_BUCKETS - 1;
+	h->bucket[ms]++;
+}
+
+static uint32_t
+histogram_percentile(struct weston_latency_histogram *h, int percent)
+{
+	uint64_t target, seen = 0;
+	uint32_t i;
+
+	target = ((uint64_t) h->count * percent + 99) / 100;
+	for (i = 0; i < WESTON_LATENCY_BUCKETS; i++) {
+		seen += h->bucket[i];
+		if (seen >= target)
+			return i;
+	}
+
+	return WESTON_LATENCY_BUCKETS - 1;
+}
+
+static void
+histogram_log(struct weston_latency_histogram *h, const char *what)
+{
+	uint32_t i;
+
+	if (h->count == 0)
+		return;
+
+	weston_log("input latency %s: %u frames, mean %.1f ms, "
+		   "50%% %u ms, 90%% %u ms, 99%% %u ms, max %u ms\n",
+		   what, h->count, (double) h->sum / h->count,
+		   histogram_percentile(h, 50),
+		   histogram_percentile(h, 90),
+		   histogram_percentile(h, 99), h->max);
+
+	weston_log_continue(STAMP_SPACE "ms:frames");
+	for (i = 0; i < WESTON_LATENCY_BUCKETS; i++)
+		if (h->bucket[i])
+			weston_log_continue(" %u%s:%u", i,
+					    i == WESTON_LATENCY_BUCKETS - 1 ?
+					    "+" : "", h->bucket[i]);
+	weston_log_continue("\n");
+}
+
+void
+weston_latency_input(struct weston_surface *surface, uint32_t time)
+{
+	struct latency_client *lc;
+	uint32_t now;
+
+	if (surface == NULL || surface->resource == NULL)
+		return;
+
+	lc = latency_client_get(surface->compositor,
+				wl_resource_get_client(surface->resource), 1);
+	if (lc == NULL)
+		return;
+
+	now = weston_compositor_get_time();
+	if (lc->pending && now - lc->pending_time <= LATENCY_MAX_AGE)
+		return;
+
+	/* Event times from backends that don't use the wall clock, like
+	 * X server time, are replaced by the time we got the event. */
+	if (now - time > LATENCY_MAX_AGE)
+		time = now;
+
+	lc->pending = 1;
+	lc->pending_time = time;
+}
+
+void
+weston_latency_commit(struct weston_surface *surface)
+{
+	struct latency_client *lc;
+
+	if (surface->resource == NULL)
+		return;
+
+	if (!surface->pending.newly_attached &&
+	    !pixman_region32_not_empty(&surface->pending.damage))
+		return;
+
+	lc = latency_client_get(surface->compositor,
+				wl_resource_get_client(surface->resource), 0);
+	if (lc == NULL || !lc->pending)
+		return;
+
+	lc->pending = 0;
+	if (weston_compositor_get_time() - lc->pending_time > LATENCY_MAX_AGE)
+		return;
+
+	if (!surface->latency_pending ||
+	    (int32_t) (lc->pending_time - surface->latency_time) < 0)
+		surface->latency_time = lc->pending_time;
+	surface->latency_pending = 1;
+}
+
+void
+weston_latency_repaint(struct weston_output *output,
+		       struct weston_surface *surface)
+{
+	struct latency_sample *sample;
+
+	if (!surface->latency_pending)
+		return;
+	surface->latency_pending = 0;
+
+	sample = wl_array_add(&output->latency_pending, sizeof *sample);
+	if (sample == NULL)
+		return;
+
+	sample->client =
+		latency_client_get(surface->compositor,
+				   wl_resource_get_client(surface->resource),
+				   0);
+	sample->time = surface->latency_time;
+}
+
+void
+weston_latency_present(struct weston_output *output)
+{
+	struct latency_sample *sample;
+	uint32_t now, ms;
+
+	if (output->latency_pending.size == 0)
+		return;
+
+	/* The frame time handed to weston_output_finish_frame() may be on
+	 * a different clock than input events, so take our own. */
+	now = weston_compositor_get_time();
+
+	wl_array_for_each(sample, &output->latency_pending) {
+		ms = now - sample->time;
+		histogram_add(&output->latency, ms);
+		if (sample->client)
+			histogram_add(&sample->client->histogram, ms);
+	}
+
+	output->latency_pending.size = 0;
+}
+
+static void
+latency_binding(struct weston_seat *seat, uint32_t time, uint32_t key,
+		void *data)
+{
+	struct weston_compositor *ec = data;
+	struct weston_output *output;
+	struct latency_client *lc;
+	char what[64];
+
+	wl_list_for_each(output, &ec->output_list, link) {
+		snprintf(what, sizeof what, "on output %s", output->name);
+		histogram_log(&output->latency, what);
+		memset(&output->latency, 0, sizeof output->latency);
+	}
+
+	wl_list_for_each(lc, &ec->latency_client_list, link) {
+		snprintf(what, sizeof what, "of client %d", (int) lc->pid);
+		histogram_log(&lc->histogram, what);
+		memset(&lc->histogram, 0, sizeof lc->histogram);
+	}
+}
+
+void
+weston_latency_init(struct weston_compositor *ec)
+{
+	wl_list_init(&ec->latency_client_list);
+
+	weston_compositor_add_debug_binding(ec, KEY_L, latency_binding, ec);
+}
+
+void
+weston_latency_release(struct weston_compositor *ec)
+{
+	struct latency_client *lc, *next;
+
+	/* Clients outlive the compositor at shutdown. */
+	wl_list_for_each_safe(lc, next, &ec->latency_client_list, link) {
+		wl_list_remove(&lc->destroy_listener.link);
+		wl_list_remove(&lc->link);
+		free(lc);
+	}
+}
+
+void
+weston_latency_output_init(struct weston_output *output)
+{
+	wl_array_init(&output->latency_pending);
+	memset(&output->latency, 0, sizeof output->latency);
+}
+
+void
+weston_latency_output_release(struct weston_output *output)
+{
+	wl_array_release(&output->latency_pending);
+}
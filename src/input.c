@@ -937,15 +937,89 @@ weston_pointer_handle_output_destroy(struct wl_listener *listener, void *data)
 	weston_pointer_move(pointer, fx, fy);
 }
 
+static void
+weston_pointer_flush_motion(struct weston_pointer *pointer)
+{
+	if (!pointer || !pointer->coalesced.pending)
+		return;
+
+	pointer->coalesced.pending = 0;
+	pointer->grab->interface->motion(pointer->grab,
+					 pointer->coalesced.time,
+					 pointer->coalesced.x,
+					 pointer->coalesced.y);
+}
+
+/** Give the coalesced motion of all seats to their grabs
+ *
+ * With coalesce-motion set, relative motion only moves a target
+ * position, which the grab gets at the next repaint, or before any
+ * other event of the seat, so that clients still see events in order.
+ */
+WL_EXPORT void
+weston_compositor_flush_motion(struct weston_compositor *compositor)
+{
+	struct weston_seat *seat;
+
+	wl_list_for_each(seat, &compositor->seat_list, link)
+		weston_pointer_flush_motion(seat->pointer);
+}
+
+static void
+weston_pointer_note_input(struct weston_pointer *pointer, uint32_t time)
+{
+	if (pointer->focus)
+		weston_latency_input(pointer->focus->surface, time);
+}
+
 WL_EXPORT void
 notify_motion(struct weston_seat *seat,
 	      uint32_t time, wl_fixed_t dx, wl_fixed_t dy)
 {
 	struct weston_compositor *ec = seat->compositor;
 	struct weston_pointer *pointer = seat->pointer;
+	struct weston_output *output;
+	wl_fixed_t x, y;
+	int scheduled = 0;
 
 	weston_compositor_wake(ec);
-	pointer->grab->interface->motion(pointer->grab, time, pointer->x + dx, pointer->y + dy);
+	weston_pointer_note_input(pointer, time);
+
+	if (!ec->coalesce_motion) {
+		pointer->grab->interface->motion(pointer->grab, time,
+						 pointer->x + dx,
+						 pointer->y + dy);
+		return;
+	}
+
+	if (!pointer->coalesced.pending) {
+		pointer->coalesced.pending = 1;
+		pointer->coalesced.x = pointer->x;
+		pointer->coalesced.y = pointer->y;
+	}
+
+	/* Clamp every step, as if the pointer had moved. */
+	x = pointer->coalesced.x + dx;
+	y = pointer->coalesced.y + dy;
+	weston_pointer_clamp(pointer, &x, &y);
+
+	pointer->coalesced.x = x;
+	pointer->coalesced.y = y;
+	pointer->coalesced.time = time;
+
+	/* Make sure a frame comes to flush the motion, even when the
+	 * pointer has no sprite to be repainted. */
+	wl_list_for_each(output, &ec->output_list, link) {
+		if (pixman_region32_contains_point(&output->region,
+						   wl_fixed_to_int(x),
+						   wl_fixed_to_int(y), NULL)) {
+			weston_output_schedule_repaint(output);
+			scheduled = 1;
+		}
+	}
+
+	if (!scheduled)
+		weston_compositor_schedule_repaint(ec);
 }
 
 static void
@@ -992,6 +1066,8 @@ notify_motion_absolute(struct weston_seat *seat,
 	struct weston_pointer *pointer = seat->pointer;
 
 	weston_compositor_wake(ec);
+	weston_pointer_flush_motion(pointer);
+	weston_pointer_note_input(pointer, time);
 	pointer->grab->interface->motion(pointer->grab, time, x, y);
 }
 
@@ -1016,6 +1092,9 @@ notify_button(struct weston_seat *seat, uint32_t time, int32_t button,
 	struct weston_compositor *compositor = seat->compositor;
 	struct weston_pointer *pointer = seat->pointer;
 
+	weston_pointer_flush_motion(pointer);
+	weston_pointer_note_input(pointer, time);
+
 	if (state == WL_POINTER_BUTTON_STATE_PRESSED) {
 		weston_compositor_idle_inhibit(compositor);
 		if (pointer->button_count == 0) {
@@ -1050,10 +1129,13 @@ notify_axis(struct weston_seat *seat, uint32_t time, uint32_t axis,
 	struct wl_list *resource_list;
 
 	weston_compositor_wake(compositor);
+	weston_pointer_flush_motion(pointer);
 
 	if (!value)
 		return;
 
+	weston_pointer_note_input(pointer, time);
+
 	if (weston_compositor_run_axis_binding(compositor, seat,
 						   time, axis, value))
 		return;
@@ -1179,7 +1261,7 @@ send_modifiers(struct wl_resource *resource, uint32_t serial, struct weston_keyb
 }
 
 static struct weston_xkb_info *
-weston_xkb_info_create(struct xkb_keymap *keymap);
+weston_xkb_info_get(struct weston_compositor *ec, struct xkb_keymap *keymap);
 
 static void
 update_keymap(struct weston_seat *seat)
@@ -1191,7 +1273,8 @@ update_keymap(struct weston_seat *seat)
 	xkb_mod_mask_t latched_mods;
 	xkb_mod_mask_t locked_mods;
 
-	xkb_info = weston_xkb_info_create(keyboard->pending_keymap);
+	xkb_info = weston_xkb_info_get(seat->compositor,
+				       keyboard->pending_keymap);
 
 	xkb_keymap_unref(keyboard->pending_keymap);
 	keyboard->pending_keymap = NULL;
@@ -1201,6 +1284,12 @@ update_keymap(struct weston_seat *seat)
 		return;
 	}
 
+	/* Same keymap as before, nothing to tell the clients. */
+	if (xkb_info == keyboard->xkb_info) {
+		weston_xkb_info_destroy(xkb_info);
+		return;
+	}
+
 	state = xkb_state_new(xkb_info->keymap);
 	if (!state) {
 		weston_log("failed to initialise XKB state\n");
@@ -1267,6 +1356,11 @@ notify_key(struct weston_seat *seat, uint32_t time, uint32_t key,
 	struct weston_keyboard_grab *grab = keyboard->grab;
 	uint32_t *k, *end;
 
+	weston_pointer_flush_motion(seat->pointer);
+
+	if (keyboard->focus)
+		weston_latency_input(keyboard->focus, time);
+
 	if (state == WL_KEYBOARD_KEY_STATE_PRESSED) {
 		weston_compositor_idle_inhibit(compositor);
 		keyboard->grab_key = key;
@@ -1315,6 +1409,8 @@ WL_EXPORT void
 notify_pointer_focus(struct weston_seat *seat, struct weston_output *output,
 		     wl_fixed_t x, wl_fixed_t y)
 {
+	weston_pointer_flush_motion(seat->pointer);
+
 	if (output) {
 		weston_pointer_move(seat->pointer, x, y);
 	} else {
@@ -1451,6 +1547,11 @@ notify_touch(struct weston_seat *seat, uint32_t time, int touch_id,
 	struct weston_view *ev;
 	wl_fixed_t sx, sy;
 
+	weston_pointer_flush_motion(seat->pointer);
+
+	if (touch->focus)
+		weston_latency_input(touch->focus->surface, time);
+
 	/* Update grab's global coordinates. */
 	if (touch_id == touch->grab_touch_id && touch_type != WL_TOUCH_UP) {
 		touch->grab_x = x;
@@ -1469,6 +1570,8 @@ notify_touch(struct weston_seat *seat, uint32_t time, int touch_id,
 		if (touch->num_tp == 1) {
 			ev = weston_compositor_pick_view(ec, x, y, &sx, &sy);
 			weston_touch_set_focus(seat, ev);
+			if (ev)
+				weston_latency_input(ev->surface, time);
 		} else if (touch->focus) {
 			ev = touch->focus;
 			weston_view_from_global_fixed(ev, x, y, &sx, &sy);
@@ -1836,6 +1939,7 @@ weston_compositor_xkb_init(struct weston_compositor *ec,
 			   struct xkb_rule_names *names)
 {
 	ec->use_xkbcommon = 1;
+	wl_list_init(&ec->xkb_info_list);
 
 	if (ec->xkb_context == NULL) {
 		ec->xkb_context = xkb_context_new(0);
@@ -1863,6 +1967,13 @@ weston_xkb_info_destroy(struct weston_xkb_info *xkb_info)
 	if (--xkb_info->ref_count > 0)
 		return;
 
+	wl_list_remove(&xkb_info->link);
+	free((char *) xkb_info->names.rules);
+	free((char *) xkb_info->names.model);
+	free((char *) xkb_info->names.layout);
+	free((char *) xkb_info->names.variant);
+	free((char *) xkb_info->names.options);
+
 	if (xkb_info->keymap)
 		xkb_map_unref(xkb_info->keymap);
 
@@ -1876,6 +1987,8 @@ weston_xkb_info_destroy(struct weston_xkb_info *xkb_info)
 void
 weston_compositor_xkb_destroy(struct weston_compositor *ec)
 {
+	struct weston_xkb_info *xkb_info, *next;
+
 	/*
 	 * If we're operating in raw keyboard mode, we never initialized
 	 * libxkbcommon so there's no cleanup to do either.
@@ -1891,21 +2004,78 @@ weston_compositor_xkb_destroy(struct weston_compositor *ec)
 
 	if (ec->xkb_info)
 		weston_xkb_info_destroy(ec->xkb_info);
+
+	/* Drop the references the keymap cache holds.  Whatever is still
+	 * in use goes away with its keyboard. */
+	wl_list_for_each_safe(xkb_info, next, &ec->xkb_info_list, link) {
+		if (xkb_info->named) {
+			xkb_info->named = 0;
+			weston_xkb_info_destroy(xkb_info);
+		}
+	}
+	wl_list_for_each_safe(xkb_info, next, &ec->xkb_info_list, link)
+		wl_list_init(&xkb_info->link);
+
 	xkb_context_unref(ec->xkb_context);
 }
 
+static int
+keymap_store(struct weston_xkb_info *xkb_info, const char *keymap_str)
+{
+	xkb_info->keymap_size = strlen(keymap_str) + 1;
+
+	xkb_info->keymap_fd = os_create_sealed_file("weston-keymap",
+						    keymap_str,
+						    xkb_info->keymap_size);
+	if (xkb_info->keymap_fd >= 0)
+		return 0;
+
+	/* No sealing, clients get a writable file.  This is what every
+	 * keymap used to be shared through anyway. */
+	xkb_info->keymap_fd = os_create_anonymous_file(xkb_info->keymap_size);
+	if (xkb_info->keymap_fd < 0) {
+		weston_log("creating a keymap file for %lu bytes failed: %m\n",
+			(unsigned long) xkb_info->keymap_size);
+		return -1;
+	}
+
+	xkb_info->keymap_area = mmap(NULL, xkb_info->keymap_size,
+				     PROT_READ | PROT_WRITE,
+				     MAP_SHARED, xkb_info->keymap_fd, 0);
+	if (xkb_info->keymap_area == MAP_FAILED) {
+		weston_log("failed to mmap() %lu bytes\n",
+			(unsigned long) xkb_info->keymap_size);
+		xkb_info->keymap_area = NULL;
+		close(xkb_info->keymap_fd);
+		return -1;
+	}
+	strcpy(xkb_info->keymap_area, keymap_str);
+
+	return 0;
+}
+
+/* Returns a reference to the info for the given keymap.  Keyboards with
+ * the same keymap share the info, and with it the keymap fd. */
 static struct weston_xkb_info *
-weston_xkb_info_create(struct xkb_keymap *keymap)
+weston_xkb_info_get(struct weston_compositor *ec, struct xkb_keymap *keymap)
 {
-	struct weston_xkb_info *xkb_info = zalloc(sizeof *xkb_info);
+	struct weston_xkb_info *xkb_info;
+	char *keymap_str;
+
+	wl_list_for_each(xkb_info, &ec->xkb_info_list, link) {
+		if (xkb_info->keymap == keymap) {
+			xkb_info->ref_count++;
+			return xkb_info;
+		}
+	}
+
+	xkb_info = zalloc(sizeof *xkb_info);
 	if (xkb_info == NULL)
 		return NULL;
 
 	xkb_info->keymap = xkb_map_ref(keymap);
 	xkb_info->ref_count = 1;
 
-	char *keymap_str;
-
 	xkb_info->shift_mod = xkb_map_mod_get_index(xkb_info->keymap,
 						    XKB_MOD_NAME_SHIFT);
 	xkb_info->caps_mod = xkb_map_mod_get_index(xkb_info->keymap,
@@ -1932,30 +2102,15 @@ weston_xkb_info_create(struct xkb_keymap *keymap)
 		weston_log("failed to get string version of keymap\n");
 		goto err_keymap;
 	}
-	xkb_info->keymap_size = strlen(keymap_str) + 1;
 
-	xkb_info->keymap_fd = os_create_anonymous_file(xkb_info->keymap_size);
-	if (xkb_info->keymap_fd < 0) {
-		weston_log("creating a keymap file for %lu bytes failed: %m\n",
-			(unsigned long) xkb_info->keymap_size);
+	if (keymap_store(xkb_info, keymap_str) < 0)
 		goto err_keymap_str;
-	}
-
-	xkb_info->keymap_area = mmap(NULL, xkb_info->keymap_size,
-				     PROT_READ | PROT_WRITE,
-				     MAP_SHARED, xkb_info->keymap_fd, 0);
-	if (xkb_info->keymap_area == MAP_FAILED) {
-		weston_log("failed to mmap() %lu bytes\n",
-			(unsigned long) xkb_info->keymap_size);
-		goto err_dev_zero;
-	}
-	strcpy(xkb_info->keymap_area, keymap_str);
 	free(keymap_str);
 
+	wl_list_insert(&ec->xkb_info_list, &xkb_info->link);
+
 	return xkb_info;
 
-err_dev_zero:
-	close(xkb_info->keymap_fd);
 err_keymap_str:
 	free(keymap_str);
 err_keymap:
@@ -1972,9 +2127,7 @@ weston_compositor_build_global_keymap(struct weston_compositor *ec)
 	if (ec->xkb_info != NULL)
 		return 0;
 
-	keymap = xkb_map_new_from_names(ec->xkb_context,
-					&ec->xkb_names,
-					0);
+	keymap = weston_compositor_get_keymap(ec, &ec->xkb_names);
 	if (keymap == NULL) {
 		weston_log("failed to compile global XKB keymap\n");
 		weston_log("  tried rules %s, model %s, layout %s, variant %s, "
@@ -1985,13 +2138,70 @@ weston_compositor_build_global_keymap(struct weston_compositor *ec)
 		return -1;
 	}
 
-	ec->xkb_info = weston_xkb_info_create(keymap);
+	ec->xkb_info = weston_xkb_info_get(ec, keymap);
 	xkb_keymap_unref(keymap);
 	if (ec->xkb_info == NULL)
 		return -1;
 
 	return 0;
 }
+
+static int
+rule_name_equal(const char *a, const char *b)
+{
+	if (a == NULL || b == NULL)
+		return a == b;
+
+	return strcmp(a, b) == 0;
+}
+
+static char *
+rule_name_dup(const char *name)
+{
+	return name ? strdup(name) : NULL;
+}
+
+/* Returns a new reference to the keymap compiled from the given names.
+ * Compiled keymaps are kept until the compositor goes away, so seats and
+ * keyboards coming and going with the same names neither recompile the
+ * keymap nor serialize it again. */
+WL_EXPORT struct xkb_keymap *
+weston_compositor_get_keymap(struct weston_compositor *ec,
+			     const struct xkb_rule_names *names)
+{
+	struct weston_xkb_info *xkb_info;
+	struct xkb_keymap *keymap;
+
+	wl_list_for_each(xkb_info, &ec->xkb_info_list, link) {
+		if (xkb_info->named &&
+		    rule_name_equal(xkb_info->names.rules, names->rules) &&
+		    rule_name_equal(xkb_info->names.model, names->model) &&
+		    rule_name_equal(xkb_info->names.layout, names->layout) &&
+		    rule_name_equal(xkb_info->names.variant,
+				    names->variant) &&
+		    rule_name_equal(xkb_info->names.options,
+				    names->options))
+			return xkb_keymap_ref(xkb_info->keymap);
+	}
+
+	keymap = xkb_map_new_from_names(ec->xkb_context, names, 0);
+	if (keymap == NULL)
+		return NULL;
+
+	/* The cache holds the reference we get here. */
+	xkb_info = weston_xkb_info_get(ec, keymap);
+	if (xkb_info == NULL)
+		return keymap;
+
+	xkb_info->named = 1;
+	xkb_info->names.rules = rule_name_dup(names->rules);
+	xkb_info->names.model = rule_name_dup(names->model);
+	xkb_info->names.layout = rule_name_dup(names->layout);
+	xkb_info->names.variant = rule_name_dup(names->variant);
+	xkb_info->names.options = rule_name_dup(names->options);
+
+	return keymap;
+}
 #else
 int
 weston_compositor_xkb_init(struct weston_compositor *ec,
@@ -2004,6 +2214,13 @@ void
 weston_compositor_xkb_destroy(struct weston_compositor *ec)
 {
 }
+
+WL_EXPORT struct xkb_keymap *
+weston_compositor_get_keymap(struct weston_compositor *ec,
+			     const struct xkb_rule_names *names)
+{
+	return NULL;
+}
 #endif
 
 WL_EXPORT void
@@ -2045,7 +2262,8 @@ weston_seat_init_keyboard(struct weston_seat *seat, struct xkb_keymap *keymap)
 #ifdef ENABLE_XKBCOMMON
 	if (seat->compositor->use_xkbcommon) {
 		if (keymap != NULL) {
-			keyboard->xkb_info = weston_xkb_info_create(keymap);
+			keyboard->xkb_info =
+				weston_xkb_info_get(seat->compositor, keymap);
 			if (keyboard->xkb_info == NULL)
 				goto err;
 		} else {
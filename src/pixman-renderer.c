@@ -25,8 +25,10 @@
 
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "pixman-renderer.h"
+#include "yuv-convert.h"
 
 #include <linux/input.h>
 
@@ -34,6 +36,37 @@ struct pixman_output_state {
 	void *shadow_buffer;
 	pixman_image_t *shadow_image;
 	pixman_image_t *hw_buffer;
+
+	/* Drawn straight into hw_buffer but not into the shadow yet, in
+	 * global coordinates, see can_draw_direct() */
+	pixman_region32_t shadow_stale;
+
+	/* copy SHM buffers of surfaces on this output, see
+	 * pixman_renderer::copy_buffers */
+	int copy_buffers;
+};
+
+/* Number of buffer images kept per surface, enough for clients
+ * cycling through two or three buffers. */
+#define BUFFER_IMAGE_CACHE_SIZE 3
+
+/* A pixman image wrapping the storage of a wl_shm buffer, kept around
+ * for as long as the buffer lives so re-attaching it is cheap.
+ */
+struct pixman_buffer_image {
+	struct pixman_surface_state *ps;
+	struct weston_buffer *buffer;
+	pixman_image_t *image;
+	void *data; /* changes when the wl_shm_pool is resized */
+	struct wl_listener buffer_destroy_listener;
+	struct wl_list link; /* pixman_surface_state::buffer_images */
+};
+
+/* A downscaling transform without rotation, up to an integer
+ * translation in output pixels. */
+struct pixman_scale_key {
+	pixman_fixed_t sx, sy;	/* buffer pixels per output pixel */
+	pixman_fixed_t rx, ry;	/* sub-pixel phase, -sx < rx <= 0 */
 };
 
 struct pixman_surface_state {
@@ -42,7 +75,28 @@ struct pixman_surface_state {
 	pixman_image_t *image;
 	struct weston_buffer_reference buffer_ref;
 
-	struct wl_listener buffer_destroy_listener;
+	/* The attached buffer is YUV; it has no image of its own and is
+	 * converted into copy_image on flush. */
+	int yuv;
+	enum yuv_format yuv_format;
+
+	/* Renderer-owned copy of the buffer contents, kept in copy mode
+	 * and for YUV buffers. copy_valid is cleared when the copy needs
+	 * a full update.
+	 */
+	pixman_image_t *copy_image;
+	int copy_valid;
+
+	/* pixman_buffer_image::link, most recently attached first */
+	struct wl_list buffer_images;
+	int num_buffer_images;
+
+	/* image resampled at scale_key, see scale_cache_get() */
+	pixman_image_t *scaled_image;
+	struct pixman_scale_key scale_key;
+	struct pixman_scale_key scale_candidate;
+	uint32_t scale_candidate_time;
+
 	struct wl_listener surface_destroy_listener;
 	struct wl_listener renderer_destroy_listener;
 };
@@ -50,6 +104,13 @@ struct pixman_surface_state {
 struct pixman_renderer {
 	struct weston_renderer base;
 
+	/* Default for outputs without their own setting: copy the damaged
+	 * part of SHM buffers into a renderer-owned image on flush and
+	 * release the client buffer right away, instead of compositing
+	 * straight from the client buffer until the next attach.
+	 */
+	int copy_buffers;
+
 	int repaint_debug;
 	pixman_image_t *debug_color;
 	struct weston_binding *debug_binding;
@@ -167,20 +228,129 @@ transform_apply_viewport(pixman_transform_t *transform,
 	pixman_transform_translate(transform, NULL, D2F(src_x), D2F(src_y));
 }
 
+static void
+scale_cache_invalidate(struct pixman_surface_state *ps)
+{
+	if (ps->scaled_image) {
+		pixman_image_unref(ps->scaled_image);
+		ps->scaled_image = NULL;
+	}
+	memset(&ps->scale_candidate, 0, sizeof ps->scale_candidate);
+}
+
+static int64_t
+floor_div(int64_t a, int64_t b)
+{
+	int64_t q = a / b;
+
+	if (a % b < 0)
+		q--;
+
+	return q;
+}
+
+/* Bilinear downscaling of a buffer on every repaint is expensive, so
+ * keep the resampled image around for as long as the scale, the
+ * sub-pixel phase and the buffer contents stay the same. The cache is
+ * only filled once a key has been seen on two different frames, so
+ * animated scales do not pay for it. On success, transform is replaced
+ * by the integer translation placing the returned image.
+ */
+static pixman_image_t *
+scale_cache_get(struct pixman_surface_state *ps, struct weston_output *output,
+		pixman_transform_t *transform)
+{
+	pixman_fixed_t (*m)[3] = transform->matrix;
+	struct pixman_scale_key key;
+	pixman_transform_t scale;
+	int64_t ox, oy;
+	int width, height;
+
+	/* solid color surfaces */
+	if (!pixman_image_get_data(ps->image))
+		return NULL;
+
+	if (m[0][1] != 0 || m[1][0] != 0 ||
+	    m[2][0] != 0 || m[2][1] != 0 || m[2][2] != pixman_fixed_1)
+		return NULL;
+
+	if (m[0][0] < pixman_fixed_1 || m[1][1] < pixman_fixed_1 ||
+	    (m[0][0] == pixman_fixed_1 && m[1][1] == pixman_fixed_1))
+		return NULL;
+
+	/* src = s * dst + t = s * (dst - o) + r with o integer and
+	 * -s < r <= 0, o being the floor of -t / s */
+	ox = floor_div(-(int64_t) m[0][2], m[0][0]);
+	oy = floor_div(-(int64_t) m[1][2], m[1][1]);
+	key.sx = m[0][0];
+	key.sy = m[1][1];
+	key.rx = m[0][2] + ox * m[0][0];
+	key.ry = m[1][2] + oy * m[1][1];
+
+	if (!ps->scaled_image ||
+	    memcmp(&key, &ps->scale_key, sizeof key) != 0) {
+		if (memcmp(&key, &ps->scale_candidate, sizeof key) != 0 ||
+		    ps->scale_candidate_time == output->frame_time) {
+			ps->scale_candidate = key;
+			ps->scale_candidate_time = output->frame_time;
+			return NULL;
+		}
+
+		if (ps->scaled_image)
+			pixman_image_unref(ps->scaled_image);
+
+		/* One extra column and row on either side for the
+		 * partially covered edge pixels. */
+		width = floor_div(((int64_t) pixman_image_get_width(ps->image)
+				   << 16) - key.rx + key.sx - 1, key.sx) + 2;
+		height = floor_div(((int64_t) pixman_image_get_height(ps->image)
+				    << 16) - key.ry + key.sy - 1, key.sy) + 2;
+		ps->scaled_image = pixman_image_create_bits(PIXMAN_a8r8g8b8,
+							    width, height,
+							    NULL, 0);
+		if (!ps->scaled_image)
+			return NULL;
+
+		pixman_transform_init_scale(&scale, key.sx, key.sy);
+		scale.matrix[0][2] = key.rx - key.sx;
+		scale.matrix[1][2] = key.ry - key.sy;
+		pixman_image_set_transform(ps->image, &scale);
+		pixman_image_set_filter(ps->image, PIXMAN_FILTER_BILINEAR,
+					NULL, 0);
+
+		if (ps->buffer_ref.buffer)
+			wl_shm_buffer_begin_access(ps->buffer_ref.buffer->shm_buffer);
+		pixman_image_composite32(PIXMAN_OP_SRC,
+					 ps->image, NULL, ps->scaled_image,
+					 0, 0, 0, 0, 0, 0, width, height);
+		if (ps->buffer_ref.buffer)
+			wl_shm_buffer_end_access(ps->buffer_ref.buffer->shm_buffer);
+
+		ps->scale_key = key;
+	}
+
+	pixman_transform_init_translate(transform,
+					pixman_int_to_fixed(1 - ox),
+					pixman_int_to_fixed(1 - oy));
+
+	return ps->scaled_image;
+}
+
 static void
 repaint_region(struct weston_view *ev, struct weston_output *output,
+	       pixman_image_t *target,
 	       pixman_region32_t *region, pixman_region32_t *surf_region,
 	       pixman_op_t pixman_op)
 {
 	struct pixman_renderer *pr =
 		(struct pixman_renderer *) output->compositor->renderer;
 	struct pixman_surface_state *ps = get_surface_state(ev->surface);
-	struct pixman_output_state *po = get_output_state(output);
 	struct weston_buffer_viewport *vp = &ev->surface->buffer_viewport;
 	pixman_region32_t final_region;
 	float view_x, view_y;
 	pixman_transform_t transform;
 	pixman_fixed_t fw, fh;
+	pixman_image_t *src_image;
 	pixman_image_t *mask_image;
 	pixman_color_t mask = { 0, };
 
@@ -212,7 +382,7 @@ repaint_region(struct weston_view *ev, struct weston_output *output,
 	region_global_to_output(output, &final_region);
 
 	/* And clip to it */
-	pixman_image_set_clip_region32 (po->shadow_image, &final_region);
+	pixman_image_set_clip_region32 (target, &final_region);
 
 	/* Set up the source transformation based on the surface
 	   position, the output position/transform/scale and the client
@@ -332,12 +502,20 @@ repaint_region(struct weston_view *ev, struct weston_output *output,
 			       pixman_double_to_fixed(vp->buffer.scale),
 			       pixman_double_to_fixed(vp->buffer.scale));
 
-	pixman_image_set_transform(ps->image, &transform);
+	src_image = scale_cache_get(ps, output, &transform);
+	if (src_image) {
+		pixman_image_set_transform(src_image, &transform);
+		pixman_image_set_filter(src_image, PIXMAN_FILTER_NEAREST,
+					NULL, 0);
+	} else {
+		src_image = ps->image;
+		pixman_image_set_transform(ps->image, &transform);
 
-	if (ev->transform.enabled || output->current_scale != vp->buffer.scale)
-		pixman_image_set_filter(ps->image, PIXMAN_FILTER_BILINEAR, NULL, 0);
-	else
-		pixman_image_set_filter(ps->image, PIXMAN_FILTER_NEAREST, NULL, 0);
+		if (ev->transform.enabled || output->current_scale != vp->buffer.scale)
+			pixman_image_set_filter(ps->image, PIXMAN_FILTER_BILINEAR, NULL, 0);
+		else
+			pixman_image_set_filter(ps->image, PIXMAN_FILTER_NEAREST, NULL, 0);
+	}
 
 	if (ps->buffer_ref.buffer)
 		wl_shm_buffer_begin_access(ps->buffer_ref.buffer->shm_buffer);
@@ -349,15 +527,23 @@ repaint_region(struct weston_view *ev, struct weston_output *output,
 		mask_image = NULL;
 	}
 
+	/* An opaque view scaled with the bilinear filter must stay
+	 * opaque up to its edges when it replaces what is below. */
+	if (pixman_op == PIXMAN_OP_SRC)
+		pixman_image_set_repeat(src_image, PIXMAN_REPEAT_PAD);
+
 	pixman_image_composite32(pixman_op,
-				 ps->image, /* src */
+				 src_image, /* src */
 				 mask_image, /* mask */
-				 po->shadow_image, /* dest */
+				 target, /* dest */
 				 0, 0, /* src_x, src_y */
 				 0, 0, /* mask_x, mask_y */
 				 0, 0, /* dest_x, dest_y */
-				 pixman_image_get_width (po->shadow_image), /* width */
-				 pixman_image_get_height (po->shadow_image) /* height */);
+				 pixman_image_get_width (target), /* width */
+				 pixman_image_get_height (target) /* height */);
+
+	if (pixman_op == PIXMAN_OP_SRC)
+		pixman_image_set_repeat(src_image, PIXMAN_REPEAT_NONE);
 
 	if (mask_image)
 		pixman_image_unref(mask_image);
@@ -369,20 +555,54 @@ repaint_region(struct weston_view *ev, struct weston_output *output,
 		pixman_image_composite32(PIXMAN_OP_OVER,
 					 pr->debug_color, /* src */
 					 NULL /* mask */,
-					 po->shadow_image, /* dest */
+					 target, /* dest */
 					 0, 0, /* src_x, src_y */
 					 0, 0, /* mask_x, mask_y */
 					 0, 0, /* dest_x, dest_y */
-					 pixman_image_get_width (po->shadow_image), /* width */
-					 pixman_image_get_height (po->shadow_image) /* height */);
+					 pixman_image_get_width (target), /* width */
+					 pixman_image_get_height (target) /* height */);
 
-	pixman_image_set_clip_region32 (po->shadow_image, NULL);
+	pixman_image_set_clip_region32 (target, NULL);
 
 	pixman_region32_fini(&final_region);
 }
 
+/* Whether all of the view replaces what is below it: it is drawn with
+ * PIXMAN_OP_SRC, and never reads from the image it is drawn into.
+ */
+static int
+view_is_opaque(struct weston_view *ev)
+{
+	struct pixman_surface_state *ps = get_surface_state(ev->surface);
+	pixman_format_code_t format = pixman_image_get_format(ps->image);
+	pixman_region32_t surface_blend;
+	int opaque;
+
+	if (ev->alpha != 1.0)
+		return 0;
+
+	if (ev->transform.enabled &&
+	    (ev->transform.matrix.type & ~(WESTON_MATRIX_TRANSFORM_TRANSLATE |
+					   WESTON_MATRIX_TRANSFORM_SCALE)))
+		return 0;
+
+	/* Only bits images have a format. */
+	if (format != 0 && PIXMAN_FORMAT_A(format) == 0)
+		return 1;
+
+	pixman_region32_init_rect(&surface_blend, 0, 0,
+				  ev->surface->width, ev->surface->height);
+	pixman_region32_subtract(&surface_blend, &surface_blend,
+				 &ev->surface->opaque);
+	opaque = !pixman_region32_not_empty(&surface_blend);
+	pixman_region32_fini(&surface_blend);
+
+	return opaque;
+}
+
 static void
 draw_view(struct weston_view *ev, struct weston_output *output,
+	  pixman_image_t *target,
 	  pixman_region32_t *damage) /* in global coordinates */
 {
 	struct pixman_surface_state *ps = get_surface_state(ev->surface);
@@ -409,10 +629,14 @@ draw_view(struct weston_view *ev, struct weston_output *output,
 	}
 
 	/* TODO: Implement repaint_region_complex() using pixman_composite_trapezoids() */
-	if (ev->alpha != 1.0 ||
-	    (ev->transform.enabled &&
-	     ev->transform.matrix.type != WESTON_MATRIX_TRANSFORM_TRANSLATE)) {
-		repaint_region(ev, output, &repaint, NULL, PIXMAN_OP_OVER);
+	if (view_is_opaque(ev)) {
+		repaint_region(ev, output, target, &repaint, NULL,
+			       PIXMAN_OP_SRC);
+	} else if (ev->alpha != 1.0 ||
+		   (ev->transform.enabled &&
+		    ev->transform.matrix.type != WESTON_MATRIX_TRANSFORM_TRANSLATE)) {
+		repaint_region(ev, output, target, &repaint, NULL,
+			       PIXMAN_OP_OVER);
 	} else {
 		/* blended region is whole surface minus opaque region: */
 		pixman_region32_init_rect(&surface_blend, 0, 0,
@@ -420,11 +644,13 @@ draw_view(struct weston_view *ev, struct weston_output *output,
 		pixman_region32_subtract(&surface_blend, &surface_blend, &ev->surface->opaque);
 
 		if (pixman_region32_not_empty(&ev->surface->opaque)) {
-			repaint_region(ev, output, &repaint, &ev->surface->opaque, PIXMAN_OP_SRC);
+			repaint_region(ev, output, target, &repaint,
+				       &ev->surface->opaque, PIXMAN_OP_SRC);
 		}
 
 		if (pixman_region32_not_empty(&surface_blend)) {
-			repaint_region(ev, output, &repaint, &surface_blend, PIXMAN_OP_OVER);
+			repaint_region(ev, output, target, &repaint,
+				       &surface_blend, PIXMAN_OP_OVER);
 		}
 		pixman_region32_fini(&surface_blend);
 	}
@@ -434,14 +660,68 @@ out:
 	pixman_region32_fini(&repaint);
 }
 static void
-repaint_surfaces(struct weston_output *output, pixman_region32_t *damage)
+repaint_surfaces(struct weston_output *output, pixman_image_t *target,
+		 pixman_region32_t *damage)
 {
 	struct weston_compositor *compositor = output->compositor;
 	struct weston_view *view;
 
 	wl_list_for_each_reverse(view, &compositor->view_list, link)
 		if (view->plane == &compositor->primary_plane)
-			draw_view(view, output, damage);
+			draw_view(view, output, target, damage);
+}
+
+/* The shadow image is there so that blending never reads from the
+ * hardware buffer, which is often slow to read, and to copy only
+ * finished pixels to it. When every damaged pixel comes from a single
+ * opaque view, as with fullscreen-shell showing one opaque client,
+ * centered on its black backdrop or scaled, nothing is read and the
+ * views can be drawn straight into the hardware buffer: one copy of
+ * the client buffer instead of two. */
+static int
+can_draw_direct(struct weston_output *output, pixman_region32_t *damage)
+{
+	struct weston_compositor *compositor = output->compositor;
+	struct pixman_renderer *pr = get_renderer(compositor);
+	struct weston_view *view;
+	pixman_region32_t repaint, covered;
+	int direct = 1;
+
+	if (pr->repaint_debug || output->zoom.active)
+		return 0;
+
+	pixman_region32_init(&repaint);
+	pixman_region32_init(&covered);
+
+	wl_list_for_each(view, &compositor->view_list, link) {
+		if (view->plane != &compositor->primary_plane ||
+		    !get_surface_state(view->surface)->image)
+			continue;
+
+		pixman_region32_intersect(&repaint,
+					  &view->transform.boundingbox, damage);
+		pixman_region32_subtract(&repaint, &repaint, &view->clip);
+		if (!pixman_region32_not_empty(&repaint))
+			continue;
+
+		if (!view_is_opaque(view)) {
+			direct = 0;
+			break;
+		}
+
+		pixman_region32_union(&covered, &covered, &repaint);
+	}
+
+	/* Nothing may be left showing the old contents of the buffer. */
+	if (direct) {
+		pixman_region32_subtract(&repaint, damage, &covered);
+		direct = !pixman_region32_not_empty(&repaint);
+	}
+
+	pixman_region32_fini(&repaint);
+	pixman_region32_fini(&covered);
+
+	return direct;
 }
 
 static void
@@ -479,8 +759,17 @@ pixman_renderer_repaint_output(struct weston_output *output,
 	if (!po->hw_buffer)
 		return;
 
-	repaint_surfaces(output, output_damage);
-	copy_to_hw_buffer(output, output_damage);
+	if (can_draw_direct(output, output_damage)) {
+		repaint_surfaces(output, po->hw_buffer, output_damage);
+		pixman_region32_union(&po->shadow_stale, &po->shadow_stale,
+				      output_damage);
+	} else {
+		pixman_region32_union(&po->shadow_stale, &po->shadow_stale,
+				      output_damage);
+		repaint_surfaces(output, po->shadow_image, &po->shadow_stale);
+		copy_to_hw_buffer(output, &po->shadow_stale);
+		pixman_region32_clear(&po->shadow_stale);
+	}
 
 	pixman_region32_copy(&output->previous_damage, output_damage);
 	wl_signal_emit(&output->frame_signal, output);
@@ -488,26 +777,233 @@ pixman_renderer_repaint_output(struct weston_output *output,
 	/* Actual flip should be done by caller */
 }
 
+static int
+surface_copy_buffers(struct weston_surface *surface)
+{
+	struct pixman_renderer *pr = get_renderer(surface->compositor);
+
+	if (surface->output && surface->output->renderer_state)
+		return get_output_state(surface->output)->copy_buffers;
+
+	return pr->copy_buffers;
+}
+
 static void
-pixman_renderer_flush_damage(struct weston_surface *surface)
+copy_buffer_rect(struct pixman_surface_state *ps,
+		 const struct yuv_planes *yuv, pixman_box32_t r)
 {
-	/* No-op for pixman renderer */
+	if (yuv)
+		yuv_convert_rect(yuv, pixman_image_get_data(ps->copy_image),
+				 pixman_image_get_stride(ps->copy_image),
+				 r.x1, r.y1, r.x2 - r.x1, r.y2 - r.y1);
+	else
+		pixman_image_composite32(PIXMAN_OP_SRC,
+					 ps->image, NULL, ps->copy_image,
+					 r.x1, r.y1, 0, 0, r.x1, r.y1,
+					 r.x2 - r.x1, r.y2 - r.y1);
 }
 
 static void
-buffer_state_handle_buffer_destroy(struct wl_listener *listener, void *data)
+pixman_renderer_flush_damage(struct weston_surface *surface)
 {
-	struct pixman_surface_state *ps;
+	struct pixman_surface_state *ps = get_surface_state(surface);
+	struct weston_buffer *buffer = ps->buffer_ref.buffer;
+	struct yuv_planes planes, *yuv = NULL;
+	pixman_format_code_t format;
+	pixman_box32_t *rectangles;
+	pixman_box32_t r;
+	int i, n;
+
+	if (pixman_region32_not_empty(&surface->damage))
+		scale_cache_invalidate(ps);
+
+	if (!buffer || (!ps->image && !ps->yuv))
+		return;
 
-	ps = container_of(listener, struct pixman_surface_state,
-			  buffer_destroy_listener);
+	if (!ps->yuv && !surface_copy_buffers(surface)) {
+		if (ps->copy_image) {
+			pixman_image_unref(ps->copy_image);
+			ps->copy_image = NULL;
+		}
+		return;
+	}
+
+	if (ps->yuv)
+		format = PIXMAN_x8r8g8b8;
+	else
+		format = pixman_image_get_format(ps->image);
+
+	if (!ps->copy_image ||
+	    pixman_image_get_format(ps->copy_image) != format ||
+	    pixman_image_get_width(ps->copy_image) != buffer->width ||
+	    pixman_image_get_height(ps->copy_image) != buffer->height) {
+		if (ps->copy_image)
+			pixman_image_unref(ps->copy_image);
+		ps->copy_image = pixman_image_create_bits(format,
+							  buffer->width,
+							  buffer->height,
+							  NULL, 0);
+		ps->copy_valid = 0;
+		if (!ps->copy_image)
+			return;
+	}
 
 	if (ps->image) {
+		/* The buffer image may still carry the transform of a
+		 * previous repaint. */
+		pixman_image_set_transform(ps->image, NULL);
+		pixman_image_set_filter(ps->image, PIXMAN_FILTER_NEAREST,
+					NULL, 0);
+	}
+
+	wl_shm_buffer_begin_access(buffer->shm_buffer);
+
+	if (ps->yuv) {
+		yuv = &planes;
+		yuv_planes_init(yuv, ps->yuv_format,
+				wl_shm_buffer_get_data(buffer->shm_buffer),
+				wl_shm_buffer_get_stride(buffer->shm_buffer),
+				buffer->width, buffer->height);
+	}
+
+	if (!ps->copy_valid) {
+		r.x1 = 0;
+		r.y1 = 0;
+		r.x2 = buffer->width;
+		r.y2 = buffer->height;
+		copy_buffer_rect(ps, yuv, r);
+	} else {
+		rectangles = pixman_region32_rectangles(&surface->damage, &n);
+		for (i = 0; i < n; i++) {
+			r = weston_surface_to_buffer_rect(surface,
+							  rectangles[i]);
+			/* pixman clips, the converter does not */
+			if (r.x1 < 0)
+				r.x1 = 0;
+			if (r.y1 < 0)
+				r.y1 = 0;
+			r.x2 = MIN(r.x2, buffer->width);
+			r.y2 = MIN(r.y2, buffer->height);
+			if (r.x1 < r.x2 && r.y1 < r.y2)
+				copy_buffer_rect(ps, yuv, r);
+		}
+	}
+
+	wl_shm_buffer_end_access(buffer->shm_buffer);
+
+	ps->copy_valid = 1;
+
+	/* Draw from the copy and let the client have its buffer back. */
+	if (ps->image)
+		pixman_image_unref(ps->image);
+	ps->image = pixman_image_ref(ps->copy_image);
+	weston_buffer_reference(&ps->buffer_ref, NULL);
+}
+
+static void
+buffer_image_destroy(struct pixman_buffer_image *bi)
+{
+	struct pixman_surface_state *ps = bi->ps;
+
+	if (ps->image == bi->image) {
 		pixman_image_unref(ps->image);
 		ps->image = NULL;
 	}
 
-	ps->buffer_destroy_listener.notify = NULL;
+	pixman_image_unref(bi->image);
+	wl_list_remove(&bi->buffer_destroy_listener.link);
+	wl_list_remove(&bi->link);
+	ps->num_buffer_images--;
+	free(bi);
+}
+
+static void
+buffer_image_handle_buffer_destroy(struct wl_listener *listener, void *data)
+{
+	struct pixman_buffer_image *bi;
+
+	bi = container_of(listener, struct pixman_buffer_image,
+			  buffer_destroy_listener);
+
+	buffer_image_destroy(bi);
+}
+
+static pixman_image_t *
+buffer_image_get(struct pixman_surface_state *ps,
+		 struct weston_buffer *buffer,
+		 pixman_format_code_t pixman_format)
+{
+	struct pixman_buffer_image *bi;
+	void *data = wl_shm_buffer_get_data(buffer->shm_buffer);
+
+	wl_list_for_each(bi, &ps->buffer_images, link) {
+		if (bi->buffer != buffer)
+			continue;
+
+		if (bi->data != data) {
+			buffer_image_destroy(bi);
+			break;
+		}
+
+		wl_list_remove(&bi->link);
+		wl_list_insert(&ps->buffer_images, &bi->link);
+
+		return bi->image;
+	}
+
+	if (ps->num_buffer_images == BUFFER_IMAGE_CACHE_SIZE) {
+		bi = container_of(ps->buffer_images.prev,
+				  struct pixman_buffer_image, link);
+		buffer_image_destroy(bi);
+	}
+
+	bi = zalloc(sizeof *bi);
+	if (!bi)
+		return NULL;
+
+	bi->image = pixman_image_create_bits(pixman_format,
+		buffer->width, buffer->height, data,
+		wl_shm_buffer_get_stride(buffer->shm_buffer));
+	if (!bi->image) {
+		free(bi);
+		return NULL;
+	}
+
+	bi->ps = ps;
+	bi->buffer = buffer;
+	bi->data = data;
+	bi->buffer_destroy_listener.notify =
+		buffer_image_handle_buffer_destroy;
+	wl_signal_add(&buffer->destroy_signal, &bi->buffer_destroy_listener);
+	wl_list_insert(&ps->buffer_images, &bi->link);
+	ps->num_buffer_images++;
+
+	return bi->image;
+}
+
+static int
+yuv_buffer_check(struct wl_shm_buffer *shm_buffer, enum yuv_format format)
+{
+	size_t size;
+
+	size = yuv_buffer_size(format,
+			       wl_shm_buffer_get_stride(shm_buffer),
+			       wl_shm_buffer_get_width(shm_buffer),
+			       wl_shm_buffer_get_height(shm_buffer));
+	if (size == 0) {
+		weston_log("YUV buffer stride too small for its width\n");
+		return -1;
+	}
+
+	/* libwayland checked stride * height against the pool, and does
+	 * not tell its size, so that is all we may read. */
+	if (size > (size_t) wl_shm_buffer_get_stride(shm_buffer) *
+		   wl_shm_buffer_get_height(shm_buffer)) {
+		weston_log("YUV buffer planes exceed the checked size\n");
+		return -1;
+	}
+
+	return 0;
 }
 
 static void
@@ -518,16 +1014,13 @@ pixman_renderer_attach(struct weston_surface *es, struct weston_buffer *buffer)
 	pixman_format_code_t pixman_format;
 
 	weston_buffer_reference(&ps->buffer_ref, buffer);
-
-	if (ps->buffer_destroy_listener.notify) {
-		wl_list_remove(&ps->buffer_destroy_listener.link);
-		ps->buffer_destroy_listener.notify = NULL;
-	}
+	scale_cache_invalidate(ps);
 
 	if (ps->image) {
 		pixman_image_unref(ps->image);
 		ps->image = NULL;
 	}
+	ps->yuv = 0;
 
 	if (!buffer)
 		return;
@@ -550,6 +1043,18 @@ pixman_renderer_attach(struct weston_surface *es, struct weston_buffer *buffer)
 	case WL_SHM_FORMAT_RGB565:
 		pixman_format = PIXMAN_r5g6b5;
 		break;
+	case WL_SHM_FORMAT_YUYV:
+		ps->yuv = 1;
+		ps->yuv_format = YUV_FORMAT_YUYV;
+		break;
+	case WL_SHM_FORMAT_NV12:
+		ps->yuv = 1;
+		ps->yuv_format = YUV_FORMAT_NV12;
+		break;
+	case WL_SHM_FORMAT_YUV420:
+		ps->yuv = 1;
+		ps->yuv_format = YUV_FORMAT_YUV420;
+		break;
 	default:
 		weston_log("Unsupported SHM buffer format\n");
 		weston_buffer_reference(&ps->buffer_ref, NULL);
@@ -561,26 +1066,35 @@ pixman_renderer_attach(struct weston_surface *es, struct weston_buffer *buffer)
 	buffer->width = wl_shm_buffer_get_width(shm_buffer);
 	buffer->height = wl_shm_buffer_get_height(shm_buffer);
 
-	ps->image = pixman_image_create_bits(pixman_format,
-		buffer->width, buffer->height,
-		wl_shm_buffer_get_data(shm_buffer),
-		wl_shm_buffer_get_stride(shm_buffer));
+	/* Converted on flush, the chroma planes are expected right after
+	 * the luma plane in the same buffer. */
+	if (ps->yuv) {
+		if (yuv_buffer_check(shm_buffer, ps->yuv_format) < 0) {
+			ps->yuv = 0;
+			weston_buffer_reference(&ps->buffer_ref, NULL);
+		}
+		return;
+	}
+
+	ps->image = buffer_image_get(ps, buffer, pixman_format);
+	if (!ps->image) {
+		weston_buffer_reference(&ps->buffer_ref, NULL);
+		return;
+	}
 
-	ps->buffer_destroy_listener.notify =
-		buffer_state_handle_buffer_destroy;
-	wl_signal_add(&buffer->destroy_signal,
-		      &ps->buffer_destroy_listener);
+	pixman_image_ref(ps->image);
 }
 
 static void
 pixman_renderer_surface_state_destroy(struct pixman_surface_state *ps)
 {
+	struct pixman_buffer_image *bi, *next;
+
 	wl_list_remove(&ps->surface_destroy_listener.link);
 	wl_list_remove(&ps->renderer_destroy_listener.link);
-	if (ps->buffer_destroy_listener.notify) {
-		wl_list_remove(&ps->buffer_destroy_listener.link);
-		ps->buffer_destroy_listener.notify = NULL;
-	}
+
+	wl_list_for_each_safe(bi, next, &ps->buffer_images, link)
+		buffer_image_destroy(bi);
 
 	ps->surface->renderer_state = NULL;
 
@@ -588,6 +1102,11 @@ pixman_renderer_surface_state_destroy(struct pixman_surface_state *ps)
 		pixman_image_unref(ps->image);
 		ps->image = NULL;
 	}
+	if (ps->copy_image) {
+		pixman_image_unref(ps->copy_image);
+		ps->copy_image = NULL;
+	}
+	scale_cache_invalidate(ps);
 	weston_buffer_reference(&ps->buffer_ref, NULL);
 	free(ps);
 }
@@ -627,6 +1146,7 @@ pixman_renderer_create_surface(struct weston_surface *surface)
 	surface->renderer_state = ps;
 
 	ps->surface = surface;
+	wl_list_init(&ps->buffer_images);
 
 	ps->surface_destroy_listener.notify =
 		surface_state_handle_surface_destroy;
@@ -652,7 +1172,9 @@ pixman_renderer_surface_set_color(struct weston_surface *es,
 	color.green = green * 0xffff;
 	color.blue = blue * 0xffff;
 	color.alpha = alpha * 0xffff;
-	
+
+	scale_cache_invalidate(ps);
+
 	if (ps->image) {
 		pixman_image_unref(ps->image);
 		ps->image = NULL;
@@ -698,11 +1220,16 @@ WL_EXPORT int
 pixman_renderer_init(struct weston_compositor *ec)
 {
 	struct pixman_renderer *renderer;
+	struct weston_config_section *section;
 
 	renderer = calloc(1, sizeof *renderer);
 	if (renderer == NULL)
 		return -1;
 
+	section = weston_config_get_section(ec->config, "core", NULL, NULL);
+	weston_config_section_get_bool(section, "pixman-copy-buffers",
+				       &renderer->copy_buffers, 0);
+
 	renderer->repaint_debug = 0;
 	renderer->debug_color = NULL;
 	renderer->base.read_pixels = pixman_renderer_read_pixels;
@@ -720,6 +1247,9 @@ pixman_renderer_init(struct weston_compositor *ec)
 						    debug_binding, ec);
 
 	wl_display_add_shm_format(ec->wl_display, WL_SHM_FORMAT_RGB565);
+	wl_display_add_shm_format(ec->wl_display, WL_SHM_FORMAT_YUYV);
+	/* NV12 and YUV420 would pass yuv_buffer_check() only once the
+	 * pool size is known, their chroma follows stride * height. */
 
 	wl_signal_init(&renderer->destroy_signal);
 
@@ -741,15 +1271,41 @@ pixman_renderer_output_set_buffer(struct weston_output *output, pixman_image_t *
 	}
 }
 
+/* The last frame rendered on the output, in its buffer coordinates. The
+ * image keeps no transform or filter set between repaints. Only valid
+ * during the repaint of the output, since what was drawn straight into
+ * the hardware buffer is drawn into it again then. */
+WL_EXPORT pixman_image_t *
+pixman_renderer_output_get_shadow(struct weston_output *output)
+{
+	struct pixman_output_state *po = get_output_state(output);
+
+	if (pixman_region32_not_empty(&po->shadow_stale)) {
+		repaint_surfaces(output, po->shadow_image, &po->shadow_stale);
+		pixman_region32_clear(&po->shadow_stale);
+	}
+
+	return po->shadow_image;
+}
+
 WL_EXPORT int
 pixman_renderer_output_create(struct weston_output *output)
 {
+	struct pixman_renderer *pr = get_renderer(output->compositor);
 	struct pixman_output_state *po = calloc(1, sizeof *po);
+	struct weston_config_section *section = NULL;
 	int w, h;
 
 	if (!po)
 		return -1;
 
+	if (output->name)
+		section = weston_config_get_section(output->compositor->config,
+						    "output", "name",
+						    output->name);
+	weston_config_section_get_bool(section, "pixman-copy-buffers",
+				       &po->copy_buffers, pr->copy_buffers);
+
 	/* set shadow image transformation */
 	w = output->current_mode->width;
 	h = output->current_mode->height;
@@ -771,6 +1327,8 @@ pixman_renderer_output_create(struct weston_output *output)
 		return -1;
 	}
 
+	pixman_region32_init(&po->shadow_stale);
+
 	output->renderer_state = po;
 
 	return 0;
@@ -782,6 +1340,7 @@ pixman_renderer_output_destroy(struct weston_output *output)
 	struct pixman_output_state *po = get_output_state(output);
 
 	pixman_image_unref(po->shadow_image);
+	pixman_region32_fini(&po->shadow_stale);
 
 	if (po->hw_buffer)
 		pixman_image_unref(po->hw_buffer);
@@ -33,5 +33,8 @@ pixman_renderer_output_create(struct weston_output *output);
 void
 pixman_renderer_output_set_buffer(struct weston_output *output, pixman_image_t *buffer);
 
+pixman_image_t *
+pixman_renderer_output_get_shadow(struct weston_output *output);
+
 void
 pixman_renderer_output_destroy(struct weston_output *output);
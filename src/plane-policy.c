@@ -0,0 +1,217 @@
+/*
+ * Copyright © 2014 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "plane-policy.h"
+
+/* Upper bound on the search nodes visited per assignment, so a scene
+ * with many candidate views cannot stall the repaint. The greedy
+ * assignment is always found first. */
+#define MAX_STEPS 4096
+
+struct search {
+	const struct plane_policy_plane *planes;
+	int count_planes;
+	const struct plane_policy_view *views;
+	int count_views;
+	int32_t width, height;
+
+	int *current;
+	int *best;
+	int64_t best_cost;
+	int steps;
+};
+
+static int
+views_overlap(const struct plane_policy_view *a,
+	      const struct plane_policy_view *b)
+{
+	return a->x1 < b->x2 && b->x1 < a->x2 &&
+	       a->y1 < b->y2 && b->y1 < a->y2;
+}
+
+static int64_t
+view_area(const struct search *s, const struct plane_policy_view *view)
+{
+	int32_t x1 = view->x1 > 0 ? view->x1 : 0;
+	int32_t y1 = view->y1 > 0 ? view->y1 : 0;
+	int32_t x2 = view->x2 < s->width ? view->x2 : s->width;
+	int32_t y2 = view->y2 < s->height ? view->y2 : s->height;
+
+	if (x1 >= x2 || y1 >= y2)
+		return 0;
+
+	return (int64_t) (x2 - x1) * (y2 - y1);
+}
+
+static int
+plane_accepts(const struct plane_policy_plane *plane,
+	      const struct plane_policy_view *view)
+{
+	uint32_t flags = view->flags;
+	int i;
+
+	if (flags & (PLANE_POLICY_VIEW_PRIMARY | PLANE_POLICY_VIEW_TRANSFORMED))
+		return 0;
+
+	if ((flags & PLANE_POLICY_VIEW_SCALED) && !plane->can_scale)
+		return 0;
+
+	if ((plane->max_width && view->x2 - view->x1 > plane->max_width) ||
+	    (plane->max_height && view->y2 - view->y1 > plane->max_height))
+		return 0;
+
+	switch (plane->type) {
+	case PLANE_POLICY_CURSOR:
+		if (!(flags & PLANE_POLICY_VIEW_SHM))
+			return 0;
+		break;
+	case PLANE_POLICY_SCANOUT:
+		if (!(flags & PLANE_POLICY_VIEW_FULLSCREEN))
+			return 0;
+		/* fall through */
+	case PLANE_POLICY_OVERLAY:
+		if (flags & (PLANE_POLICY_VIEW_SHM | PLANE_POLICY_VIEW_ALPHA))
+			return 0;
+		break;
+	}
+
+	if (plane->count_formats == 0 || view->format == 0)
+		return 1;
+
+	for (i = 0; i < plane->count_formats; i++)
+		if (plane->formats[i] == view->format)
+			return 1;
+
+	return 0;
+}
+
+/* Whether view i can go on plane p, given the views above it. */
+static int
+can_place(const struct search *s, int i, int p)
+{
+	const struct plane_policy_plane *plane = &s->planes[p];
+	const struct plane_policy_view *view = &s->views[i];
+	const struct plane_policy_plane *above;
+	int j, q;
+
+	if (!plane_accepts(plane, view))
+		return 0;
+
+	for (j = 0; j < i; j++) {
+		q = s->current[j];
+		if (q == p)
+			return 0;
+		if (!views_overlap(&s->views[j], view))
+			continue;
+
+		/* Anything composited above must stay above, and the
+		 * hardware puts every plane on top of the primary one. */
+		if (q == PLANE_POLICY_PRIMARY)
+			return 0;
+
+		above = &s->planes[q];
+		if (above->type != PLANE_POLICY_OVERLAY)
+			continue;
+		if (plane->type == PLANE_POLICY_CURSOR)
+			return 0;
+		if (plane->type == PLANE_POLICY_OVERLAY &&
+		    above->zpos <= plane->zpos)
+			return 0;
+	}
+
+	return 1;
+}
+
+static void
+search(struct search *s, int i, int64_t cost)
+{
+	int j, p;
+
+	if (cost >= s->best_cost)
+		return;
+
+	if (s->steps++ >= MAX_STEPS && s->best_cost != INT64_MAX)
+		return;
+
+	if (i == s->count_views) {
+		s->best_cost = cost;
+		memcpy(s->best, s->current, i * sizeof *s->best);
+		return;
+	}
+
+	for (p = 0; p < s->count_planes; p++) {
+		if (!can_place(s, i, p))
+			continue;
+
+		s->current[i] = p;
+		if (s->planes[p].type != PLANE_POLICY_SCANOUT) {
+			search(s, i + 1, cost);
+			continue;
+		}
+
+		/* Everything below a scanout view is hidden by it. */
+		for (j = i + 1; j < s->count_views; j++)
+			s->current[j] = PLANE_POLICY_PRIMARY;
+		search(s, s->count_views, cost);
+	}
+
+	s->current[i] = PLANE_POLICY_PRIMARY;
+	search(s, i + 1, cost + view_area(s, &s->views[i]));
+}
+
+int64_t
+plane_policy_assign(const struct plane_policy_plane *planes, int count_planes,
+		    const struct plane_policy_view *views, int count_views,
+		    int32_t width, int32_t height, int *assignment)
+{
+	struct search s;
+	int64_t cost = 0;
+	int i;
+
+	s.width = width;
+	s.height = height;
+	s.current = malloc((count_views + 1) * sizeof *s.current);
+	if (s.current == NULL) {
+		for (i = 0; i < count_views; i++) {
+			assignment[i] = PLANE_POLICY_PRIMARY;
+			cost += view_area(&s, &views[i]);
+		}
+		return cost;
+	}
+
+	s.planes = planes;
+	s.count_planes = count_planes;
+	s.views = views;
+	s.count_views = count_views;
+	s.best = assignment;
+	s.best_cost = INT64_MAX;
+	s.steps = 0;
+
+	search(&s, 0, 0);
+	free(s.current);
+
+	return s.best_cost;
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright © 2014 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef _WESTON_PLANE_POLICY_H
+#define _WESTON_PLANE_POLICY_H
+
+#include <stdint.h>
+
+/* Plane assignment, independent of any backend: given what the hardware
+ * planes can do and the views of an output, decide which views go on
+ * which plane so that the least area is left to the renderer.
+ *
+ * The drm backend logs its scenes (debug binding mod+shift+space, P)
+ * in this text form, one item per line, which tests/plane-policy-test.c
+ * replays:
+ *
+ *   output <width> <height>
+ *   plane cursor|scanout|overlay [zpos=<n>] [scale] [max=<w>x<h>]
+ *         [formats=<fourcc>,...]
+ *   view <x1> <y1> <x2> <y2> [format=<fourcc>] [primary] [shm]
+ *        [alpha] [scaled] [transformed] [fullscreen]
+ *
+ * Views are listed top to bottom, as in weston_compositor::view_list.
+ */
+
+#define PLANE_POLICY_PRIMARY	-1
+
+enum plane_policy_plane_type {
+	PLANE_POLICY_CURSOR,
+	PLANE_POLICY_SCANOUT,
+	PLANE_POLICY_OVERLAY
+};
+
+struct plane_policy_plane {
+	enum plane_policy_plane_type type;
+	int zpos;		/* among overlays, higher is on top */
+	int can_scale;
+	int32_t max_width;	/* 0 for no limit */
+	int32_t max_height;
+	int count_formats;	/* 0 takes any format */
+	const uint32_t *formats;
+};
+
+enum plane_policy_view_flags {
+	PLANE_POLICY_VIEW_PRIMARY = (1 << 0),	/* must be composited */
+	PLANE_POLICY_VIEW_SHM = (1 << 1),	/* only fits the cursor */
+	PLANE_POLICY_VIEW_ALPHA = (1 << 2),	/* needs blending */
+	PLANE_POLICY_VIEW_SCALED = (1 << 3),
+	PLANE_POLICY_VIEW_TRANSFORMED = (1 << 4),
+	PLANE_POLICY_VIEW_FULLSCREEN = (1 << 5)	/* scanout candidate */
+};
+
+struct plane_policy_view {
+	int32_t x1, y1, x2, y2;	/* bounding box, output coordinates */
+	uint32_t format;	/* 0 if not known */
+	uint32_t flags;
+};
+
+/* Fill assignment with a plane index, or PLANE_POLICY_PRIMARY, for each
+ * view. The planes are tried in the order given, so the first result
+ * considered is the greedy one; other assignments replace it only when
+ * they composite strictly less area. Returns that area, in pixels.
+ */
+int64_t
+plane_policy_assign(const struct plane_policy_plane *planes, int count_planes,
+		    const struct plane_policy_view *views, int count_views,
+		    int32_t width, int32_t height, int *assignment);
+
+#endif
@@ -39,6 +39,10 @@
 #include "../shared/os-compatibility.h"
 #include "fullscreen-shell-client-protocol.h"
 
+/* Buffers in flight when reading straight into them: one shown by the
+ * parent, one committed, one being filled. */
+#define SS_MAX_BUFFERS 3
+
 struct shared_output {
 	struct weston_output *output;
 	struct wl_listener output_destroyed;
@@ -65,6 +69,13 @@ struct shared_output {
 
 		struct wl_list buffers;
 		struct wl_list free_buffers;
+
+		/* filled, waiting for the frame callback to be committed */
+		struct ss_shm_buffer *ready;
+		/* changes since the last commit */
+		pixman_region32_t commit_damage;
+		/* a frame was dropped for want of a free buffer */
+		int missed;
 	} shm;
 
 	int cache_dirty;
@@ -374,11 +385,20 @@ static void
 buffer_release(void *data, struct wl_buffer *buffer)
 {
 	struct ss_shm_buffer *sb = data;
+	struct shared_output *so = sb->output;
 
-	if (sb->output) {
-		wl_list_insert(&sb->output->shm.free_buffers, &sb->free_link);
-	} else {
+	if (!so) {
 		ss_shm_buffer_destroy(sb);
+		return;
+	}
+
+	wl_list_insert(&so->shm.free_buffers, &sb->free_link);
+
+	/* The damage of the dropped frame is still in the buffers, but
+	 * can only be read during a repaint. */
+	if (so->shm.missed) {
+		so->shm.missed = 0;
+		weston_output_schedule_repaint(so->output);
 	}
 }
 
@@ -405,9 +425,16 @@ shared_output_get_shm_buffer(struct shared_output *so)
 	    so->shm.height != height) {
 
 		/* Destroy free buffers */
-		wl_list_for_each_safe(sb, bnext, &so->shm.free_buffers, link)
+		wl_list_for_each_safe(sb, bnext, &so->shm.free_buffers, free_link)
 			ss_shm_buffer_destroy(sb);
 
+		/* The ready buffer was never attached, it is not coming
+		 * back */
+		if (so->shm.ready) {
+			ss_shm_buffer_destroy(so->shm.ready);
+			so->shm.ready = NULL;
+		}
+
 		/* Orphan in-use buffers so they get destroyed */
 		wl_list_for_each(sb, &so->shm.buffers, link)
 			sb->output = NULL;
@@ -590,15 +617,45 @@ static const struct wl_callback_listener shared_output_frame_listener = {
 };
 
 static void
-shared_output_update(struct shared_output *so)
+shared_output_commit(struct shared_output *so, struct ss_shm_buffer *sb,
+		     pixman_region32_t *damage)
 {
-	struct ss_shm_buffer *sb;
 	pixman_box32_t *r;
 	int i, nrects;
+
+	r = pixman_region32_rectangles(damage, &nrects);
+	for (i = 0; i < nrects; ++i)
+		wl_surface_damage(so->parent.surface, r[i].x1, r[i].y1,
+				  r[i].x2 - r[i].x1, r[i].y2 - r[i].y1);
+
+	wl_surface_attach(so->parent.surface, sb->buffer, 0, 0);
+
+	so->parent.frame_cb = wl_surface_frame(so->parent.surface);
+	wl_callback_add_listener(so->parent.frame_cb,
+				 &shared_output_frame_listener, so);
+
+	wl_surface_commit(so->parent.surface);
+	wl_display_flush(so->parent.display);
+}
+
+static void
+shared_output_update(struct shared_output *so)
+{
+	struct ss_shm_buffer *sb;
 	pixman_transform_t transform;
 
+	if (so->parent.frame_cb)
+		return;
+
+	if (so->shm.ready) {
+		shared_output_commit(so, so->shm.ready, &so->shm.commit_damage);
+		so->shm.ready = NULL;
+		pixman_region32_clear(&so->shm.commit_damage);
+		return;
+	}
+
 	/* Only update if we need to */
-	if (!so->cache_dirty || so->parent.frame_cb)
+	if (!so->cache_dirty)
 		return;
 
 	sb = shared_output_get_shm_buffer(so);
@@ -633,24 +690,110 @@ shared_output_update(struct shared_output *so)
 	pixman_image_set_transform(sb->pm_image, NULL);
 	pixman_image_set_clip_region32(sb->pm_image, NULL);
 
+	shared_output_commit(so, sb, &sb->damage);
+	so->cache_dirty = 0;
+
+	/* Clear the buffer damage */
+	pixman_region32_fini(&sb->damage);
+	pixman_region32_init(&sb->damage);
+}
+
+static int
+shared_output_buffer_count(struct shared_output *so)
+{
+	return wl_list_length(&so->shm.buffers);
+}
+
+/* Without a transform, the output is read straight into the buffer for
+ * the parent, in whole rows so that the renderer writes them with the
+ * buffer's stride: one copy of the damage per frame, and no cache.
+ * The buffer stays ready, and keeps being updated, until the parent
+ * wants a new frame. */
+static void
+shared_output_read_direct(struct shared_output *so, pixman_region32_t *damage)
+{
+	struct weston_output *output = so->output;
+	struct ss_shm_buffer *sb = so->shm.ready;
+	pixman_region32_t rows;
+	pixman_box32_t *r;
+	uint32_t *dst, *top, *bottom;
+	int32_t width, height, y, h;
+	int i, j, nrects, do_yflip;
+
+	pixman_region32_union(&so->shm.commit_damage,
+			      &so->shm.commit_damage, damage);
+
+	/* The buffers keep the damage they miss meanwhile. */
+	if (!sb && wl_list_empty(&so->shm.free_buffers) &&
+	    so->shm.width == output->width &&
+	    so->shm.height == output->height &&
+	    shared_output_buffer_count(so) >= SS_MAX_BUFFERS) {
+		so->shm.missed = 1;
+		return;
+	}
+
+	if (!sb) {
+		sb = shared_output_get_shm_buffer(so);
+		if (sb == NULL) {
+			shared_output_destroy(so);
+			return;
+		}
+	}
+
+	width = output->current_mode->width;
+	height = output->current_mode->height;
+	do_yflip = !!(output->compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
+
+	if (do_yflip && so->tmp_data_size < width * 4u) {
+		free(so->tmp_data);
+		so->tmp_data_size = 0;
+		so->tmp_data = malloc(width * 4);
+		if (!so->tmp_data) {
+			shared_output_destroy(so);
+			return;
+		}
+		so->tmp_data_size = width * 4;
+	}
+
+	pixman_region32_init(&rows);
 	r = pixman_region32_rectangles(&sb->damage, &nrects);
-	for (i = 0; i < nrects; ++i)
-		wl_surface_damage(so->parent.surface, r[i].x1, r[i].y1,
-				  r[i].x2 - r[i].x1, r[i].y2 - r[i].y1);
+	for (i = 0; i < nrects; i++)
+		pixman_region32_union_rect(&rows, &rows, 0, r[i].y1,
+					   width, r[i].y2 - r[i].y1);
 
-	wl_surface_attach(so->parent.surface, sb->buffer, 0, 0);
+	r = pixman_region32_rectangles(&rows, &nrects);
+	for (i = 0; i < nrects; i++) {
+		y = r[i].y1;
+		h = r[i].y2 - r[i].y1;
+		dst = (uint32_t *) sb->data + y * width;
+
+		if (!do_yflip) {
+			output->compositor->renderer->read_pixels(
+				output, PIXMAN_a8r8g8b8, dst,
+				0, y, width, h);
+			continue;
+		}
 
-	so->parent.frame_cb = wl_surface_frame(so->parent.surface);
-	wl_callback_add_listener(so->parent.frame_cb,
-				 &shared_output_frame_listener, so);
+		output->compositor->renderer->read_pixels(
+			output, PIXMAN_a8r8g8b8, dst,
+			0, height - r[i].y2, width, h);
 
-	wl_surface_commit(so->parent.surface);
-	wl_callback_destroy(wl_display_sync(so->parent.display));
-	wl_display_flush(so->parent.display);
+		for (j = 0; j < h / 2; j++) {
+			top = dst + j * width;
+			bottom = dst + (h - 1 - j) * width;
+			memcpy(so->tmp_data, top, width * 4);
+			memcpy(top, bottom, width * 4);
+			memcpy(bottom, so->tmp_data, width * 4);
+		}
+	}
+
+	pixman_region32_fini(&rows);
 
-	/* Clear the buffer damage */
 	pixman_region32_fini(&sb->damage);
 	pixman_region32_init(&sb->damage);
+
+	so->shm.ready = sb;
+	shared_output_update(so);
 }
 
 static void
@@ -785,6 +928,19 @@ shared_output_repainted(struct wl_listener *listener, void *data)
 	wl_list_for_each(sb, &so->shm.buffers, link)
 		pixman_region32_union(&sb->damage, &sb->damage, &damage);
 
+	if (so->output->transform == WL_OUTPUT_TRANSFORM_NORMAL &&
+	    so->output->current_scale == 1) {
+		/* the cache would be out of date, should that change */
+		if (so->cache_image) {
+			pixman_image_unref(so->cache_image);
+			so->cache_image = NULL;
+		}
+
+		shared_output_read_direct(so, &damage);
+		pixman_region32_fini(&damage);
+		return;
+	}
+
 	/* Transform to buffer coordinates */
 	weston_transformed_region(so->output->width, so->output->height,
 				  so->output->transform,
@@ -934,6 +1090,7 @@ shared_output_create(struct weston_output *output, int parent_fd)
 	/* Ok, everything's created.  We should be good to go */
 	wl_list_init(&so->shm.buffers);
 	wl_list_init(&so->shm.free_buffers);
+	pixman_region32_init(&so->shm.commit_damage);
 
 	so->output = output;
 	so->output_destroyed.notify = output_destroyed;
@@ -966,8 +1123,9 @@ shared_output_destroy(struct shared_output *so)
 
 	wl_list_for_each_safe(buffer, bnext, &so->shm.buffers, link)
 		ss_shm_buffer_destroy(buffer);
-	wl_list_for_each_safe(buffer, bnext, &so->shm.free_buffers, link)
+	wl_list_for_each_safe(buffer, bnext, &so->shm.free_buffers, free_link)
 		ss_shm_buffer_destroy(buffer);
+	pixman_region32_fini(&so->shm.commit_damage);
 
 	wl_display_disconnect(so->parent.display);
 	wl_event_source_remove(so->event_source);
@@ -975,7 +1133,8 @@ shared_output_destroy(struct shared_output *so)
 	wl_list_remove(&so->output_destroyed.link);
 	wl_list_remove(&so->frame_listener.link);
 
-	pixman_image_unref(so->cache_image);
+	if (so->cache_image)
+		pixman_image_unref(so->cache_image);
 	free(so->tmp_data);
 
 	free(so);
@@ -23,6 +23,10 @@
 #include <float.h>
 #include <math.h>
 
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
 #include "vertex-clipping.h"
 
 float
@@ -313,3 +317,60 @@ clip_transformed(struct clip_context *ctx,
 
 	return n;
 }
+
+#ifdef __SSE__
+
+int
+clip_boxes(const struct clip_box *boxes, int nboxes,
+	   const struct clip_box *clips, int nclips,
+	   struct clip_box *out)
+{
+	struct clip_box *start = out;
+	__m128 b, c, r;
+	int i, j;
+
+	/* A box is one vector x1, y1, x2, y2: max() of the first and
+	 * min() of the second half gives the intersection, which is
+	 * non-empty if x1 < x2 and y1 < y2. */
+	for (i = 0; i < nboxes; i++) {
+		b = _mm_loadu_ps(&boxes[i].x1);
+		for (j = 0; j < nclips; j++) {
+			c = _mm_loadu_ps(&clips[j].x1);
+			r = _mm_shuffle_ps(_mm_max_ps(b, c), _mm_min_ps(b, c),
+					   _MM_SHUFFLE(3, 2, 1, 0));
+			if ((_mm_movemask_ps(_mm_cmplt_ps(r,
+					_mm_movehl_ps(r, r))) & 3) != 3)
+				continue;
+			_mm_storeu_ps(&out->x1, r);
+			out++;
+		}
+	}
+
+	return out - start;
+}
+
+#else
+
+int
+clip_boxes(const struct clip_box *boxes, int nboxes,
+	   const struct clip_box *clips, int nclips,
+	   struct clip_box *out)
+{
+	struct clip_box *start = out;
+	int i, j;
+
+	for (i = 0; i < nboxes; i++) {
+		for (j = 0; j < nclips; j++) {
+			out->x1 = max(boxes[i].x1, clips[j].x1);
+			out->y1 = max(boxes[i].y1, clips[j].y1);
+			out->x2 = min(boxes[i].x2, clips[j].x2);
+			out->y2 = min(boxes[i].y2, clips[j].y2);
+			if (out->x1 < out->x2 && out->y1 < out->y2)
+				out++;
+		}
+	}
+
+	return out - start;
+}
+
+#endif
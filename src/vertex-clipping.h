@@ -28,6 +28,11 @@ struct polygon8 {
 	int n;
 };
 
+struct clip_box {
+	float x1, y1;
+	float x2, y2;
+};
+
 struct clip_context {
 	struct {
 		float x;
@@ -58,6 +63,16 @@ int
 clip_transformed(struct clip_context *ctx,
 		 struct polygon8 *surf,
 		 float *ex,
-		 float *ey);\
+		 float *ey);
+
+/* Intersect each of the nboxes boxes with each of the nclips clip
+ * boxes, for axis-aligned geometry where no polygon clipping is
+ * needed. Non-empty intersections are written to out, which must have
+ * room for nboxes * nclips boxes; returns their number.
+ */
+int
+clip_boxes(const struct clip_box *boxes, int nboxes,
+	   const struct clip_box *clips, int nclips,
+	   struct clip_box *out);
 
 #endif
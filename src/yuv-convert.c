@@ -0,0 +1,348 @@
+/*
+ * Copyright © 2014 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "yuv-convert.h"
+
+/*
+ * Fixed point BT.601, limited range, in 8 fractional bits:
+ *   R = 1.164 (Y - 16)                   + 1.596 (V - 128)
+ *   G = 1.164 (Y - 16) - 0.391 (U - 128) - 0.813 (V - 128)
+ *   B = 1.164 (Y - 16) + 2.018 (U - 128)
+ * The SIMD paths use the very same integer math, so their output is
+ * bit-identical to the generic one.
+ */
+#define K_Y	298
+#define K_RV	409
+#define K_GU	-100
+#define K_GV	-208
+#define K_BU	516
+
+static inline uint32_t
+clamp8(int v)
+{
+	if (v < 0)
+		return 0;
+	if (v > 255)
+		return 255;
+	return v;
+}
+
+static inline uint32_t
+yuv_pixel(int y, int u, int v)
+{
+	int c = K_Y * (y - 16) + 128;
+	int d = u - 128;
+	int e = v - 128;
+
+	return 0xff000000 |
+		clamp8((c + K_RV * e) >> 8) << 16 |
+		clamp8((c + K_GU * d + K_GV * e) >> 8) << 8 |
+		clamp8((c + K_BU * d) >> 8);
+}
+
+/* The last pixel of an odd width row has no chroma sample of its own,
+ * it shares the one to its left. */
+static inline int
+chroma_index(const struct yuv_planes *src, int i)
+{
+	if (i / 2 < src->chroma_width)
+		return i / 2;
+
+	return src->chroma_width - 1;
+}
+
+static void
+convert_row_generic(const struct yuv_planes *src, uint32_t *dst,
+		    int x, int y, int width)
+{
+	const uint8_t *row, *u, *v;
+	int i, k;
+
+	switch (src->format) {
+	case YUV_FORMAT_YUYV:
+		row = src->data[0] + y * src->stride[0];
+		for (i = x; i < x + width; i++) {
+			k = chroma_index(src, i);
+			dst[i] = yuv_pixel(row[i * 2],
+					   row[k * 4 + 1], row[k * 4 + 3]);
+		}
+		break;
+	case YUV_FORMAT_NV12:
+		row = src->data[0] + y * src->stride[0];
+		u = src->data[1] + (y / 2) * src->stride[1];
+		for (i = x; i < x + width; i++) {
+			k = chroma_index(src, i);
+			dst[i] = yuv_pixel(row[i], u[k * 2], u[k * 2 + 1]);
+		}
+		break;
+	case YUV_FORMAT_YUV420:
+		row = src->data[0] + y * src->stride[0];
+		u = src->data[1] + (y / 2) * src->stride[1];
+		v = src->data[2] + (y / 2) * src->stride[2];
+		for (i = x; i < x + width; i++) {
+			k = chroma_index(src, i);
+			dst[i] = yuv_pixel(row[i], u[k], v[k]);
+		}
+		break;
+	}
+}
+
+#ifdef __SSE2__
+
+/* Convert and store 8 pixels, c = Y - 16, d = U - 128, e = V - 128,
+ * one 16 bit lane per pixel. */
+static inline void
+store8_sse2(uint32_t *dst, __m128i c, __m128i d, __m128i e)
+{
+	const __m128i k_r = _mm_setr_epi16(K_Y, K_RV, K_Y, K_RV,
+					   K_Y, K_RV, K_Y, K_RV);
+	const __m128i k_gu = _mm_setr_epi16(K_Y, K_GU, K_Y, K_GU,
+					    K_Y, K_GU, K_Y, K_GU);
+	const __m128i k_gv = _mm_setr_epi16(0, K_GV, 0, K_GV,
+					    0, K_GV, 0, K_GV);
+	const __m128i k_b = _mm_setr_epi16(K_Y, K_BU, K_Y, K_BU,
+					   K_Y, K_BU, K_Y, K_BU);
+	const __m128i round = _mm_set1_epi32(128);
+	__m128i cd_lo = _mm_unpacklo_epi16(c, d);
+	__m128i cd_hi = _mm_unpackhi_epi16(c, d);
+	__m128i ce_lo = _mm_unpacklo_epi16(c, e);
+	__m128i ce_hi = _mm_unpackhi_epi16(c, e);
+	__m128i r, g, b, lo, hi, bg, ra;
+
+	lo = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(ce_lo, k_r),
+					  round), 8);
+	hi = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(ce_hi, k_r),
+					  round), 8);
+	r = _mm_packs_epi32(lo, hi);
+
+	lo = _mm_add_epi32(_mm_madd_epi16(cd_lo, k_gu),
+			   _mm_madd_epi16(ce_lo, k_gv));
+	hi = _mm_add_epi32(_mm_madd_epi16(cd_hi, k_gu),
+			   _mm_madd_epi16(ce_hi, k_gv));
+	lo = _mm_srai_epi32(_mm_add_epi32(lo, round), 8);
+	hi = _mm_srai_epi32(_mm_add_epi32(hi, round), 8);
+	g = _mm_packs_epi32(lo, hi);
+
+	lo = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(cd_lo, k_b),
+					  round), 8);
+	hi = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(cd_hi, k_b),
+					  round), 8);
+	b = _mm_packs_epi32(lo, hi);
+
+	r = _mm_packus_epi16(r, r);
+	g = _mm_packus_epi16(g, g);
+	b = _mm_packus_epi16(b, b);
+
+	bg = _mm_unpacklo_epi8(b, g);
+	ra = _mm_unpacklo_epi8(r, _mm_set1_epi8(-1));
+	_mm_storeu_si128((__m128i *) dst, _mm_unpacklo_epi16(bg, ra));
+	_mm_storeu_si128((__m128i *) (dst + 4), _mm_unpackhi_epi16(bg, ra));
+}
+
+/* Spread 16 bit U0 V0 U1 V1 U2 V2 U3 V3 over 8 pixels. */
+static inline void
+split_uv_sse2(__m128i uv, __m128i *d, __m128i *e)
+{
+	const __m128i bias = _mm_set1_epi16(128);
+
+	*d = _mm_shufflelo_epi16(uv, _MM_SHUFFLE(2, 2, 0, 0));
+	*d = _mm_shufflehi_epi16(*d, _MM_SHUFFLE(2, 2, 0, 0));
+	*e = _mm_shufflelo_epi16(uv, _MM_SHUFFLE(3, 3, 1, 1));
+	*e = _mm_shufflehi_epi16(*e, _MM_SHUFFLE(3, 3, 1, 1));
+	*d = _mm_sub_epi16(*d, bias);
+	*e = _mm_sub_epi16(*e, bias);
+}
+
+static inline __m128i
+load_u8x8_sse2(const uint8_t *p)
+{
+	return _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) p),
+				 _mm_setzero_si128());
+}
+
+static inline __m128i
+load_u8x4_dup_sse2(const uint8_t *p)
+{
+	int32_t v;
+	__m128i w;
+
+	memcpy(&v, p, sizeof v);
+	w = _mm_unpacklo_epi8(_mm_cvtsi32_si128(v), _mm_setzero_si128());
+
+	return _mm_sub_epi16(_mm_unpacklo_epi16(w, w), _mm_set1_epi16(128));
+}
+
+/* Converts whole blocks of 8 pixels starting at the even x, returns the
+ * number of pixels done. A block ends on an odd pixel, so it never needs
+ * the missing chroma sample of an odd width row. */
+static int
+convert_row_sse2(const struct yuv_planes *src, uint32_t *dst,
+		 int x, int y, int width)
+{
+	const __m128i y_bias = _mm_set1_epi16(16);
+	const uint8_t *row, *u, *v;
+	__m128i c, d, e, p;
+	int i, end = x + (width & ~7);
+
+	row = src->data[0] + y * src->stride[0];
+
+	switch (src->format) {
+	case YUV_FORMAT_YUYV:
+		for (i = x; i < end; i += 8) {
+			p = _mm_loadu_si128((const __m128i *) (row + i * 2));
+			c = _mm_and_si128(p, _mm_set1_epi16(0xff));
+			split_uv_sse2(_mm_srli_epi16(p, 8), &d, &e);
+			store8_sse2(dst + i, _mm_sub_epi16(c, y_bias), d, e);
+		}
+		break;
+	case YUV_FORMAT_NV12:
+		u = src->data[1] + (y / 2) * src->stride[1];
+		for (i = x; i < end; i += 8) {
+			c = _mm_sub_epi16(load_u8x8_sse2(row + i), y_bias);
+			split_uv_sse2(load_u8x8_sse2(u + i), &d, &e);
+			store8_sse2(dst + i, c, d, e);
+		}
+		break;
+	case YUV_FORMAT_YUV420:
+		u = src->data[1] + (y / 2) * src->stride[1];
+		v = src->data[2] + (y / 2) * src->stride[2];
+		for (i = x; i < end; i += 8) {
+			c = _mm_sub_epi16(load_u8x8_sse2(row + i), y_bias);
+			d = load_u8x4_dup_sse2(u + i / 2);
+			e = load_u8x4_dup_sse2(v + i / 2);
+			store8_sse2(dst + i, c, d, e);
+		}
+		break;
+	}
+
+	return end - x;
+}
+
+#endif
+
+void
+yuv_planes_init(struct yuv_planes *planes, enum yuv_format format,
+		const void *data, int stride, int width, int height)
+{
+	const uint8_t *p = data;
+
+	memset(planes, 0, sizeof *planes);
+	planes->format = format;
+	planes->data[0] = p;
+	planes->stride[0] = stride;
+
+	switch (format) {
+	case YUV_FORMAT_YUYV:
+		planes->chroma_width = width / 2;
+		break;
+	case YUV_FORMAT_NV12:
+		planes->data[1] = p + stride * height;
+		planes->stride[1] = stride;
+		planes->chroma_width = (width + 1) / 2;
+		break;
+	case YUV_FORMAT_YUV420:
+		planes->data[1] = p + stride * height;
+		planes->stride[1] = stride / 2;
+		planes->data[2] = planes->data[1] +
+			planes->stride[1] * ((height + 1) / 2);
+		planes->stride[2] = stride / 2;
+		planes->chroma_width = (width + 1) / 2;
+		break;
+	}
+
+	/* An odd stride cuts the last chroma sample of an odd width. */
+	if (planes->chroma_width > stride / 2)
+		planes->chroma_width = stride / 2;
+}
+
+size_t
+yuv_buffer_size(enum yuv_format format, int stride, int width, int height)
+{
+	size_t luma = (size_t) stride * height;
+	size_t chroma_rows = (height + 1) / 2;
+
+	if (width < 2 || height < 1)
+		return 0;
+
+	switch (format) {
+	case YUV_FORMAT_YUYV:
+		if (stride / 2 < width)
+			return 0;
+		return luma;
+	case YUV_FORMAT_NV12:
+		if (stride < width)
+			return 0;
+		return luma + (size_t) stride * chroma_rows;
+	case YUV_FORMAT_YUV420:
+		if (stride < width)
+			return 0;
+		return luma + 2 * (size_t) (stride / 2) * chroma_rows;
+	}
+
+	return 0;
+}
+
+void
+yuv_convert_rect_generic(const struct yuv_planes *src,
+			 uint32_t *dst, int dst_stride,
+			 int x, int y, int width, int height)
+{
+	int j;
+
+	for (j = y; j < y + height; j++)
+		convert_row_generic(src,
+				    (uint32_t *) ((char *) dst + j * dst_stride),
+				    x, j, width);
+}
+
+void
+yuv_convert_rect(const struct yuv_planes *src,
+		 uint32_t *dst, int dst_stride,
+		 int x, int y, int width, int height)
+{
+#ifdef __SSE2__
+	uint32_t *row;
+	int j, done;
+
+	/* Start on a chroma sample; converting the pixel to the left
+	 * again is harmless. */
+	width += x & 1;
+	x &= ~1;
+
+	for (j = y; j < y + height; j++) {
+		row = (uint32_t *) ((char *) dst + j * dst_stride);
+		done = convert_row_sse2(src, row, x, j, width);
+		if (done < width)
+			convert_row_generic(src, row, x + done, j,
+					    width - done);
+	}
+#else
+	yuv_convert_rect_generic(src, dst, dst_stride, x, y, width, height);
+#endif
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright © 2014 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef _WESTON_YUV_CONVERT_H
+#define _WESTON_YUV_CONVERT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum yuv_format {
+	YUV_FORMAT_YUYV,	/* packed Y0 U Y1 V, 4:2:2 */
+	YUV_FORMAT_NV12,	/* Y plane, interleaved UV plane, 4:2:0 */
+	YUV_FORMAT_YUV420	/* Y, U and V planes, 4:2:0 */
+};
+
+struct yuv_planes {
+	enum yuv_format format;
+	const uint8_t *data[3];
+	int stride[3];		/* in bytes */
+	int chroma_width;	/* complete chroma samples in a row */
+};
+
+/* Locate the planes of a single-buffer YUV image. The chroma planes
+ * directly follow the luma plane; NV12 chroma rows have the luma stride,
+ * YUV420 chroma rows half of it. The buffer must have passed
+ * yuv_buffer_size().
+ */
+void
+yuv_planes_init(struct yuv_planes *planes, enum yuv_format format,
+		const void *data, int stride, int width, int height);
+
+/* Number of bytes the planes of a width x height image with the given
+ * luma stride span, or 0 if the stride does not cover the width or the
+ * image is too narrow to carry a chroma sample.
+ */
+size_t
+yuv_buffer_size(enum yuv_format format, int stride, int width, int height);
+
+/* Convert the rectangle at x, y of the source into x8r8g8b8 pixels at
+ * the same position of dst, using BT.601 limited range coefficients.
+ */
+void
+yuv_convert_rect(const struct yuv_planes *src,
+		 uint32_t *dst, int dst_stride,
+		 int x, int y, int width, int height);
+
+/* Same as yuv_convert_rect(), without any SIMD code paths. */
+void
+yuv_convert_rect_generic(const struct yuv_planes *src,
+			 uint32_t *dst, int dst_stride,
+			 int x, int y, int width, int height);
+
+#endif
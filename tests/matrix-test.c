@@ -24,6 +24,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <unistd.h>
 #include <signal.h>
@@ -240,6 +241,160 @@ test(void)
 	return TEST_FAIL;
 }
 
+/* Scalar references for the SIMD kernels in matrix.c */
+static void
+multiply_ref(struct weston_matrix *m, const struct weston_matrix *n)
+{
+	struct weston_matrix tmp;
+	int i, j;
+
+	for (i = 0; i < 16; i++) {
+		tmp.d[i] = 0;
+		for (j = 0; j < 4; j++)
+			tmp.d[i] += m->d[(i / 4) * 4 + j] * n->d[i % 4 + j * 4];
+	}
+	memcpy(m->d, tmp.d, sizeof tmp.d);
+}
+
+static void
+transform_ref(const struct weston_matrix *m, struct weston_vector *v)
+{
+	struct weston_vector t;
+	int i, j;
+
+	for (i = 0; i < 4; i++) {
+		t.f[i] = 0;
+		for (j = 0; j < 4; j++)
+			t.f[i] += v->f[j] * m->d[i + j * 4];
+	}
+	*v = t;
+}
+
+static int
+float_differs(double a, double b)
+{
+	return fabs(a - b) > 1e-5 * (fabs(a) > fabs(b) ? fabs(a) : fabs(b)) &&
+	       fabs(a - b) > 1e-6;
+}
+
+static int
+test_kernels(void)
+{
+	struct weston_matrix m, n, r;
+	struct weston_vector v[8], w[8];
+	int i, k, fails = 0;
+
+	for (k = 0; k < 10000; k++) {
+		randomize_matrix(&m);
+		randomize_matrix(&n);
+		m.type = n.type = WESTON_MATRIX_TRANSFORM_OTHER;
+
+		r = m;
+		weston_matrix_multiply(&r, &n);
+		multiply_ref(&m, &n);
+		for (i = 0; i < 16; i++)
+			fails += float_differs(r.d[i], m.d[i]);
+
+		for (i = 0; i < 8; i++) {
+			v[i].f[0] = w[i].f[0] = frand() * 1000.0;
+			v[i].f[1] = w[i].f[1] = frand() * 1000.0;
+			v[i].f[2] = w[i].f[2] = frand();
+			v[i].f[3] = w[i].f[3] = 1.0f;
+			transform_ref(&n, &w[i]);
+		}
+		weston_matrix_transform_points(&n, v, 8);
+		for (i = 0; i < 8 * 4; i++)
+			fails += float_differs(v[i / 4].f[i % 4],
+					       w[i / 4].f[i % 4]);
+	}
+
+	printf("multiply and transform kernels: %d mismatches.\n", fails);
+
+	return fails;
+}
+
+static void
+random_affine_xy(struct weston_matrix *m)
+{
+	double phi;
+	int i;
+
+	weston_matrix_init(m);
+	for (i = 0; i < 4; i++) {
+		switch (random() % 3) {
+		case 0:
+			weston_matrix_translate(m, frand() * 1000.0,
+						frand() * 1000.0, 0.0f);
+			break;
+		case 1:
+			weston_matrix_scale(m, 0.1 + fabs(frand()) * 4.0,
+					    0.1 + fabs(frand()) * 4.0, 1.0f);
+			break;
+		case 2:
+			phi = frand() * M_PI;
+			weston_matrix_rotate_xy(m, cos(phi), sin(phi));
+			break;
+		}
+	}
+}
+
+/* A matrix filled in by hand has type 0 but need not be the identity,
+ * like the one clients/calibrator.c builds. */
+static int
+test_untyped_inverse(void)
+{
+	struct weston_matrix m, inv;
+	int fails = 0;
+
+	memset(&m, 0, sizeof m);
+	m.d[0] = 2.0f;
+	m.d[5] = 4.0f;
+	m.d[10] = 1.0f;
+	m.d[12] = 3.0f;
+	m.d[15] = 1.0f;
+
+	if (weston_matrix_invert(&inv, &m) < 0)
+		fails++;
+	else
+		fails += float_differs(inv.d[0], 0.5f) +
+			 float_differs(inv.d[5], 0.25f) +
+			 float_differs(inv.d[12], -1.5f);
+
+	printf("untyped inverse: %d mismatches.\n", fails);
+
+	return fails;
+}
+
+/* The closed form inverses must agree with the LU decomposition. */
+static int
+test_closed_form_inverse(void)
+{
+	struct weston_matrix m, inv, ref;
+	struct inverse_matrix q;
+	int i, k, fails = 0;
+
+	for (k = 0; k < 10000; k++) {
+		random_affine_xy(&m);
+
+		if (weston_matrix_invert(&inv, &m) < 0 ||
+		    matrix_invert(q.LU, q.perm, &m) < 0) {
+			fails++;
+			continue;
+		}
+
+		weston_matrix_init(&ref);
+		for (i = 0; i < 4; i++)
+			inverse_transform(q.LU, q.perm, &ref.d[i * 4]);
+
+		for (i = 0; i < 16; i++)
+			fails += float_differs(inv.d[i], ref.d[i]);
+	}
+
+	printf("closed form inverses: %d mismatches.\n", fails);
+
+	return fails;
+}
+
 static int running;
 static void
 stopme(int n)
@@ -347,19 +502,100 @@ test_loop_speed_invert(void)
 static void __attribute__((noinline))
 test_loop_speed_invert_explicit(void)
 {
-	struct weston_matrix m;
+	struct weston_matrix m, inv;
 	unsigned long count = 0;
 	double t;
 
 	printf("\nRunning 3 s test on weston_matrix_invert()...\n");
 
+	randomize_matrix(&m);
+	m.type = WESTON_MATRIX_TRANSFORM_OTHER;
+
+	running = 1;
+	alarm(3);
+	reset_timer();
+	while (running) {
+		weston_matrix_invert(&inv, &m);
+		count++;
+	}
+	t = read_timer();
+
+	printf("%lu iterations in %f seconds, avg. %.1f ns/iter.\n",
+	       count, t, 1e9 * t / count);
+}
+
+static void __attribute__((noinline))
+test_loop_speed_multiply(void)
+{
+	struct weston_matrix m, n;
+	unsigned long count = 0;
+	double t;
+
+	printf("\nRunning 3 s test on weston_matrix_multiply()...\n");
+
+	randomize_matrix(&n);
+	n.type = WESTON_MATRIX_TRANSFORM_OTHER;
+	weston_matrix_init(&m);
+
+	running = 1;
+	alarm(3);
+	reset_timer();
+	while (running) {
+		weston_matrix_multiply(&m, &n);
+		m.d[15] = 1.0f;
+		count++;
+	}
+	t = read_timer();
+
+	printf("%lu iterations in %f seconds, avg. %.1f ns/iter.\n",
+	       count, t, 1e9 * t / count);
+}
+
+static void __attribute__((noinline))
+test_loop_speed_transform_points(void)
+{
+	struct weston_matrix m;
+	struct weston_vector v[1024];
+	unsigned long count = 0;
+	double t;
+	int i;
+
+	printf("\nRunning 3 s test on weston_matrix_transform_points(), "
+	       "1024 points...\n");
+
 	weston_matrix_init(&m);
+	for (i = 0; i < 1024; i++) {
+		v[i].f[0] = v[i].f[1] = v[i].f[2] = 0.5f;
+		v[i].f[3] = 1.0f;
+	}
+
+	running = 1;
+	alarm(3);
+	reset_timer();
+	while (running) {
+		weston_matrix_transform_points(&m, v, 1024);
+		count++;
+	}
+	t = read_timer();
+
+	printf("%lu iterations in %f seconds, avg. %.1f ns/point.\n",
+	       count, t, 1e9 * t / count / 1024);
+}
+
+static void __attribute__((noinline))
+test_loop_speed_invert_type(const char *name, struct weston_matrix *m)
+{
+	struct weston_matrix inv;
+	unsigned long count = 0;
+	double t;
+
+	printf("\nRunning 3 s test on weston_matrix_invert(), %s...\n", name);
 
 	running = 1;
 	alarm(3);
 	reset_timer();
 	while (running) {
-		weston_matrix_invert(&m, &m);
+		weston_matrix_invert(&inv, m);
 		count++;
 	}
 	t = read_timer();
@@ -368,7 +604,31 @@ test_loop_speed_invert_explicit(void)
 	       count, t, 1e9 * t / count);
 }
 
-int main(void)
+static void
+test_loop_speed(void)
+{
+	struct weston_matrix m;
+
+	test_loop_speed_matrixvector();
+	test_loop_speed_transform_points();
+	test_loop_speed_multiply();
+	test_loop_speed_inversetransform();
+	test_loop_speed_invert();
+	test_loop_speed_invert_explicit();
+
+	weston_matrix_init(&m);
+	weston_matrix_translate(&m, 10.0f, 20.0f, 0.0f);
+	test_loop_speed_invert_type("translate", &m);
+
+	weston_matrix_rotate_xy(&m, cos(0.3), sin(0.3));
+	weston_matrix_scale(&m, 2.0f, 2.0f, 1.0f);
+	test_loop_speed_invert_type("translate, rotate, scale", &m);
+
+	m.type |= WESTON_MATRIX_TRANSFORM_OTHER;
+	test_loop_speed_invert_type("other", &m);
+}
+
+int main(int argc, char *argv[])
 {
 	struct sigaction ding;
 	struct weston_matrix M;
@@ -384,6 +644,12 @@ int main(void)
 
 	srandom(13);
 
+	/* --timing skips the precision tests and only runs the loops. */
+	if (argc > 1 && strcmp(argv[1], "--timing") == 0) {
+		test_loop_speed();
+		return 0;
+	}
+
 	M.d[0] = 3.0;	M.d[4] = 17.0;	M.d[8] = 10.0;	M.d[12] = 0.0;
 	M.d[1] = 2.0;	M.d[5] = 4.0;	M.d[9] = -2.0;	M.d[13] = 0.0;
 	M.d[2] = 6.0;	M.d[6] = 18.0;	M.d[10] = -12;	M.d[14] = 0.0;
@@ -411,11 +677,12 @@ int main(void)
 	print_matrix(&M);
 	printf("max abs error: %g, original determinant %g\n", errsup, det);
 
+	if (test_kernels() != 0 || test_closed_form_inverse() != 0 ||
+	    test_untyped_inverse() != 0)
+		return 1;
+
 	test_loop_precision();
-	test_loop_speed_matrixvector();
-	test_loop_speed_inversetransform();
-	test_loop_speed_invert();
-	test_loop_speed_invert_explicit();
+	test_loop_speed();
 
 	return 0;
 }
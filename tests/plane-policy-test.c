@@ -0,0 +1,345 @@
+/*
+ * Copyright © 2014 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "weston-test-runner.h"
+
+#include "../src/plane-policy.h"
+
+#define ARRAY_LENGTH(a) (sizeof (a) / sizeof (a)[0])
+
+/*
+ * Scenes in the format the drm backend logs, see plane-policy.h. The
+ * comment at the end of each view line is the plane type the policy is
+ * expected to pick for it.
+ */
+static const char *scenes[] = {
+	/* fullscreen video and a cursor: nothing to composite */
+	"output 1920 1080\n"
+	"plane cursor zpos=0 max=64x64\n"
+	"plane scanout zpos=0\n"
+	"plane overlay zpos=0 scale formats=XR24,NV12\n"
+	"view 500 300 532 332 shm # cursor\n"
+	"view 0 0 1920 1080 format=NV12 fullscreen # scanout\n"
+	"view 0 0 1920 1080 format=XR24 # primary\n",
+
+	/* greedy would spend the only overlay on the small view on top */
+	"output 1920 1080\n"
+	"plane overlay zpos=0 scale formats=XR24,NV12\n"
+	"view 1800 0 1920 40 format=XR24 # primary\n"
+	"view 320 180 1600 900 format=NV12 # overlay\n"
+	"view 0 0 1920 1080 shm # primary\n",
+
+	/* a translucent banner on top keeps the video composited */
+	"output 1280 720\n"
+	"plane overlay zpos=0 scale formats=NV12\n"
+	"view 0 600 1280 720 format=XR24 alpha # primary\n"
+	"view 0 0 1280 720 format=NV12 # primary\n",
+
+	/* the overlay cannot scan out this format */
+	"output 1280 720\n"
+	"plane overlay zpos=0 formats=NV12\n"
+	"view 100 100 740 580 format=YUYV # primary\n"
+	"view 0 0 1280 720 shm # primary\n",
+
+	/* overlapping videos need the overlays in the right order */
+	"output 1920 1080\n"
+	"plane overlay zpos=0 scale\n"
+	"plane overlay zpos=1 scale\n"
+	"view 1280 720 1920 1080 format=NV12 # overlay\n"
+	"view 0 0 1920 1080 format=NV12 # overlay\n",
+
+	/* no scaling on the overlay, a cursor too big for the plane */
+	"output 1024 768\n"
+	"plane cursor zpos=0 max=64x64\n"
+	"plane overlay zpos=0\n"
+	"view 0 0 128 128 shm # primary\n"
+	"view 200 200 520 440 format=XR24 scaled # primary\n"
+	"view 600 200 920 440 format=XR24 # overlay\n"
+	"view 0 0 1024 768 shm # primary\n",
+
+	/* views on other outputs, or without a buffer, stay composited */
+	"output 1024 768\n"
+	"plane overlay zpos=0\n"
+	"view 1024 0 2048 768 format=XR24 primary # primary\n"
+	"view 0 0 1024 768 format=XR24 transformed # primary\n",
+};
+
+struct scene {
+	int32_t width, height;
+	struct plane_policy_plane planes[8];
+	uint32_t formats[8][8];
+	int count_planes;
+	struct plane_policy_view views[256];
+	int expected[256];
+	int count_views;
+};
+
+static const char *plane_types[] = {
+	[PLANE_POLICY_CURSOR] = "cursor",
+	[PLANE_POLICY_SCANOUT] = "scanout",
+	[PLANE_POLICY_OVERLAY] = "overlay",
+};
+
+static const char *view_flags[] = {
+	"primary", "shm", "alpha", "scaled", "transformed", "fullscreen"
+};
+
+static uint32_t
+parse_fourcc(const char *s)
+{
+	assert(strlen(s) >= 4);
+
+	return (uint32_t) s[0] | (uint32_t) s[1] << 8 |
+		(uint32_t) s[2] << 16 | (uint32_t) s[3] << 24;
+}
+
+/* -1 for primary */
+static int
+parse_plane_type(const char *s)
+{
+	unsigned i;
+
+	for (i = 0; i < ARRAY_LENGTH(plane_types); i++)
+		if (strcmp(s, plane_types[i]) == 0)
+			return i;
+
+	assert(strcmp(s, "primary") == 0);
+
+	return PLANE_POLICY_PRIMARY;
+}
+
+static void
+parse_plane(struct scene *scene, char *args)
+{
+	struct plane_policy_plane *plane = &scene->planes[scene->count_planes];
+	uint32_t *formats = scene->formats[scene->count_planes];
+	char *tok, *f, *save;
+	int n, type;
+
+	assert(scene->count_planes < (int) ARRAY_LENGTH(scene->planes));
+	scene->count_planes++;
+
+	tok = strtok_r(args, " ", &save);
+	type = parse_plane_type(tok);
+	assert(type != PLANE_POLICY_PRIMARY);
+	plane->type = type;
+
+	while ((tok = strtok_r(NULL, " ", &save))) {
+		if (strncmp(tok, "zpos=", 5) == 0) {
+			plane->zpos = atoi(tok + 5);
+		} else if (strcmp(tok, "scale") == 0) {
+			plane->can_scale = 1;
+		} else if (strncmp(tok, "max=", 4) == 0) {
+			n = sscanf(tok + 4, "%dx%d", &plane->max_width,
+				   &plane->max_height);
+			assert(n == 2);
+		} else if (strncmp(tok, "formats=", 8) == 0) {
+			plane->formats = formats;
+			for (f = strtok(tok + 8, ","); f; f = strtok(NULL, ","))
+				formats[plane->count_formats++] =
+					parse_fourcc(f);
+		} else {
+			assert(0 && "unknown plane property");
+		}
+	}
+}
+
+static void
+parse_view(struct scene *scene, char *args, const char *expected)
+{
+	struct plane_policy_view *view = &scene->views[scene->count_views];
+	char *tok, *save;
+	unsigned i;
+	int n;
+
+	assert(scene->count_views < (int) ARRAY_LENGTH(scene->views));
+	assert(expected);
+	scene->expected[scene->count_views] = parse_plane_type(expected);
+	scene->count_views++;
+
+	n = sscanf(args, "%d %d %d %d", &view->x1, &view->y1,
+		   &view->x2, &view->y2);
+	assert(n == 4);
+	strtok_r(args, " ", &save);
+	for (i = 0; i < 3; i++)
+		strtok_r(NULL, " ", &save);
+
+	while ((tok = strtok_r(NULL, " ", &save))) {
+		if (strncmp(tok, "format=", 7) == 0) {
+			view->format = parse_fourcc(tok + 7);
+			continue;
+		}
+
+		for (i = 0; i < ARRAY_LENGTH(view_flags); i++)
+			if (strcmp(tok, view_flags[i]) == 0)
+				break;
+		assert(i < ARRAY_LENGTH(view_flags));
+		view->flags |= 1 << i;
+	}
+}
+
+static void
+parse_scene(struct scene *scene, const char *text)
+{
+	char *copy, *line, *comment, *save;
+	char expected[32];
+	int n;
+
+	memset(scene, 0, sizeof *scene);
+	copy = strdup(text);
+
+	for (line = strtok_r(copy, "\n", &save); line;
+	     line = strtok_r(NULL, "\n", &save)) {
+		line += strspn(line, " ");
+
+		expected[0] = '\0';
+		comment = strchr(line, '#');
+		if (comment) {
+			sscanf(comment + 1, "%31s", expected);
+			*comment = '\0';
+		}
+
+		if (strncmp(line, "output ", 7) == 0) {
+			n = sscanf(line + 7, "%d %d", &scene->width,
+				   &scene->height);
+			assert(n == 2);
+		} else if (strncmp(line, "plane ", 6) == 0) {
+			parse_plane(scene, line + 6);
+		} else if (strncmp(line, "view ", 5) == 0) {
+			parse_view(scene, line + 5,
+				   expected[0] ? expected : NULL);
+		} else {
+			assert(line[0] == '\0');
+		}
+	}
+
+	free(copy);
+}
+
+static int
+overlap(const struct plane_policy_view *a, const struct plane_policy_view *b)
+{
+	return a->x1 < b->x2 && b->x1 < a->x2 &&
+	       a->y1 < b->y2 && b->y1 < a->y2;
+}
+
+/* Whatever the policy decides, the result must be displayable. */
+static void
+check_assignment(const struct scene *scene, const int *assignment)
+{
+	const struct plane_policy_plane *plane;
+	int i, j, scanout = 0;
+
+	for (i = 0; i < scene->count_views; i++) {
+		if (assignment[i] == PLANE_POLICY_PRIMARY)
+			continue;
+
+		assert(!scanout);
+		assert(assignment[i] < scene->count_planes);
+		plane = &scene->planes[assignment[i]];
+		if (plane->type == PLANE_POLICY_SCANOUT)
+			scanout = 1;
+
+		for (j = 0; j < i; j++) {
+			assert(assignment[j] != assignment[i]);
+			if (overlap(&scene->views[i], &scene->views[j]))
+				assert(assignment[j] != PLANE_POLICY_PRIMARY);
+		}
+	}
+}
+
+TEST_P(plane_policy_scene, scenes)
+{
+	const char * const *text = data;
+	struct scene scene;
+	int assignment[256];
+	int i, type;
+
+	parse_scene(&scene, *text);
+	plane_policy_assign(scene.planes, scene.count_planes,
+			    scene.views, scene.count_views,
+			    scene.width, scene.height, assignment);
+
+	check_assignment(&scene, assignment);
+
+	for (i = 0; i < scene.count_views; i++) {
+		type = assignment[i] == PLANE_POLICY_PRIMARY ?
+			PLANE_POLICY_PRIMARY :
+			(int) scene.planes[assignment[i]].type;
+		if (type != scene.expected[i])
+			fprintf(stderr, "view %d: expected %s, got %s\n", i,
+				scene.expected[i] < 0 ? "primary" :
+				plane_types[scene.expected[i]],
+				type < 0 ? "primary" : plane_types[type]);
+		assert(type == scene.expected[i]);
+	}
+}
+
+TEST(plane_policy_many_views)
+{
+	struct scene scene;
+	int assignment[256];
+	int64_t cost, greedy;
+	int i;
+
+	memset(&scene, 0, sizeof scene);
+	scene.width = 1920;
+	scene.height = 1080;
+	for (i = 0; i < 3; i++) {
+		scene.planes[i].type = PLANE_POLICY_OVERLAY;
+		scene.planes[i].can_scale = 1;
+	}
+	scene.count_planes = 3;
+
+	/* Many small tiles with a few bigger ones in between: the search
+	 * runs out of steps long before it has seen every assignment,
+	 * and must still be no worse than the greedy one. */
+	scene.count_views = 256;
+	for (i = 0; i < scene.count_views; i++) {
+		scene.views[i].x1 = (i % 16) * 120;
+		scene.views[i].y1 = (i / 16) * 67;
+		scene.views[i].x2 = scene.views[i].x1 + 100;
+		scene.views[i].y2 = scene.views[i].y1 + 50;
+		if (i % 50 == 49) {
+			scene.views[i].x2 += 15;
+			scene.views[i].y2 += 15;
+		}
+	}
+
+	greedy = 0;
+	for (i = 3; i < scene.count_views; i++)
+		greedy += 100 * 50 + (i % 50 == 49 ? 115 * 65 - 100 * 50 : 0);
+
+	cost = plane_policy_assign(scene.planes, scene.count_planes,
+				   scene.views, scene.count_views,
+				   scene.width, scene.height, assignment);
+
+	check_assignment(&scene, assignment);
+	assert(cost <= greedy);
+}
@@ -220,3 +220,66 @@ TEST(float_difference_same)
 	assert(float_difference(1.0f, 1.0f) == 0.0f);
 }
 
+
+TEST(clip_boxes_intersections)
+{
+	const struct clip_box boxes[] = {
+		{ 0.0f, 0.0f, 10.0f, 10.0f },
+		{ 20.0f, 0.0f, 30.0f, 10.0f },
+	};
+	const struct clip_box clips[] = {
+		{ 5.0f, 5.0f, 25.0f, 15.0f },	/* overlaps both */
+		{ 10.0f, 0.0f, 20.0f, 10.0f },	/* touches both */
+		{ 2.0f, 2.0f, 4.0f, 4.0f },	/* inside the first */
+	};
+	struct clip_box out[6];
+	int n;
+
+	n = clip_boxes(boxes, 2, clips, 3, out);
+
+	assert(n == 3);
+	assert(out[0].x1 == 5.0f && out[0].y1 == 5.0f &&
+	       out[0].x2 == 10.0f && out[0].y2 == 10.0f);
+	assert(out[1].x1 == 2.0f && out[1].y1 == 2.0f &&
+	       out[1].x2 == 4.0f && out[1].y2 == 4.0f);
+	assert(out[2].x1 == 20.0f && out[2].y1 == 5.0f &&
+	       out[2].x2 == 25.0f && out[2].y2 == 10.0f);
+}
+
+TEST(clip_boxes_random)
+{
+	struct clip_box boxes[16], clips[16], out[16 * 16];
+	struct clip_box r;
+	int i, j, k, n;
+
+	srandom(42);
+	for (i = 0; i < 16; i++) {
+		boxes[i].x1 = random() % 100;
+		boxes[i].y1 = random() % 100;
+		boxes[i].x2 = boxes[i].x1 + random() % 50;
+		boxes[i].y2 = boxes[i].y1 + random() % 50;
+		clips[i].x1 = random() % 100;
+		clips[i].y1 = random() % 100;
+		clips[i].x2 = clips[i].x1 + random() % 50;
+		clips[i].y2 = clips[i].y1 + random() % 50;
+	}
+
+	n = clip_boxes(boxes, 16, clips, 16, out);
+
+	k = 0;
+	for (i = 0; i < 16; i++) {
+		for (j = 0; j < 16; j++) {
+			r.x1 = fmaxf(boxes[i].x1, clips[j].x1);
+			r.y1 = fmaxf(boxes[i].y1, clips[j].y1);
+			r.x2 = fminf(boxes[i].x2, clips[j].x2);
+			r.y2 = fminf(boxes[i].y2, clips[j].y2);
+			if (r.x1 >= r.x2 || r.y1 >= r.y2)
+				continue;
+
+			assert(k < n);
+			assert(memcmp(&r, &out[k], sizeof r) == 0);
+			k++;
+		}
+	}
+	assert(k == n);
+}
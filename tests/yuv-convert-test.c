@@ -0,0 +1,242 @@
+/*
+ * Copyright © 2014 Collabora, Ltd.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+
+#include "../src/yuv-convert.h"
+
+#define WIDTH 1920
+#define HEIGHT 1080
+
+static const char *format_names[] = {
+	[YUV_FORMAT_YUYV] = "YUYV",
+	[YUV_FORMAT_NV12] = "NV12",
+	[YUV_FORMAT_YUV420] = "YUV420",
+};
+
+static struct timespec begin_time;
+
+static void
+reset_timer(void)
+{
+	clock_gettime(CLOCK_MONOTONIC, &begin_time);
+}
+
+static double
+read_timer(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (double)(t.tv_sec - begin_time.tv_sec) +
+	       1e-9 * (t.tv_nsec - begin_time.tv_nsec);
+}
+
+static int running;
+static void
+stopme(int n)
+{
+	running = 0;
+}
+
+static uint8_t *
+create_source(enum yuv_format format, int width, int height, int *stride)
+{
+	uint8_t *data;
+	size_t size;
+	size_t i;
+
+	if (format == YUV_FORMAT_YUYV)
+		*stride = width * 2;
+	else
+		*stride = width;
+
+	/* Exactly what the planes span, so any overread is out of bounds. */
+	size = yuv_buffer_size(format, *stride, width, height);
+	assert(size > 0);
+
+	data = malloc(size);
+	for (i = 0; i < size; i++)
+		data[i] = random();
+
+	return data;
+}
+
+static int
+test_rect(const struct yuv_planes *planes, int width, int height,
+	  int x, int y, int w, int h)
+{
+	uint32_t *a, *b;
+	int stride = width * 4;
+	int ret = 0;
+
+	a = calloc(width * height, 4);
+	b = calloc(width * height, 4);
+
+	yuv_convert_rect_generic(planes, a, stride, x, y, w, h);
+	yuv_convert_rect(planes, b, stride, x, y, w, h);
+
+	/* yuv_convert_rect() may rewrite the pixel left of an odd x */
+	if (x & 1)
+		yuv_convert_rect_generic(planes, a, stride, x - 1, y, 1, h);
+
+	if (memcmp(a, b, width * height * 4) != 0)
+		ret = -1;
+
+	free(a);
+	free(b);
+
+	return ret;
+}
+
+static int
+test_correctness(enum yuv_format format)
+{
+	struct yuv_planes planes;
+	uint8_t *data;
+	int width = 67, height = 33;
+	int stride, x, y, w, h;
+	int i, fails = 0;
+
+	data = create_source(format, width, height, &stride);
+	yuv_planes_init(&planes, format, data, stride, width, height);
+
+	fails += test_rect(&planes, width, height, 0, 0, width, height);
+
+	for (i = 0; i < 1000; i++) {
+		x = random() % width;
+		y = random() % height;
+		w = 1 + random() % (width - x);
+		h = 1 + random() % (height - y);
+		fails += test_rect(&planes, width, height, x, y, w, h) != 0;
+	}
+
+	printf("%s: %d rectangles failed.\n", format_names[format], fails);
+
+	free(data);
+
+	return fails;
+}
+
+static int
+test_buffer_size(void)
+{
+	int fails = 0;
+
+	/* strides that do not cover the width */
+	fails += yuv_buffer_size(YUV_FORMAT_YUYV, 133, 67, 33) != 0;
+	fails += yuv_buffer_size(YUV_FORMAT_NV12, 66, 67, 33) != 0;
+	fails += yuv_buffer_size(YUV_FORMAT_YUV420, 66, 67, 33) != 0;
+
+	/* no complete chroma sample */
+	fails += yuv_buffer_size(YUV_FORMAT_YUYV, 4, 1, 1) != 0;
+
+	/* chroma planes count, not just stride * height */
+	fails += yuv_buffer_size(YUV_FORMAT_YUYV, 134, 67, 33) != 134 * 33;
+	fails += yuv_buffer_size(YUV_FORMAT_NV12, 68, 67, 33) != 68 * 50;
+	fails += yuv_buffer_size(YUV_FORMAT_YUV420, 68, 67, 33) != 68 * 50;
+	fails += yuv_buffer_size(YUV_FORMAT_YUV420, 67, 67, 33) !=
+		67 * 33 + 2 * 33 * 17;
+
+	printf("buffer size: %d checks failed.\n", fails);
+
+	return fails;
+}
+
+static void __attribute__((noinline))
+test_loop_speed(enum yuv_format format, const char *name,
+		void (*convert)(const struct yuv_planes *, uint32_t *, int,
+				int, int, int, int),
+		int w, int h)
+{
+	struct yuv_planes planes;
+	uint32_t *dst;
+	uint8_t *data;
+	unsigned long count = 0;
+	int stride;
+	double t;
+
+	printf("\nRunning 3 s test on %s(), %s %dx%d of %dx%d...\n",
+	       name, format_names[format], w, h, WIDTH, HEIGHT);
+
+	data = create_source(format, WIDTH, HEIGHT, &stride);
+	yuv_planes_init(&planes, format, data, stride, WIDTH, HEIGHT);
+	dst = malloc(WIDTH * HEIGHT * 4);
+
+	running = 1;
+	alarm(3);
+	reset_timer();
+	while (running) {
+		convert(&planes, dst, WIDTH * 4,
+			(WIDTH - w) / 2, (HEIGHT - h) / 2, w, h);
+		count++;
+	}
+	t = read_timer();
+
+	printf("%lu iterations in %f seconds, avg. %.1f us/iter.\n",
+	       count, t, 1e6 * t / count);
+
+	free(dst);
+	free(data);
+}
+
+int main(void)
+{
+	struct sigaction ding;
+	int fails = 0;
+	int f;
+
+	ding.sa_handler = stopme;
+	sigemptyset(&ding.sa_mask);
+	ding.sa_flags = 0;
+	sigaction(SIGALRM, &ding, NULL);
+
+	srandom(13);
+
+	fails += test_buffer_size();
+	for (f = YUV_FORMAT_YUYV; f <= YUV_FORMAT_YUV420; f++)
+		fails += test_correctness(f);
+
+	if (fails)
+		return 1;
+
+	/* A client converting every frame in full, versus the compositor
+	 * converting only a damaged quarter of the frame. */
+	for (f = YUV_FORMAT_YUYV; f <= YUV_FORMAT_YUV420; f++) {
+		test_loop_speed(f, "yuv_convert_rect_generic",
+				yuv_convert_rect_generic, WIDTH, HEIGHT);
+		test_loop_speed(f, "yuv_convert_rect",
+				yuv_convert_rect, WIDTH, HEIGHT);
+		test_loop_speed(f, "yuv_convert_rect",
+				yuv_convert_rect, WIDTH / 2, HEIGHT / 2);
+	}
+
+	return 0;
+}